@@ -22,315 +22,195 @@
 #include "BlockArray.h"
 
 // System
-#include <assert.h>
 #include <sys/mman.h>
-#include <sys/param.h>
-#include <unistd.h>
-#include <stdio.h>
 
 // KDE
-#include <kde_file.h>
 #include <KDebug>
 
 using namespace Konsole;
 
-static int blocksize = 0;
-
-BlockArray::BlockArray()
-    : size(0),
-      current(size_t(-1)),
-      index(size_t(-1)),
-      lastmap(0),
-      lastmap_index(size_t(-1)),
-      lastblock(0), ion(-1),
-      length(0)
+// the buffer is allocated in multiples of the size of a huge page
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+BlockArray::BlockArray(size_t size)
+    : _buffer(0),
+      _size(0),
+      _blockCount(0),
+      _firstRecord(0),
+      _nextRecord(0),
+      _head(0),
+      _tail(0),
+      _lastRecord(-1),
+      _lastOffset(0)
 {
-    // lastmap_index = index = current = size_t(-1);
-    if (blocksize == 0)
-        blocksize = ((sizeof(Block) / getpagesize()) + 1) * getpagesize();
+    _size = ((size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+    if (_size == 0)
+        _size = HUGE_PAGE_SIZE;
+    _blockCount = _size / BLOCK_SIZE;
+
+    void* buffer = mmap(0, _size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+    if (buffer == MAP_FAILED) {
+        kWarning() << "Unable to allocate" << _size << "bytes of history";
+        _size = 0;
+        _blockCount = 0;
+        return;
+    }
 
+#ifdef MADV_HUGEPAGE
+    madvise(buffer, _size, MADV_HUGEPAGE);
+#endif
+
+    _buffer = (unsigned char*)buffer;
+    _blockRecords = QVector<qint64>(_blockCount, -1);
+    _blockOffsets = QVector<size_t>(_blockCount, 0);
 }
 
 BlockArray::~BlockArray()
 {
-    setHistorySize(0);
-    assert(!lastblock);
+    if (_buffer)
+        munmap(_buffer, _size);
 }
 
-size_t BlockArray::append(Block* block)
+size_t BlockArray::maxRecordLength() const
 {
-    if (!size)
-        return size_t(-1);
-
-    ++current;
-    if (current >= size) current = 0;
-
-    int rc;
-    rc = KDE_lseek(ion, current * blocksize, SEEK_SET); if (rc < 0) { perror("HistoryBuffer::add.seek"); setHistorySize(0); return size_t(-1); }
-    rc = write(ion, block, blocksize); if (rc < 0) { perror("HistoryBuffer::add.write"); setHistorySize(0); return size_t(-1); }
-
-    length++;
-    if (length > size) length = size;
-
-    ++index;
-
-    delete block;
-    return current;
-}
-
-size_t BlockArray::newBlock()
-{
-    if (!size)
-        return size_t(-1);
-    append(lastblock);
-
-    lastblock = new Block();
-    return index + 1;
+    if (_size < sizeof(RecordHeader))
+        return 0;
+    return (_size - sizeof(RecordHeader)) & ~(sizeof(quint32) - 1);
 }
 
-Block *BlockArray::lastBlock() const
+size_t BlockArray::recordSize(size_t offset) const
 {
-    return lastblock;
+    // keep records aligned to their headers
+    const RecordHeader* header = (const RecordHeader*)(_buffer + offset);
+    return (sizeof(RecordHeader) + header->length + sizeof(quint32) - 1)
+           & ~(sizeof(quint32) - 1);
 }
 
-bool BlockArray::has(size_t i) const
+size_t BlockArray::nextOffset(size_t offset) const
 {
-    if (i == index + 1)
-        return true;
-
-    if (i > index)
-        return false;
-    if (index - i >= length)
-        return false;
-    return true;
+    const size_t next = offset + recordSize(offset);
+    if (next + sizeof(RecordHeader) > _size ||
+        ((const RecordHeader*)(_buffer + next))->length == PADDING)
+        return 0;
+    return next;
 }
 
-const Block* BlockArray::at(size_t i)
+unsigned char* BlockArray::append(size_t length, unsigned char flags)
 {
-    if (i == index + 1)
-        return lastblock;
-
-    if (i == lastmap_index)
-        return lastmap;
-
-    if (i > index) {
-        //kDebug() << "BlockArray::at() i > index\n";
+    if (!_buffer || length > maxRecordLength())
         return 0;
-    }
-
-//     if (index - i >= length) {
-//         kDebug() << "BlockArray::at() index - i >= length\n";
-//         return 0;
-//     }
-
-    size_t j = i; // (current - (index - i) + (index/size+1)*size) % size ;
 
-    assert(j < size);
-    unmap();
+    const size_t size = (sizeof(RecordHeader) + length + sizeof(quint32) - 1)
+                        & ~(sizeof(quint32) - 1);
 
-    Block* block = (Block*)mmap(0, blocksize, PROT_READ, MAP_PRIVATE, ion, j * blocksize);
+    size_t offset = _tail;
+    if (offset + size > _size) {
+        // the record is stored at the start of the buffer instead.  The
+        // records after the tail are the oldest ones, they are evicted first.
+        while (count() > 0 && _head >= offset)
+            removeFirst();
 
-    if (block == (Block*)-1) { perror("mmap"); return 0; }
+        if (offset + sizeof(RecordHeader) <= _size)
+            ((RecordHeader*)(_buffer + offset))->length = PADDING;
 
-    lastmap = block;
-    lastmap_index = i;
-
-    return block;
-}
+        // the blocks which are skipped start with the new record, so that
+        // the first records of the blocks stay in order
+        for (size_t block = (offset + BLOCK_SIZE - 1) / BLOCK_SIZE; block < _blockCount; block++) {
+            _blockRecords[block] = _nextRecord;
+            _blockOffsets[block] = 0;
+        }
 
-void BlockArray::unmap()
-{
-    if (lastmap) {
-        int res = munmap((char*)lastmap, blocksize);
-        if (res < 0) perror("munmap");
+        offset = 0;
     }
-    lastmap = 0;
-    lastmap_index = size_t(-1);
-}
 
-bool BlockArray::setSize(size_t newsize)
-{
-    return setHistorySize(newsize * 1024 / blocksize);
-}
-
-bool BlockArray::setHistorySize(size_t newsize)
-{
-//    kDebug() << "setHistorySize " << size << " " << newsize;
-
-    if (size == newsize)
-        return false;
-
-    unmap();
-
-    if (!newsize) {
-        delete lastblock;
-        lastblock = 0;
-        if (ion >= 0) close(ion);
-        ion = -1;
-        current = size_t(-1);
-        return true;
+    // evict the oldest records which overlap the new one
+    while (count() > 0 && _head >= offset && _head < offset + size)
+        removeFirst();
+    if (count() == 0)
+        _head = offset;
+
+    RecordHeader* header = (RecordHeader*)(_buffer + offset);
+    header->length = length;
+    header->flags = flags;
+
+    // the record is the first one in the blocks after the one it starts in,
+    // and in that one too if it starts at the beginning of the block
+    const size_t lastBlock = (offset + size - 1) / BLOCK_SIZE;
+    size_t block = (offset + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    for (; block <= lastBlock; block++) {
+        _blockRecords[block] = _nextRecord;
+        _blockOffsets[block] = offset;
     }
 
-    if (!size) {
-        FILE* tmp = tmpfile();
-        if (!tmp) {
-            perror("konsole: cannot open temp file.\n");
-        } else {
-            ion = dup(fileno(tmp));
-            if (ion<0) {
-                perror("konsole: cannot dup temp file.\n");
-                fclose(tmp);
-            }
-        }
-        if (ion < 0)
-            return false;
-
-        assert(!lastblock);
+    _nextRecord++;
+    _tail = offset + size;
 
-        lastblock = new Block();
-        size = newsize;
-        return false;
-    }
-
-    if (newsize > size) {
-        increaseBuffer();
-        size = newsize;
-        return false;
-    } else {
-        decreaseBuffer(newsize);
-        if (ftruncate(ion, length*blocksize) == -1)
-            perror("ftruncate");
-        size = newsize;
-
-        return true;
-    }
+    return (unsigned char*)(header + 1);
 }
 
-void moveBlock(FILE* fion, int cursor, int newpos, char* buffer2)
+void BlockArray::removeFirst()
 {
-    int res = KDE_fseek(fion, cursor * blocksize, SEEK_SET);
-    if (res)
-        perror("fseek");
-    res = fread(buffer2, blocksize, 1, fion);
-    if (res != 1)
-        perror("fread");
-
-    res = KDE_fseek(fion, newpos * blocksize, SEEK_SET);
-    if (res)
-        perror("fseek");
-    res = fwrite(buffer2, blocksize, 1, fion);
-    if (res != 1)
-        perror("fwrite");
-    //    printf("moving block %d to %d\n", cursor, newpos);
+    Q_ASSERT(count() > 0);
+
+    _firstRecord++;
+    _head = count() > 0 ? nextOffset(_head) : _tail;
 }
 
-void BlockArray::decreaseBuffer(size_t newsize)
+void BlockArray::clear()
 {
-    if (index < newsize) // still fits in whole
-        return;
-
-    int offset = (current - (newsize - 1) + size) % size;
-
-    if (!offset)
-        return;
-
-    // The Block constructor could do somthing in future...
-    char* buffer1 = new char[blocksize];
-
-    FILE* fion = fdopen(dup(ion), "w+b");
-    if (!fion) {
-        delete [] buffer1;
-        perror("fdopen/dup");
-        return;
-    }
-
-    int firstblock;
-    if (current <= newsize) {
-        firstblock = current + 1;
-    } else {
-        firstblock = 0;
-    }
-
-    size_t oldpos;
-    for (size_t i = 0, cursor=firstblock; i < newsize; i++) {
-        oldpos = (size + cursor + offset) % size;
-        moveBlock(fion, oldpos, cursor, buffer1);
-        if (oldpos < newsize) {
-            cursor = oldpos;
-        } else
-            cursor++;
-    }
-
-    current = newsize - 1;
-    length = newsize;
-
-    delete [] buffer1;
-
-    fclose(fion);
-
+    _firstRecord = _nextRecord;
+    _head = 0;
+    _tail = 0;
+    _lastRecord = -1;
 }
 
-void BlockArray::increaseBuffer()
+BlockArray::RecordHeader* BlockArray::header(int index) const
 {
-    if (index < size) // not even wrapped once
-        return;
-
-    int offset = (current + size + 1) % size;
-    if (!offset) // no moving needed
-        return;
+    Q_ASSERT(index >= 0 && index < count());
 
-    // The Block constructor could do somthing in future...
-    char* buffer1 = new char[blocksize];
-    char* buffer2 = new char[blocksize];
+    const qint64 record = _firstRecord + index;
 
-    int runs = 1;
-    int bpr = size; // blocks per run
-
-    if (size % offset == 0) {
-        bpr = size / offset;
-        runs = offset;
-    }
-
-    FILE* fion = fdopen(dup(ion), "w+b");
-    if (!fion) {
-        perror("fdopen/dup");
-    delete [] buffer1;
-    delete [] buffer2;
-        return;
+    // start from the oldest record, or the one which was found last
+    qint64 current = _firstRecord;
+    size_t offset = _head;
+    if (_lastRecord >= _firstRecord && _lastRecord <= record) {
+        current = _lastRecord;
+        offset = _lastOffset;
     }
 
-    int res;
-    for (int i = 0; i < runs; i++)
-    {
-        // free one block in chain
-        int firstblock = (offset + i) % size;
-        res = KDE_fseek(fion, firstblock * blocksize, SEEK_SET);
-        if (res)
-            perror("fseek");
-        res = fread(buffer1, blocksize, 1, fion);
-        if (res != 1)
-            perror("fread");
-        int newpos = 0;
-        for (int j = 1, cursor=firstblock; j < bpr; j++)
-        {
-            cursor = (cursor + offset) % size;
-            newpos = (cursor - offset + size) % size;
-            moveBlock(fion, cursor, newpos, buffer2);
+    // the blocks after the one holding the oldest record, up to the one
+    // holding the newest record, have first records in ascending order.
+    // Find the last one which starts at or before the record.
+    const size_t headBlock = _head / BLOCK_SIZE;
+    const size_t tailBlock = (_tail - 1) / BLOCK_SIZE;
+    size_t blocks = (tailBlock + _blockCount - headBlock) % _blockCount;
+    if (blocks == 0 && _head >= _tail)
+        blocks = _blockCount;
+
+    size_t low = 1;
+    size_t high = blocks;
+    while (low <= high) {
+        const size_t middle = (low + high) / 2;
+        const size_t block = (headBlock + middle) % _blockCount;
+        if (_blockRecords[block] <= record) {
+            if (_blockRecords[block] > current) {
+                current = _blockRecords[block];
+                offset = _blockOffsets[block];
+            }
+            low = middle + 1;
+        } else {
+            high = middle - 1;
         }
-        res = KDE_fseek(fion, i * blocksize, SEEK_SET);
-        if (res)
-            perror("fseek");
-        res = fwrite(buffer1, blocksize, 1, fion);
-        if (res != 1)
-            perror("fwrite");
     }
-    current = size - 1;
-    length = size;
 
-    delete [] buffer1;
-    delete [] buffer2;
+    // walk the headers of the records in between
+    while (current < record) {
+        offset = nextOffset(offset);
+        current++;
+    }
 
-    fclose(fion);
+    _lastRecord = record;
+    _lastOffset = offset;
 
+    return (RecordHeader*)(_buffer + offset);
 }
-
@@ -21,99 +21,116 @@
 #ifndef BLOCKARRAY_H
 #define BLOCKARRAY_H
 
-#include <unistd.h>
+// System
+#include <stddef.h>
 
-#define BLOCKSIZE (1 << 12)
-#define ENTRIES   ((BLOCKSIZE - sizeof(size_t) ) / sizeof(unsigned char))
+// Qt
+#include <QtCore/QVector>
 
 namespace Konsole
 {
 
-struct Block {
-    Block() { size = 0; }
-    unsigned char data[ENTRIES];
-    size_t size;
-};
-
-// ///////////////////////////////////////////////////////
-
-class BlockArray {
+/**
+ * A ring buffer of fixed-size blocks holding variable-length records.
+ *
+ * The blocks are allocated in one piece of memory, which is sized in
+ * multiples of 2MB so that the kernel can back it with huge pages.
+ *
+ * Each record is stored as a header with the record's length and flags,
+ * followed by the record's data, and the records are found by walking from
+ * one header to the next.  Records are stored one after another and may
+ * span several blocks.  A record which does not fit at the end of the
+ * buffer is stored at its start instead.  The oldest records are evicted
+ * when the memory they use is needed for a new record, so appending and
+ * evicting records take constant time.
+ *
+ * To find a record without walking all of the records before it, the
+ * buffer keeps the first record in each block.
+ */
+class BlockArray
+{
 public:
-    /**
-    * Creates a history file for holding
-    * maximal size blocks. If more blocks
-    * are requested, then it drops earlier
-    * added ones.
-    */
-    BlockArray();
-
-    /// destructor
-    ~BlockArray();
-
-    /**
-    * adds the Block at the end of history.
-    * This may drop other blocks.
-    *
-    * The ownership on the block is transferred.
-    * An unique index number is returned for accessing
-    * it later (if not yet dropped then)
-    *
-    * Note, that the block may be dropped completely
-    * if history is turned off.
-    */
-    size_t append(Block* block);
-
-    /**
-    * gets the block at the index. Function may return
-    * 0 if the block isn't available any more.
-    *
-    * The returned block is strictly readonly as only
-    * maped in memory - and will be invalid on the next
-    * operation on this class.
-    */
-    const Block* at(size_t index);
+    /** The size of each block in bytes */
+    static const size_t BLOCK_SIZE = 1 << 16;
 
     /**
-    * reorders blocks as needed. If newsize is null,
-    * the history is emptied completely. The indices
-    * returned on append won't change their semantic,
-    * but they may not be valid after this call.
-    */
-    bool setHistorySize(size_t newsize);
-
-    size_t newBlock();
+     * Creates a ring buffer with enough blocks to hold at least
+     * @p size bytes of records.
+     */
+    explicit BlockArray(size_t size);
+    ~BlockArray();
 
-    Block* lastBlock() const;
+    /** Returns the number of records in the buffer. */
+    int count() const { return int(_nextRecord - _firstRecord); }
 
     /**
-    * Convenient function to set the size in KBytes
-    * instead of blocks
-    */
-    bool setSize(size_t newsize);
-
-    size_t len() const { return length; }
-
-    bool has(size_t index) const;
-
-    size_t getCurrent() const { return current; }
+     * Appends a new record of @p length bytes with the given @p flags,
+     * evicting the oldest records if necessary, and returns a pointer to the
+     * data of the record for the caller to fill in.
+     *
+     * Returns 0 if the record is longer than maxRecordLength()
+     */
+    unsigned char* append(size_t length, unsigned char flags);
+    /** Removes the oldest record. */
+    void removeFirst();
+    /** Removes all records. */
+    void clear();
+
+    /** Returns the length of the record at @p index, where 0 is the oldest record. */
+    size_t length(int index) const { return header(index)->length; }
+    /** Returns the flags of the record at @p index. */
+    unsigned char flags(int index) const { return header(index)->flags; }
+    /** Sets the flags of the record at @p index. */
+    void setFlags(int index, unsigned char flags) { header(index)->flags = flags; }
+    /** Returns the data of the record at @p index. */
+    const unsigned char* data(int index) const
+    { return (const unsigned char*)(header(index) + 1); }
+
+    /** Returns the number of bytes of memory used by the buffer. */
+    size_t memoryUsage() const { return _size; }
+
+    /** Returns the maximum length of a single record. */
+    size_t maxRecordLength() const;
 
 private:
-    void unmap();
-    void increaseBuffer();
-    void decreaseBuffer(size_t newsize);
-
-    size_t size;
-    // current always shows to the last inserted block
-    size_t current;
-    size_t index;
-
-    Block* lastmap;
-    size_t lastmap_index;
-    Block* lastblock;
-
-    int ion;
-    size_t length;
-
+    struct RecordHeader
+    {
+        quint32 length;
+        unsigned char flags;
+        unsigned char reserved[3];
+    };
+
+    // the length of the header which fills the rest of the buffer when the
+    // next record is stored at its start
+    static const quint32 PADDING = 0xFFFFFFFF;
+
+    // returns the size of the record starting at 'offset', including its header
+    size_t recordSize(size_t offset) const;
+    // returns the offset of the record after the one at 'offset'
+    size_t nextOffset(size_t offset) const;
+    RecordHeader* header(int index) const;
+
+    unsigned char* _buffer;
+    size_t _size;
+    size_t _blockCount;
+
+    // records are numbered in the order in which they were appended.
+    // _firstRecord is the oldest record, which starts at _head, and
+    // _nextRecord is the next one to be appended, which starts at _tail.
+    qint64 _firstRecord;
+    qint64 _nextRecord;
+    size_t _head;
+    size_t _tail;
+
+    // the number and the offset of the first record which overlaps each
+    // block.  A record which spans several blocks is the first record of
+    // each block after the one it starts in.
+    QVector<qint64> _blockRecords;
+    QVector<size_t> _blockOffsets;
+
+    // the record which was found last, records are usually read in order
+    mutable qint64 _lastRecord;
+    mutable size_t _lastOffset;
 };
 
 }
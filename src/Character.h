@@ -25,9 +25,15 @@
 
 // Qt
 #include <QtCore/QHash>
+#include <QtCore/QPair>
+#include <QtCore/QVector>
+
+// System
+#include <string.h>
 
 // Konsole
 #include "CharacterColor.h"
+#include "konsole_export.h"
 
 namespace Konsole
 {
@@ -203,6 +209,54 @@ inline ColorEntry::FontWeight Character::fontWeight(const ColorEntry* base) cons
         return ColorEntry::UseCurrentFormat;
 }
 
+/** A range of columns [first,second) in a line of characters. */
+typedef QPair<int,int> ColumnRange;
+
+/**
+ * Compares the first @p count characters of @p oldLine and @p newLine
+ * and appends the ranges of columns which differ to @p ranges.
+ * Adjacent changed columns are merged into a single range.
+ *
+ * Characters are compared a block at a time with memcmp(), which the C
+ * library implements with vector instructions where they are available.
+ * Only the blocks which differ are compared again character by character,
+ * so lines which have not changed are skipped quickly.  If Character
+ * contains padding bytes, every character is compared individually.
+ */
+inline void findChangedColumns(const Character* oldLine, const Character* newLine,
+                               int count, QVector<ColumnRange>& ranges)
+{
+    static const int BLOCK_SIZE = 16;
+    // the padding bytes of a Character are not initialized, so blocks
+    // can only be compared as memory if there are none
+    static const bool comparableAsMemory = sizeof(Character) ==
+        sizeof(quint16) + sizeof(quint8) + 2 * sizeof(CharacterColor) + sizeof(bool);
+
+    int x = 0;
+    while (x < count)
+    {
+        const int blockEnd = qMin(x + BLOCK_SIZE, count);
+        if (comparableAsMemory &&
+            memcmp(oldLine + x, newLine + x, (blockEnd - x) * sizeof(Character)) == 0)
+        {
+            x = blockEnd;
+            continue;
+        }
+
+        // characters which only differ in isRealCharacter are equal
+        for ( ; x < blockEnd ; x++)
+        {
+            if (oldLine[x] == newLine[x])
+                continue;
+
+            if (!ranges.isEmpty() && ranges.last().second == x)
+                ranges.last().second = x + 1;
+            else
+                ranges.append(ColumnRange(x, x + 1));
+        }
+    }
+}
+
 
 /**
  * A table which stores sequences of unicode characters, referenced
@@ -210,7 +264,7 @@ inline ColorEntry::FontWeight Character::fontWeight(const ColorEntry* base) cons
  * character ( ushort ) so that it can occupy the same space in
  * a structure.
  */
-class ExtendedCharTable
+class KONSOLEPRIVATE_EXPORT ExtendedCharTable
 {
 public:
     /** Constructs a new character table. */
@@ -148,6 +148,7 @@ extern const ColorEntry base_color_table[TABLE_COLORS] KDE_NO_EXPORT;
 class CharacterColor
 {
     friend class Character;
+    friend class HistoryScrollJournal; // writes colors to the history journal
 
 public:
   /** Constructs a new CharacterColor whose color and color space are undefined. */
@@ -199,11 +200,18 @@ public:
   /**
    * Returns true if this character color entry is valid.
    */
-  bool isValid() 
+  bool isValid() const
   {
         return _colorSpace != COLOR_SPACE_UNDEFINED;
   }
 
+  /**
+   * Returns the index of this color in a palette made of the TABLE_COLORS
+   * entries of a color table followed by the 256 colors of the 256 color
+   * space, or -1 if this color is an RGB value or undefined.
+   */
+  int paletteIndex() const;
+
   /**
    * Set this color as an intensive system color.
    *
@@ -283,6 +291,17 @@ inline QColor CharacterColor::color(const ColorEntry* base) const
   return QColor();
 }
 
+inline int CharacterColor::paletteIndex() const
+{
+  switch (_colorSpace)
+  {
+    case COLOR_SPACE_DEFAULT: return _u+0+(_v?BASE_COLORS:0);
+    case COLOR_SPACE_SYSTEM: return _u+2+(_v?BASE_COLORS:0);
+    case COLOR_SPACE_256: return TABLE_COLORS+_u;
+    default: return -1;
+  }
+}
+
 inline void CharacterColor::setIntensive()
 {
   if (_colorSpace == COLOR_SPACE_SYSTEM || _colorSpace == COLOR_SPACE_DEFAULT)
@@ -0,0 +1,89 @@
+/*
+    Copyright 2012 by Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "DamageAccumulator.h"
+
+using namespace Konsole;
+
+DamageAccumulator::DamageAccumulator(int maxBands)
+    : _maxBands(qMax(1, maxBands))
+{
+}
+
+void DamageAccumulator::addLine(int line, int startColumn, int endColumn)
+{
+    if (endColumn <= startColumn)
+        return;
+
+    if (!_bands.isEmpty()) {
+        QRect& band = _bands.last();
+
+        // extend the last band if the line is part of it or follows it
+        // and the changed columns overlap
+        const bool sameLine = band.bottom() == line;
+        const bool nextLine = band.bottom() + 1 == line &&
+                              startColumn <= band.right() + 1 &&
+                              endColumn >= band.left();
+        if (sameLine || nextLine) {
+            band.setLeft(qMin(band.left(), startColumn));
+            band.setRight(qMax(band.right(), endColumn - 1));
+            band.setBottom(line);
+            return;
+        }
+    }
+
+    _bands.append(QRect(startColumn, line, endColumn - startColumn, 1));
+}
+
+bool DamageAccumulator::isEmpty() const
+{
+    return _bands.isEmpty();
+}
+
+void DamageAccumulator::clear()
+{
+    _bands.clear();
+}
+
+QVector<QRect> DamageAccumulator::bands() const
+{
+    if (_bands.count() <= _maxBands)
+        return _bands;
+
+    // too many separate areas, painting everything in between is cheaper
+    // than clipping against all of them
+    QRect bounds;
+    foreach (const QRect& band, _bands)
+        bounds |= band;
+
+    return QVector<QRect>() << bounds;
+}
+
+QRegion DamageAccumulator::region(const QPoint& origin, int cellWidth, int cellHeight) const
+{
+    QRegion region;
+    foreach (const QRect& band, bands()) {
+        region |= QRect(origin.x() + band.x() * cellWidth,
+                        origin.y() + band.y() * cellHeight,
+                        band.width() * cellWidth,
+                        band.height() * cellHeight);
+    }
+    return region;
+}
@@ -0,0 +1,86 @@
+/*
+    Copyright 2012 by Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef DAMAGEACCUMULATOR_H
+#define DAMAGEACCUMULATOR_H
+
+// Qt
+#include <QtCore/QRect>
+#include <QtCore/QVector>
+#include <QtGui/QRegion>
+
+// Konsole
+#include "konsole_export.h"
+
+namespace Konsole
+{
+
+/**
+ * Collects the areas of a terminal display which need to be repainted,
+ * in units of character cells, and turns them into a simple region.
+ *
+ * Adding one rectangle for every changed line to a QRegion produces a
+ * region made of many rectangles when a lot of output arrives, and every
+ * paint operation is then clipped against all of them.  Instead, the
+ * damage of adjacent lines whose changed columns overlap is merged into
+ * a single band which covers only the changed columns of those lines.
+ * If more than a given number of bands are needed, the bounding
+ * rectangle of all of them is used instead.
+ *
+ * Lines are expected to be added from top to bottom.
+ */
+class KONSOLEPRIVATE_EXPORT DamageAccumulator
+{
+public:
+    /**
+     * Constructs an empty accumulator which produces at most
+     * @p maxBands rectangles.
+     */
+    explicit DamageAccumulator(int maxBands = 16);
+
+    /**
+     * Marks the columns from @p startColumn up to, but not including,
+     * @p endColumn of @p line as needing to be repainted.
+     */
+    void addLine(int line, int startColumn, int endColumn);
+
+    /** Returns true if nothing needs to be repainted. */
+    bool isEmpty() const;
+
+    /** Removes all damage. */
+    void clear();
+
+    /** Returns the damaged areas as rectangles of cells. */
+    QVector<QRect> bands() const;
+
+    /**
+     * Returns the damaged area in pixels, for a display whose first cell
+     * is at @p origin and whose cells are @p cellWidth by @p cellHeight
+     * pixels.
+     */
+    QRegion region(const QPoint& origin, int cellWidth, int cellHeight) const;
+
+private:
+    int _maxBands;
+    QVector<QRect> _bands;
+};
+
+}
+
+#endif // DAMAGEACCUMULATOR_H
@@ -1079,6 +1079,7 @@ void EditProfileDialog::setupScrollingPage(const Profile::Ptr profile)
     RadioOption types[] = { {_ui->disableScrollbackButton,Profile::DisableHistory,SLOT(noScrollBack())},
                             {_ui->fixedScrollbackButton,Profile::FixedSizeHistory,SLOT(fixedScrollBack())},
                             {_ui->unlimitedScrollbackButton,Profile::UnlimitedHistory,SLOT(unlimitedScrollBack())},
+                            {_ui->persistentScrollbackButton,Profile::PersistentHistory,SLOT(persistentScrollBack())},
                             {0,0,0} };
     setupRadio( types , scrollBackType ); 
 
@@ -1109,6 +1110,10 @@ void EditProfileDialog::unlimitedScrollBack()
 {
     updateTempProfileProperty(Profile::HistoryMode , Profile::UnlimitedHistory );
 }
+void EditProfileDialog::persistentScrollBack()
+{
+    updateTempProfileProperty(Profile::HistoryMode , Profile::PersistentHistory );
+}
 void EditProfileDialog::hideScrollBar()
 {
     updateTempProfileProperty(Profile::ScrollBarPosition , Profile::ScrollBarHidden );
@@ -147,6 +147,7 @@ private slots:
     void noScrollBack();
     void fixedScrollBack();
     void unlimitedScrollBack();
+    void persistentScrollBack();
 
     void scrollBackLinesChanged(int);
 
@@ -155,6 +155,31 @@ const HistoryType& Emulation::history() const
     return _screen[0]->getScroll();
 }
 
+qint64 Emulation::historyMemoryUsage() const
+{
+    return _screen[0]->historyMemoryUsage();
+}
+
+qint64 Emulation::releaseHistoryMemory(qint64 bytes)
+{
+    return _screen[0]->releaseHistoryMemory(bytes);
+}
+
+void Emulation::setHistorySearchIndexLimit(qint64 bytes)
+{
+    _screen[0]->setHistorySearchIndexLimit(bytes);
+}
+
+qint64 Emulation::historySearchIndexLimit() const
+{
+    return _screen[0]->historySearchIndexLimit();
+}
+
+qint64 Emulation::historySearchIndexMemoryUsage() const
+{
+    return _screen[0]->historySearchIndexMemoryUsage();
+}
+
 void Emulation::setCodec(const QTextCodec * codec)
 {
     if ( codec )
@@ -327,6 +352,13 @@ void Emulation::writeToStream( TerminalCharacterDecoder* decoder ,
     _currentScreen->writeLinesToStream(decoder,startLine,endLine);
 }
 
+QList< QPair<int,int> > Emulation::searchCandidates(const QString& text,
+                                                  int startLine,
+                                                  int endLine) const
+{
+    return _currentScreen->searchCandidates(text,startLine,endLine);
+}
+
 int Emulation::lineCount() const
 {
     // sum number of lines currently on _screen plus number of lines in history
@@ -28,6 +28,8 @@
 
 // Qt
 #include <QtGui/QKeyEvent>
+#include <QtCore/QList>
+#include <QtCore/QPair>
 #include <QtCore/QTextCodec>
 #include <QtCore/QTextStream>
 #include <QtCore/QTimer>
@@ -156,6 +158,28 @@ public:
   const HistoryType& history() const;
   /** Clears the history scroll. */
   void clearHistory();
+  /** Returns the number of bytes of memory used by the history store. */
+  qint64 historyMemoryUsage() const;
+  /**
+   * Moves the oldest lines of the history store out of memory until at least
+   * @p bytes have been released.  Returns the number of bytes released.
+   */
+  qint64 releaseHistoryMemory(qint64 bytes);
+  /**
+   * Sets the number of bytes of memory which the index of the history store
+   * may use.  A limit of 0 disables the index.
+   */
+  void setHistorySearchIndexLimit(qint64 bytes);
+  /** Returns the limit set with setHistorySearchIndexLimit() */
+  qint64 historySearchIndexLimit() const;
+  /** Returns the number of bytes of memory used by the index of the history store. */
+  qint64 historySearchIndexMemoryUsage() const;
+
+  /**
+   * Returns the ranges of lines from @p startLine to @p endLine which may contain
+   * @p text.  Lines outside of these ranges can be skipped when searching the output.
+   */
+  QList< QPair<int,int> > searchCandidates(const QString& text,int startLine,int endLine) const;
 
   /**
    * Copies the output history from @p startLine to @p endLine
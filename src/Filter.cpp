@@ -22,19 +22,26 @@
 
 // System
 #include <iostream>
+#include <limits.h>
 
 // Qt
 #include <QtGui/QAction>
 #include <QtGui/QApplication>
 #include <QtGui/QClipboard>
+#include <QtCore/QBitArray>
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QtAlgorithms>
 #include <QtCore/QString>
 #include <QtCore/QTextStream>
 #include <QtCore/QSharedData>
 #include <QtCore/QFile>
 
 // KDE
+#include <KDebug>
 #include <KLocale>
 #include <KRun>
+#include <KShell>
 
 // Konsole
 #include "TerminalCharacterDecoder.h"
@@ -42,6 +49,11 @@
 
 using namespace Konsole;
 
+FilterChain::FilterChain()
+    : _indexValid(false)
+{
+}
+
 FilterChain::~FilterChain()
 {
     QMutableListIterator<Filter*> iter(*this);
@@ -57,10 +69,12 @@ FilterChain::~FilterChain()
 void FilterChain::addFilter(Filter* filter)
 {
     append(filter);
+    _indexValid = false;
 }
 void FilterChain::removeFilter(Filter* filter)
 {
     removeAll(filter);
+    _indexValid = false;
 }
 bool FilterChain::containsFilter(Filter* filter)
 {
@@ -87,98 +101,329 @@ void FilterChain::process()
 void FilterChain::clear()
 {
     QList<Filter*>::clear();
+    _indexValid = false;
+}
+void FilterChain::updateIndex() const
+{
+    bool current = _indexValid && _indexedGenerations.count() == count();
+    for (int i = 0 ; current && i < count() ; i++)
+        current = _indexedGenerations[i] == at(i)->_generation;
+
+    if ( current )
+        return;
+
+    _indexedGenerations.resize(count());
+    _indexedHotSpots.clear();
+    for (int i = 0 ; i < _lineSpans.count() ; i++)
+        _lineSpans[i].clear();
+
+    for (int i = 0 ; i < count() ; i++)
+    {
+        const Filter* filter = at(i);
+        _indexedGenerations[i] = filter->_generation;
+        _indexedHotSpots << filter->_hotspotList;
+
+        foreach( Filter::HotSpot* spot , filter->_hotspotList )
+        {
+            if ( spot->endLine() >= _lineSpans.count() )
+                _lineSpans.resize(spot->endLine() + 1);
+
+            for (int line = qMax(0, spot->startLine()) ; line <= spot->endLine() ; line++)
+            {
+                Span span;
+                span.startColumn = (line == spot->startLine()) ? spot->startColumn() : 0;
+                span.endColumn = (line == spot->endLine()) ? spot->endColumn() : INT_MAX;
+                span.maxEndColumn = 0;
+                span.filterIndex = i;
+                span.spot = spot;
+                _lineSpans[line] << span;
+            }
+        }
+    }
+
+    for (int line = 0 ; line < _lineSpans.count() ; line++)
+    {
+        QVector<Span>& spans = _lineSpans[line];
+        qStableSort(spans.begin(), spans.end());
+
+        int maxEndColumn = -1;
+        for (int i = 0 ; i < spans.count() ; i++)
+        {
+            maxEndColumn = qMax(maxEndColumn, spans[i].endColumn);
+            spans[i].maxEndColumn = maxEndColumn;
+        }
+    }
+
+    _indexValid = true;
 }
 Filter::HotSpot* FilterChain::hotSpotAt(int line , int column) const
 {
-    QListIterator<Filter*> iter(*this);
-    while (iter.hasNext())
+    updateIndex();
+
+    if ( line < 0 || line >= _lineSpans.count() )
+        return 0;
+
+    const QVector<Span>& spans = _lineSpans[line];
+
+    // find the spans which start at or before column
+    int first = 0;
+    int last = spans.count();
+    while ( first < last )
     {
-        Filter* filter = iter.next();
-        Filter::HotSpot* spot = filter->hotSpotAt(line,column);
-        if ( spot != 0 )
+        const int middle = (first + last) / 2;
+        if ( spans[middle].startColumn <= column )
+            first = middle + 1;
+        else
+            last = middle;
+    }
+
+    // of those, return the one found by the first filter in the chain
+    // which ends at or after column
+    Filter::HotSpot* spot = 0;
+    int filterIndex = count();
+    for (int i = first - 1 ; i >= 0 && spans[i].maxEndColumn >= column ; i--)
+    {
+        if ( spans[i].endColumn >= column && spans[i].filterIndex < filterIndex )
         {
-            return spot;
+            spot = spans[i].spot;
+            filterIndex = spans[i].filterIndex;
         }
     }
 
-    return 0;
+    return spot;
 }
 
 QList<Filter::HotSpot*> FilterChain::hotSpots() const
 {
+    updateIndex();
+    return _indexedHotSpots;
+}
+QList<Filter::HotSpot*> FilterChain::hotSpotsInLines(int firstLine , int lastLine) const
+{
+    updateIndex();
+
+    firstLine = qMax(0, firstLine);
+    lastLine = qMin(lastLine, _lineSpans.count() - 1);
+
     QList<Filter::HotSpot*> list;
-    QListIterator<Filter*> iter(*this);
-    while (iter.hasNext())
+    for (int line = firstLine ; line <= lastLine ; line++)
     {
-        Filter* filter = iter.next();
-        list << filter->hotSpots();
+        foreach( const Span& span , _lineSpans[line] )
+        {
+            // hotspots covering several lines are returned with the first
+            // of their lines in the range
+            if ( line == qMax(firstLine, span.spot->startLine()) )
+                list << span.spot;
+        }
     }
     return list;
 }
 //QList<Filter::HotSpot*> FilterChain::hotSpotsAtLine(int line) const;
 
 TerminalImageFilterChain::TerminalImageFilterChain()
-: _buffer(0)
-, _linePositions(0)
 {
 }
 
 TerminalImageFilterChain::~TerminalImageFilterChain()
 {
-    delete _buffer;
-    delete _linePositions;
 }
 
+/**
+ * Searches text for the anchors of a group of filters in a single pass,
+ * to find out which of the filters can find matches in the text.
+ */
+class AnchorScanner
+{
+public:
+    AnchorScanner()
+        : _firstCharacters(0x10000)
+        , _filterCount(0)
+    {
+    }
+
+    /** Adds the anchors of @p filter, which is the filter with index @p index */
+    void addFilter(int index, const Filter* filter)
+    {
+        _filterCount = qMax(_filterCount, index + 1);
+
+        foreach( const QString& text , filter->anchors() )
+        {
+            Anchor anchor;
+            anchor.text = text;
+            anchor.caseSensitivity = filter->anchorCaseSensitivity();
+            anchor.filter = index;
+
+            // candidates are looked up by the lower case form of their first
+            // character, which serves case sensitive and insensitive anchors
+            const ushort key = text.at(0).toLower().unicode();
+            _firstCharacters.setBit(key);
+            _anchors.insert(key, anchor);
+        }
+    }
+
+    bool isEmpty() const
+    {
+        return _anchors.isEmpty();
+    }
+
+    /**
+     * Returns a bit for each filter added, which is set if one of the
+     * filter's anchors occurs in @p text.
+     */
+    QBitArray scan(const QString& text) const
+    {
+        QBitArray found(_filterCount);
+        int remaining = _filterCount;
+
+        const QChar* data = text.constData();
+        const int length = text.length();
+        for (int i = 0 ; i < length && remaining > 0 ; i++)
+        {
+            const ushort key = data[i].toLower().unicode();
+            if ( !_firstCharacters.testBit(key) )
+                continue;
+
+            QMultiHash<ushort,Anchor>::const_iterator iter = _anchors.constFind(key);
+            for ( ; iter != _anchors.constEnd() && iter.key() == key ; ++iter )
+            {
+                const Anchor& anchor = iter.value();
+                if ( found.testBit(anchor.filter) || i + anchor.text.length() > length )
+                    continue;
+
+                if ( QStringRef(&text, i, anchor.text.length()).compare(anchor.text, anchor.caseSensitivity) == 0 )
+                {
+                    found.setBit(anchor.filter);
+                    remaining--;
+                }
+            }
+        }
+        return found;
+    }
+
+private:
+    struct Anchor
+    {
+        QString text;
+        Qt::CaseSensitivity caseSensitivity;
+        int filter;
+    };
+
+    QBitArray _firstCharacters;
+    QMultiHash<ushort,Anchor> _anchors;
+    int _filterCount;
+};
+
 void TerminalImageFilterChain::setImage(const Character* const image , int lines , int columns, const QVector<LineProperty>& lineProperties)
 {
     if (empty())
         return;
 
-    // reset all filters and hotspots
-    reset();
-
     PlainTextDecoder decoder;
     decoder.setTrailingWhitespace(false);
 
-    // setup new shared buffers for the filters to process on
-    QString* newBuffer = new QString();
-    QList<int>* newLinePositions = new QList<int>();
-    setBuffer( newBuffer , newLinePositions );
-
-    // free the old buffers
-    delete _buffer;
-    delete _linePositions;
-
-    _buffer = newBuffer;
-    _linePositions = newLinePositions;
-
-    QTextStream lineStream(_buffer);
-    decoder.begin(&lineStream);
-
-    for (int i=0 ; i < lines ; i++)
-    {
-        _linePositions->append(_buffer->length());
-        decoder.decodeLine(image + i*columns,columns,LINE_DEFAULT);
-
-        // pretend that each line ends with a newline character.
-        // this prevents a link that occurs at the end of one line
-        // being treated as part of a link that occurs at the start of the next line
-        //
-        // the downside is that links which are spread over more than one line are not
-        // highlighted.  
-        //
-        // TODO - Use the "line wrapped" attribute associated with lines in a
-        // terminal image to avoid adding this imaginary character for wrapped
-        // lines
-        if ( !(lineProperties.value(i,LINE_DEFAULT) & LINE_WRAPPED) )
-            lineStream << QChar('\n');
+    // filters without anchors process every block which has changed, the
+    // others only the blocks in which the scanner finds their anchors
+    AnchorScanner scanner;
+    for (int i = 0 ; i < count() ; i++)
+    {
+        at(i)->beginImage();
+        scanner.addFilter(i, at(i));
+    }
+
+    int firstLine = 0;
+    while (firstLine < lines)
+    {
+        // lines which are wrapped onto the next line are processed together
+        // with it, so that links which are spread over more than one line
+        // are found
+        int lastLine = firstLine;
+        while ( lastLine < lines-1 && (lineProperties.value(lastLine,LINE_DEFAULT) & LINE_WRAPPED) )
+            lastLine++;
+
+        const Character* characters = image + firstLine*columns;
+        const int count = (lastLine - firstLine + 1) * columns;
+        const uint hash = qHash( QByteArray::fromRawData((const char*)characters, count*sizeof(Character)) );
+
+        QString buffer;
+        QList<int> linePositions;
+        QVector<int> columnPositions;
+        QBitArray anchorsFound;
+        bool decoded = false;
+
+        for (int i = 0 ; i < size() ; i++)
+        {
+            Filter* filter = at(i);
+            if ( filter->reuseBlock(hash, characters, count, firstLine) )
+                continue;
+
+            // the block is new or has changed, decode it the first time
+            // a filter needs its text
+            if ( !decoded )
+            {
+                QTextStream lineStream(&buffer);
+                decoder.begin(&lineStream);
+                for (int line = firstLine ; line <= lastLine ; line++)
+                {
+                    lineStream.flush();
+                    linePositions.append(buffer.length());
+                    decoder.decodeLine(image + line*columns,columns,LINE_DEFAULT);
+                }
+
+                // pretend that each block ends with a newline character.
+                // this prevents a link that occurs at the end of one block
+                // being treated as part of a link that occurs at the start of the next one
+                lineStream << QChar('\n');
+                decoder.end();
+                lineStream.flush();
+
+                if ( !scanner.isEmpty() )
+                    anchorsFound = scanner.scan(buffer);
+
+                decoded = true;
+            }
+
+            if ( !filter->anchors().isEmpty() && !anchorsFound.testBit(i) )
+            {
+                filter->processBlock(hash, characters, count, firstLine, 0, 0, 0);
+                continue;
+            }
+
+            // measure the text once for all filters, so that each match
+            // found can be converted to a column without measuring it again
+            if ( columnPositions.isEmpty() )
+            {
+                columnPositions.resize(buffer.length() + 1);
+                int width = 0;
+                for (int j = 0 ; j < buffer.length() ; j++)
+                {
+                    columnPositions[j] = width;
+                    width += konsole_wcwidth(buffer.at(j).unicode());
+                }
+                columnPositions[buffer.length()] = width;
+            }
+
+            filter->processBlock(hash, characters, count, firstLine,
+                                 &buffer, &linePositions, &columnPositions);
+        }
+
+        firstLine = lastLine + 1;
     }
-    decoder.end();
+
+    for (int i = 0 ; i < size() ; i++)
+        at(i)->endImage();
 }
 
 Filter::Filter() :
+_generation(0),
 _linePositions(0),
-_buffer(0)
+_buffer(0),
+_columnPositions(0),
+_lineOffset(0),
+_anchorCaseSensitivity(Qt::CaseSensitive),
+_timeBudget(0),
+_timeUsed(0),
+_processStart(-1),
+_budgetExceeded(false)
 {
 }
 
@@ -192,14 +437,168 @@ Filter::~Filter()
 }
 void Filter::reset()
 {
+    qDeleteAll(_hotspotList);
+    _hotspots.clear();
+    _hotspotList.clear();
+    _blocks.clear();
+    _generation++;
+}
+
+void Filter::beginImage()
+{
+    // the hotspots of the previous image are kept with the blocks they
+    // were found in until they are either reused or deleted by endImage()
+    _previousBlocks = _blocks;
+    _blocks.clear();
     _hotspots.clear();
     _hotspotList.clear();
+    _generation++;
+
+    _timeUsed = 0;
+    _budgetExceeded = false;
+}
+
+bool Filter::reuseBlock(uint hash, const Character* characters, int count, int firstLine)
+{
+    QMultiHash<uint,Block>::iterator iter = _previousBlocks.find(hash);
+    while ( iter != _previousBlocks.end() && iter.key() == hash )
+    {
+        const Block& block = iter.value();
+        if ( block.complete && block.characters.count() == count &&
+             memcmp(block.characters.constData(), characters, count*sizeof(Character)) == 0 )
+        {
+            const int offset = firstLine - block.firstLine;
+            foreach( HotSpot* spot , block.hotSpots )
+            {
+                spot->_startLine += offset;
+                spot->_endLine += offset;
+                addHotSpot(spot);
+            }
+
+            Block movedBlock = block;
+            movedBlock.firstLine = firstLine;
+            _blocks.insert(hash, movedBlock);
+            _previousBlocks.erase(iter);
+            return true;
+        }
+        ++iter;
+    }
+    return false;
+}
+
+void Filter::processBlock(uint hash, const Character* characters, int count, int firstLine,
+                          const QString* buffer, const QList<int>* linePositions,
+                          const QVector<int>* columnPositions)
+{
+    const int firstHotSpot = _hotspotList.count();
+    bool complete = true;
+
+    if ( buffer )
+    {
+        if ( timeBudgetExceeded() )
+        {
+            complete = false;
+        }
+        else
+        {
+            if ( _timeBudget > 0 )
+                _processStart = currentTime();
+
+            setBuffer(buffer, linePositions, columnPositions);
+            _lineOffset = firstLine;
+            process();
+            _lineOffset = 0;
+            setBuffer(0, 0);
+
+            if ( _timeBudget > 0 )
+            {
+                _timeUsed += currentTime() - _processStart;
+                _processStart = -1;
+            }
+
+            // the filter stopped part way through the block
+            complete = !_budgetExceeded;
+        }
+    }
+
+    Block block;
+    block.characters = QVector<Character>(count);
+    memcpy(block.characters.data(), characters, count*sizeof(Character));
+    block.firstLine = firstLine;
+    block.hotSpots = _hotspotList.mid(firstHotSpot);
+    block.complete = complete;
+    _blocks.insert(hash, block);
 }
 
-void Filter::setBuffer(const QString* buffer , const QList<int>* linePositions)
+void Filter::endImage()
+{
+    QMultiHash<uint,Block>::const_iterator iter = _previousBlocks.constBegin();
+    for ( ; iter != _previousBlocks.constEnd() ; ++iter )
+        qDeleteAll(iter.value().hotSpots);
+
+    _previousBlocks.clear();
+}
+
+void Filter::setAnchors(const QStringList& anchors, Qt::CaseSensitivity caseSensitivity)
+{
+    // an empty anchor occurs in every block
+    if ( anchors.contains(QString()) )
+        _anchors.clear();
+    else
+        _anchors = anchors;
+
+    _anchorCaseSensitivity = caseSensitivity;
+}
+
+QStringList Filter::anchors() const
+{
+    return _anchors;
+}
+
+Qt::CaseSensitivity Filter::anchorCaseSensitivity() const
+{
+    return _anchorCaseSensitivity;
+}
+
+void Filter::setTimeBudget(int msecs)
+{
+    _timeBudget = msecs;
+}
+
+int Filter::timeBudget() const
+{
+    return _timeBudget;
+}
+
+bool Filter::timeBudgetExceeded()
+{
+    if ( _timeBudget > 0 && !_budgetExceeded )
+    {
+        qint64 used = _timeUsed;
+        if ( _processStart >= 0 )
+            used += currentTime() - _processStart;
+
+        _budgetExceeded = used > _timeBudget;
+    }
+
+    return _budgetExceeded;
+}
+
+qint64 Filter::currentTime() const
+{
+    static QElapsedTimer clock;
+    if ( !clock.isValid() )
+        clock.start();
+
+    return clock.elapsed();
+}
+
+void Filter::setBuffer(const QString* buffer , const QList<int>* linePositions,
+                       const QVector<int>* columnPositions)
 {
     _buffer = buffer;
     _linePositions = linePositions;
+    _columnPositions = columnPositions;
 }
 
 void Filter::getLineColumn(int position , int& startLine , int& startColumn)
@@ -207,22 +606,31 @@ void Filter::getLineColumn(int position , int& startLine , int& startColumn)
     Q_ASSERT( _linePositions );
     Q_ASSERT( _buffer );
 
+    if ( position < 0 || position > _buffer->length() )
+        return;
 
-    for (int i = 0 ; i < _linePositions->count() ; i++)
-    {
-        int nextLine = 0;
+    // find the last line which starts at or before position
+    QList<int>::const_iterator lineIter = qUpperBound(_linePositions->constBegin(),
+                                                      _linePositions->constEnd(),
+                                                      position);
+    if ( lineIter == _linePositions->constBegin() )
+        return;
+    --lineIter;
 
-        if ( i == _linePositions->count()-1 )
-            nextLine = _buffer->length() + 1;
-        else
-            nextLine = _linePositions->value(i+1);
+    const int lineStart = *lineIter;
+    startLine = (lineIter - _linePositions->constBegin()) + _lineOffset;
 
-        if ( _linePositions->value(i) <= position && position < nextLine ) 
-        {
-            startLine = i;
-            startColumn = string_width(buffer()->mid(_linePositions->value(i),position - _linePositions->value(i)));
-            return;
-        }
+    if ( _columnPositions )
+    {
+        Q_ASSERT( _columnPositions->count() > _buffer->length() );
+        startColumn = _columnPositions->at(position) - _columnPositions->at(lineStart);
+    }
+    else
+    {
+        const QChar* text = _buffer->constData();
+        startColumn = 0;
+        for (int i = lineStart ; i < position ; i++)
+            startColumn += konsole_wcwidth(text[i].unicode());
     }
 }
 
@@ -242,7 +650,9 @@ Filter::HotSpot::~HotSpot()
 }
 void Filter::addHotSpot(HotSpot* spot)
 {
+    spot->_filter = this;
     _hotspotList << spot;
+    _generation++;
 
     for (int line = spot->startLine() ; line <= spot->endLine() ; line++)
     {
@@ -283,7 +693,12 @@ Filter::HotSpot::HotSpot(int startLine , int startColumn , int endLine , int end
     , _endLine(endLine)
     , _endColumn(endColumn)
     , _type(NotSpecified)
+    , _filter(0)
+{
+}
+Filter* Filter::HotSpot::filter() const
 {
+    return _filter;
 }
 QString Filter::HotSpot::tooltip() const
 {
@@ -344,6 +759,15 @@ QStringList RegExpFilter::HotSpot::capturedTexts() const
 void RegExpFilter::setRegExp(const QRegExp& regExp) 
 {
     _searchText = regExp;
+
+    // a fixed string is its own anchor
+    if ( regExp.patternSyntax() == QRegExp::FixedString && !regExp.isEmpty() )
+        setAnchors(QStringList(regExp.pattern()), regExp.caseSensitivity());
+    else
+        setAnchors(QStringList());
+
+    // the hotspots found with the previous expression are no longer valid
+    reset();
 }
 QRegExp RegExpFilter::regExp() const
 {
@@ -390,6 +814,9 @@ void RegExpFilter::process()
             // if matchedLength == 0, the program will get stuck in an infinite loop
             if ( _searchText.matchedLength() == 0 )
                 pos = -1;
+
+            if ( timeBudgetExceeded() )
+                pos = -1;
         }
     }    
 }
@@ -408,7 +835,7 @@ RegExpFilter::HotSpot* UrlFilter::newHotSpot(int startLine,int startColumn,int e
 }
 UrlFilter::HotSpot::HotSpot(int startLine,int startColumn,int endLine,int endColumn)
 : RegExpFilter::HotSpot(startLine,startColumn,endLine,endColumn)
-, _urlObject(new FilterObject(this))
+, _urlObject(0)
 {
     setType(Link);
 }
@@ -491,14 +918,22 @@ const QRegExp UrlFilter::CompleteUrlRegExp('('+FullUrlRegExp.pattern()+'|'+
 UrlFilter::UrlFilter()
 {
     setRegExp( CompleteUrlRegExp );
+    setAnchors( QStringList() << "://" << "www." << "@" );
 }
 UrlFilter::HotSpot::~HotSpot()
 {
-    delete _urlObject;
+    if ( _urlObject )
+        _urlObject->release();
+}
+void FilterObject::release()
+{
+    _filter = 0;
+    deleteLater();
 }
 void FilterObject::activated()
 {
-    _filter->activate(sender());
+    if ( _filter )
+        _filter->activate(sender());
 }
 QList<QAction*> UrlFilter::HotSpot::actions()
 {
@@ -506,6 +941,10 @@ QList<QAction*> UrlFilter::HotSpot::actions()
 
     const UrlType kind = urlType();
 
+    // the object is only created for hotspots whose actions are requested
+    if ( !_urlObject )
+        _urlObject = new FilterObject(this);
+
     QAction* openAction = new QAction(_urlObject);
     QAction* copyAction = new QAction(_urlObject);;
 
@@ -537,4 +976,254 @@ QList<QAction*> UrlFilter::HotSpot::actions()
     return list; 
 }
 
+// the time in milliseconds which each user filter may spend processing a
+// terminal image, so that a slow expression does not hold up painting
+static const int USER_FILTER_TIME_BUDGET = 10;
+
+UserFilter::UserFilter(const Definition& definition)
+    : _definition(definition)
+{
+    setRegExp(definition.regExp);
+    setAnchors(definition.anchors, definition.regExp.caseSensitivity());
+    setTimeBudget(USER_FILTER_TIME_BUDGET);
+}
+const UserFilter::Definition& UserFilter::definition() const
+{
+    return _definition;
+}
+RegExpFilter::HotSpot* UserFilter::newHotSpot(int startLine,int startColumn,int endLine,
+                                              int endColumn)
+{
+    return new UserFilter::HotSpot(_definition,startLine,startColumn,
+                                   endLine,endColumn);
+}
+
+// splits 'text' at its first 'count' semicolons which are not escaped
+// with a backslash
+static QStringList splitDefinition(const QString& text, int count)
+{
+    QStringList fields;
+    int start = 0;
+    for (int i = 0 ; i < text.length() && fields.count() < count ; i++)
+    {
+        if ( text[i] == '\\' )
+            i++;
+        else if ( text[i] == ';' )
+        {
+            fields << text.mid(start, i - start);
+            start = i + 1;
+        }
+    }
+    fields << text.mid(start);
+    return fields;
+}
+
+// escapes the semicolons in 'text' which are not escaped yet
+static QString escapeDefinitionField(const QString& text)
+{
+    QString escaped;
+    escaped.reserve(text.length());
+    for (int i = 0 ; i < text.length() ; i++)
+    {
+        if ( text[i] == '\\' && i + 1 < text.length() )
+            escaped += text[i++];
+        else if ( text[i] == ';' )
+            escaped += '\\';
+        escaped += text[i];
+    }
+    return escaped;
+}
+
+QString RegExpFilter::literalPrefix(const QRegExp& regExp)
+{
+    const QString& pattern = regExp.pattern();
+
+    if ( regExp.patternSyntax() == QRegExp::FixedString )
+        return pattern;
+    if ( regExp.patternSyntax() != QRegExp::RegExp && regExp.patternSyntax() != QRegExp::RegExp2 )
+        return QString();
+
+    // alternatives may each start with different text
+    if ( pattern.contains('|') )
+        return QString();
+
+    static const QString specialCharacters("\\^$.|?*+()[]{}");
+
+    QString prefix;
+    for (int i = 0 ; i < pattern.length() ; i++)
+    {
+        if ( specialCharacters.contains(pattern[i]) )
+        {
+            // quantifiers which allow the previous character to be
+            // left out
+            if ( pattern[i] == '?' || pattern[i] == '*' || pattern[i] == '{' )
+                prefix.chop(1);
+            break;
+        }
+        prefix += pattern[i];
+    }
+    return prefix;
+}
+
+QList<UserFilter::Definition> UserFilter::parseDefinitions(const QStringList& definitions)
+{
+    // all the displays of sessions using the same profile share the
+    // definitions parsed from it, along with their compiled expressions
+    static QHash<QString,QList<Definition> > parsedDefinitions;
+
+    const QString key = definitions.join(QChar('\n'));
+    if ( parsedDefinitions.contains(key) )
+        return parsedDefinitions.value(key);
+
+    QList<Definition> list;
+    foreach( const QString& text , definitions )
+    {
+        const QStringList fields = definitionFields(text);
+        if ( fields.isEmpty() )
+        {
+            kWarning() << "Hotspot filter definition must have a name, action, expression and template:" << text;
+            continue;
+        }
+
+        Definition definition;
+        definition.name = fields[0];
+
+        const QString action = fields[1].trimmed();
+        if ( action == "OpenUrl" )
+            definition.action = OpenUrl;
+        else if ( action == "RunCommand" )
+            definition.action = RunCommand;
+        else if ( action == "Copy" )
+            definition.action = CopyText;
+        else
+        {
+            kWarning() << "Unknown hotspot filter action" << action << "in" << text;
+            continue;
+        }
+
+        // checking the expression compiles it, copies of it share the result
+        definition.regExp = QRegExp(fields[2]);
+        if ( definition.regExp.isEmpty() || !definition.regExp.isValid() )
+        {
+            kWarning() << "Invalid hotspot filter expression" << fields[2] << ":"
+                       << definition.regExp.errorString();
+            continue;
+        }
+
+        definition.actionTemplate = fields[3];
+
+        const QString prefix = literalPrefix(definition.regExp);
+        if ( !prefix.isEmpty() )
+            definition.anchors << prefix;
+
+        list << definition;
+    }
+
+    if ( parsedDefinitions.count() >= 16 )
+        parsedDefinitions.clear();
+    parsedDefinitions.insert(key, list);
+
+    return list;
+}
+
+QStringList UserFilter::definitionFields(const QString& definition)
+{
+    QStringList fields = splitDefinition(definition, 3);
+    if ( fields.count() < 4 )
+        return QStringList();
+
+    fields[0].replace("\\;", ";");
+    return fields;
+}
+
+QString UserFilter::joinDefinitionFields(const QStringList& fields)
+{
+    Q_ASSERT( fields.count() == 4 );
+
+    // the template is the rest of the definition, so it is not escaped
+    return escapeDefinitionField(fields.value(0)) + ';' +
+           escapeDefinitionField(fields.value(1)) + ';' +
+           escapeDefinitionField(fields.value(2)) + ';' +
+           fields.value(3);
+}
+
+UserFilter::HotSpot::HotSpot(const Definition& definition, int startLine, int startColumn,
+                             int endLine, int endColumn)
+: RegExpFilter::HotSpot(startLine,startColumn,endLine,endColumn)
+, _name(definition.name)
+, _action(definition.action)
+, _actionTemplate(definition.actionTemplate)
+, _filterObject(0)
+{
+    setType(Link);
+}
+UserFilter::HotSpot::~HotSpot()
+{
+    if ( _filterObject )
+        _filterObject->release();
+}
+QString UserFilter::HotSpot::tooltip() const
+{
+    return _name;
+}
+QString UserFilter::HotSpot::actionText() const
+{
+    const QStringList texts = capturedTexts();
+
+    QString text;
+    for (int i = 0 ; i < _actionTemplate.length() ; i++)
+    {
+        const QChar c = _actionTemplate[i];
+        if ( c == '%' && i + 1 < _actionTemplate.length() )
+        {
+            const QChar next = _actionTemplate[i+1];
+            if ( next == '%' )
+            {
+                text += '%';
+                i++;
+                continue;
+            }
+            else if ( next.isDigit() )
+            {
+                // captured texts are quoted so that they are passed to
+                // the command as single arguments
+                const QString captured = texts.value(next.digitValue());
+                text += (_action == RunCommand) ? KShell::quoteArg(captured) : captured;
+                i++;
+                continue;
+            }
+        }
+        text += c;
+    }
+    return text;
+}
+void UserFilter::HotSpot::activate(QObject*)
+{
+    const QString text = actionText();
+
+    switch ( _action )
+    {
+        case OpenUrl:
+            new KRun(text,QApplication::activeWindow());
+            break;
+        case RunCommand:
+            KRun::runCommand(text,QApplication::activeWindow());
+            break;
+        case CopyText:
+            QApplication::clipboard()->setText(text);
+            break;
+    }
+}
+QList<QAction*> UserFilter::HotSpot::actions()
+{
+    if ( !_filterObject )
+        _filterObject = new FilterObject(this);
+
+    QAction* action = new QAction(_filterObject);
+    action->setText(_name);
+    QObject::connect( action , SIGNAL(triggered()) , _filterObject , SLOT(activated()) );
+
+    return QList<QAction*>() << action;
+}
+
 #include "Filter.moc"
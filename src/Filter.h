@@ -27,9 +27,11 @@
 #include <QtCore/QStringList>
 #include <QtCore/QHash>
 #include <QtCore/QRegExp>
+#include <QtCore/QVector>
 
 // Konsole
 #include "Character.h"
+#include "konsole_export.h"
 
 namespace Konsole
 {
@@ -52,7 +54,7 @@ namespace Konsole
  * When processing the text they should create instances of Filter::HotSpot subclasses for sections of interest
  * and add them to the filter's list of hotspots using addHotSpot()
  */
-class Filter
+class KONSOLEPRIVATE_EXPORT Filter
 {
 public:
     /**
@@ -123,16 +125,23 @@ public:
         */
        virtual QString tooltip() const;
 
+       /** Returns the filter which found the hotspot */
+       Filter* filter() const;
+
     protected:
        /** Sets the type of a hotspot.  This should only be set once */
        void setType(Type type);
 
     private:
+       // Filter moves hotspots when the text they were found in moves
+       friend class Filter;
+
        int    _startLine;
        int    _startColumn;
        int    _endLine;
        int    _endColumn;
        Type _type;
+       Filter* _filter;
 
     };
 
@@ -149,6 +158,61 @@ public:
      */
     void reset();
 
+    /**
+     * Starts processing a new terminal image, which is passed to the filter
+     * one block of lines at a time using reuseBlock() and processBlock().
+     *
+     * The hotspots found in each block are kept until the next image is
+     * processed, so that blocks of lines which have not changed, or have
+     * only been scrolled, are not processed again.
+     */
+    void beginImage();
+    /**
+     * Looks for a block of the previous image which contains the same
+     * @p count @p characters, whose hash is @p hash.  If one is found,
+     * its hotspots are moved to @p firstLine and true is returned.
+     */
+    bool reuseBlock(uint hash, const Character* characters, int count, int firstLine);
+    /**
+     * Processes @p buffer, the text of a block of lines starting at
+     * @p firstLine which contains the @p count @p characters whose hash
+     * is @p hash, and keeps the hotspots found for the next image.
+     * See setBuffer() for @p linePositions and @p columnPositions.
+     *
+     * If @p buffer is null, the block is known not to contain any matches
+     * and is kept without being processed.
+     */
+    void processBlock(uint hash, const Character* characters, int count, int firstLine,
+                      const QString* buffer, const QList<int>* linePositions,
+                      const QVector<int>* columnPositions);
+    /** Deletes the hotspots of the blocks of the previous image which were not reused. */
+    void endImage();
+
+    /**
+     * Sets strings of which at least one occurs in the text of every match
+     * the filter can find.  Filter chains search blocks of text for the
+     * anchors of all their filters at once, and a filter does not process
+     * blocks which do not contain any of its anchors.
+     *
+     * An empty list, the default, means that every block is processed.
+     */
+    void setAnchors(const QStringList& anchors, Qt::CaseSensitivity caseSensitivity = Qt::CaseSensitive);
+    /** Returns the anchors set with setAnchors() */
+    QStringList anchors() const;
+    /** Returns whether the anchors set with setAnchors() are case sensitive */
+    Qt::CaseSensitivity anchorCaseSensitivity() const;
+
+    /**
+     * Sets the time in milliseconds which the filter may spend processing
+     * each terminal image.  Once it is used up, the remaining blocks of the
+     * image are not processed, and are tried again with the next image.
+     *
+     * A budget of 0, the default, means that the filter is not limited.
+     */
+    void setTimeBudget(int msecs);
+    /** Returns the time budget set with setTimeBudget() */
+    int timeBudget() const;
+
     /** Adds a new line of text to the filter and increments the line count */
     //void addLine(const QString& string);
 
@@ -162,9 +226,17 @@ public:
     QList<HotSpot*> hotSpotsAtLine(int line) const;
 
     /**
-     * TODO: Document me
+     * Sets the text for the filter to process.
+     *
+     * @param buffer The text, with one or more lines
+     * @param linePositions The position in @p buffer where each line starts
+     * @param columnPositions Optional.  For each position in @p buffer and
+     * for the end of the buffer, the total width of the characters before
+     * it.  When given, positions are converted to columns without
+     * measuring the text again.
      */
-    void setBuffer(const QString* buffer , const QList<int>* linePositions);
+    void setBuffer(const QString* buffer , const QList<int>* linePositions,
+                   const QVector<int>* columnPositions = 0);
 
 protected:
     /** Adds a new hotspot to the list */
@@ -173,13 +245,56 @@ protected:
     const QString* buffer();
     /** Converts a character position within buffer() to a line and column */
     void getLineColumn(int position , int& startLine , int& startColumn);
+    /**
+     * Returns true if the filter has used up its time budget for the current
+     * image.  Subclasses should call this regularly while processing text and
+     * stop when it returns true.
+     */
+    bool timeBudgetExceeded();
+    /**
+     * Returns the time in milliseconds against which the time budget is
+     * measured.  Only differences between the values returned matter.
+     */
+    virtual qint64 currentTime() const;
 
 private:
+    // FilterChain indexes the hotspots of its filters
+    friend class FilterChain;
+
+    // a block of lines from a terminal image and the hotspots found in it
+    struct Block
+    {
+        QVector<Character> characters;
+        int firstLine;
+        QList<HotSpot*> hotSpots;
+        // false if the time budget ran out before the block was processed
+        bool complete;
+    };
+
     QMultiHash<int,HotSpot*> _hotspots;
     QList<HotSpot*> _hotspotList;
+    // changed whenever the hotspots are
+    uint _generation;
 
     const QList<int>* _linePositions;
     const QString* _buffer;
+    const QVector<int>* _columnPositions;
+    int _lineOffset; // line of the image where the buffer starts
+
+    QStringList _anchors;
+    Qt::CaseSensitivity _anchorCaseSensitivity;
+
+    int _timeBudget;
+    // time spent processing the current image, and the time at which the
+    // block being processed was started or -1 if there is none
+    qint64 _timeUsed;
+    qint64 _processStart;
+    bool _budgetExceeded;
+
+    // blocks of the current and of the previous image, keyed by the hash
+    // of their characters
+    QMultiHash<uint,Block> _blocks;
+    QMultiHash<uint,Block> _previousBlocks;
 };
 
 /**
@@ -189,7 +304,7 @@ private:
  * Subclasses can reimplement newHotSpot() to return custom hotspot types when matches for the regular expression
  * are found.
  */
-class RegExpFilter : public Filter
+class KONSOLEPRIVATE_EXPORT RegExpFilter : public Filter
 {
 public:
     /**
@@ -218,11 +333,21 @@ public:
      *
      * Regular expressions which match the empty string are treated as not matching
      * anything.
+     *
+     * The anchors of the filter are reset, or set to the pattern if @p text
+     * matches a fixed string.  Use setAnchors() afterwards to give the anchors
+     * of other expressions.
      */
     void setRegExp(const QRegExp& text);
     /** Returns the regular expression which the filter searches for in blocks of text */
     QRegExp regExp() const;
 
+    /**
+     * Returns literal text with which every match of @p regExp starts, or an
+     * empty string if there is none which can be found simply.
+     */
+    static QString literalPrefix(const QRegExp& regExp);
+
     /**
      * Reimplemented to search the filter's text buffer for text matching regExp()
      *
@@ -294,11 +419,114 @@ private:
     static const QRegExp CompleteUrlRegExp; 
 };
 
+/**
+ * A filter defined by the user in a profile, which finds matches for a regular
+ * expression and performs an action with the text of a match when one of
+ * its hotspots is activated.
+ *
+ * Each definition is a string of the form "name;action;regexp;template",
+ * where a semicolon in the name or regular expression is escaped as "\;"
+ * and action is one of "OpenUrl", "RunCommand" or "Copy".  In the template,
+ * "%0" is replaced by the text of the match, "%1" to "%9" by the texts of the
+ * expression's captures and "%%" by a percent sign.
+ */
+class KONSOLEPRIVATE_EXPORT UserFilter : public RegExpFilter
+{
+public:
+    /** The actions which a user filter can perform */
+    enum Action
+    {
+        /** Opens the URL given by the template */
+        OpenUrl,
+        /** Runs the command given by the template, with the captured texts quoted */
+        RunCommand,
+        /** Copies the text given by the template to the clipboard */
+        CopyText
+    };
+
+    /** A parsed user filter definition */
+    struct Definition
+    {
+        QString name;
+        Action action;
+        QString actionTemplate;
+        QRegExp regExp;
+        // literal text with which every match starts, see Filter::setAnchors()
+        QStringList anchors;
+    };
+
+    /** Hotspot type created by UserFilter instances */
+    class HotSpot : public RegExpFilter::HotSpot
+    {
+    public:
+        HotSpot(const Definition& definition, int startLine, int startColumn,
+                int endLine, int endColumn);
+        virtual ~HotSpot();
+
+        virtual QList<QAction*> actions();
+
+        /** Performs the action of the filter's definition */
+        virtual void activate(QObject* object = 0);
+
+        virtual QString tooltip() const;
+
+        /** Returns the template of the filter's action with the captured texts filled in */
+        QString actionText() const;
+
+    private:
+        QString _name;
+        Action _action;
+        QString _actionTemplate;
+        FilterObject* _filterObject;
+    };
+
+    /** Constructs a filter from @p definition */
+    explicit UserFilter(const Definition& definition);
+
+    /** Returns the definition of the filter */
+    const Definition& definition() const;
+
+    /**
+     * Parses a list of filter definitions, such as the HotSpotFilters property
+     * of a profile.  Invalid definitions are skipped.
+     *
+     * The definitions are parsed and their regular expressions compiled once
+     * for each list, and shared by the displays which use them.
+     */
+    static QList<Definition> parseDefinitions(const QStringList& definitions);
+
+    /**
+     * Splits @p definition into its name, action, regular expression and
+     * template, or returns an empty list if it does not have all four.
+     * The escapes are removed from the name.  The regular expression keeps
+     * them, since QRegExp reads "\;" as a semicolon.
+     */
+    static QStringList definitionFields(const QString& definition);
+    /** Joins the four fields returned by definitionFields() into a definition */
+    static QString joinDefinitionFields(const QStringList& fields);
+
+protected:
+    virtual RegExpFilter::HotSpot* newHotSpot(int,int,int,int);
+
+private:
+    Definition _definition;
+};
+
+/**
+ * Receives the signals of the actions of a hotspot, which are its children.
+ *
+ * Hotspots may be deleted while their actions are shown in a menu, when the
+ * filters process the image again.  The hotspot then calls release(), which
+ * detaches the object from it and deletes it, and its actions, once control
+ * returns to the event loop.
+ */
 class FilterObject : public QObject
 {
 Q_OBJECT
 public:
     FilterObject(Filter::HotSpot* filter) : _filter(filter) {}
+    /** Detaches the object from its hotspot and deletes it later */
+    void release();
 private slots:
     void activated();
 private:
@@ -322,9 +550,10 @@ private:
  * The hotSpots() and hotSpotsAtLine() method return all of the hotspots in the text and on
  * a given line respectively.
  */
-class FilterChain : protected QList<Filter*>
+class KONSOLEPRIVATE_EXPORT FilterChain : protected QList<Filter*>
 {
 public:
+    FilterChain();
     virtual ~FilterChain();
 
     /** Adds a new filter to the chain.  The chain will delete this filter when it is destroyed */
@@ -352,18 +581,53 @@ public:
     QList<Filter::HotSpot*> hotSpots() const;
     /** Returns a list of all hotspots at the given line in all the chain's filters */
     QList<Filter::HotSpot> hotSpotsAtLine(int line) const;
+    /**
+     * Returns the hotspots in all the chain's filters which cover any of the
+     * lines from @p firstLine to @p lastLine.  Each hotspot is returned once.
+     */
+    QList<Filter::HotSpot*> hotSpotsInLines(int firstLine , int lastLine) const;
+
+private:
+    // rebuilds the index of the hotspots if the hotspots of any of the
+    // filters have changed since it was built
+    void updateIndex() const;
+
+    // the part of a line which is covered by a hotspot
+    struct Span
+    {
+        int startColumn;
+        int endColumn;
+        // the largest endColumn of this and the previous spans on the line
+        int maxEndColumn;
+        // the position in the chain of the filter which found the hotspot
+        int filterIndex;
+        Filter::HotSpot* spot;
+
+        bool operator<(const Span& other) const { return startColumn < other.startColumn; }
+    };
 
+    // the hotspots of the chain's filters, and for each line the spans of
+    // the hotspots covering it ordered by their start column
+    mutable bool _indexValid;
+    mutable QVector<uint> _indexedGenerations;
+    mutable QList<Filter::HotSpot*> _indexedHotSpots;
+    mutable QVector<QVector<Span> > _lineSpans;
 };
 
 /** A filter chain which processes character images from terminal displays */
-class TerminalImageFilterChain : public FilterChain
+class KONSOLEPRIVATE_EXPORT TerminalImageFilterChain : public FilterChain
 {
 public:
     TerminalImageFilterChain();
     virtual ~TerminalImageFilterChain();
 
     /**
-     * Set the current terminal image to @p image.
+     * Set the current terminal image to @p image and processes it with
+     * each filter in the chain.
+     *
+     * The image is divided into blocks of lines, each of which ends with a
+     * line which is not wrapped onto the next one.  Only blocks which were
+     * not part of the previous image are decoded and processed again.
      *
      * @param image The terminal image
      * @param lines The number of lines in the terminal image
@@ -372,10 +636,6 @@ public:
      */
     void setImage(const Character* const image , int lines , int columns,
                   const QVector<LineProperty>& lineProperties);  
-
-private:
-    QString* _buffer;
-    QList<int>* _linePositions;
 };
 
 }
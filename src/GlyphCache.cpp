@@ -0,0 +1,327 @@
+/*
+    Copyright 2012 by Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "GlyphCache.h"
+
+// Qt
+#include <QtGui/QColor>
+#include <QtGui/QFont>
+#include <QtGui/QFontMetrics>
+#include <QtGui/QImage>
+#include <QtGui/QPainter>
+#include <QtGui/QPen>
+
+// Konsole
+#include "LineFont.h"
+
+using namespace Konsole;
+
+// the atlas is a grid of ATLAS_COLUMNS x ATLAS_ROWS cells, which is enough
+// for the glyphs of a full screen of colored text
+static const int ATLAS_COLUMNS = 64;
+static const int ATLAS_ROWS = 32;
+
+GlyphCache::GlyphCache()
+    : _cellWidth(0)
+    , _cellHeight(0)
+    , _nextCell(0)
+{
+}
+
+void GlyphCache::setCellSize(int width, int height)
+{
+    _cellWidth = width;
+    _cellHeight = height;
+    _atlas = QPixmap();
+    clear();
+}
+
+void GlyphCache::clear()
+{
+    _cells.clear();
+    _glyphFits.clear();
+    _cellKeys.clear();
+    _cellUsed.clear();
+    _nextCell = 0;
+}
+
+QRect GlyphCache::cellRect(int cell) const
+{
+    return QRect((cell % ATLAS_COLUMNS) * _cellWidth, (cell / ATLAS_COLUMNS) * _cellHeight,
+                 _cellWidth, _cellHeight);
+}
+
+int GlyphCache::allocateCell()
+{
+    if (_cellKeys.size() < ATLAS_COLUMNS * ATLAS_ROWS) {
+        _cellKeys.append(0);
+        _cellUsed.append(true);
+        return _cellKeys.size() - 1;
+    }
+
+    // the atlas is full, replace the first glyph found which has not been
+    // drawn since the last time it was passed over
+    while (_cellUsed[_nextCell]) {
+        _cellUsed[_nextCell] = false;
+        _nextCell = (_nextCell + 1) % _cellKeys.size();
+    }
+
+    const int cell = _nextCell;
+    _nextCell = (_nextCell + 1) % _cellKeys.size();
+
+    _cells.remove(_cellKeys[cell]);
+    _cellUsed[cell] = true;
+    return cell;
+}
+
+int GlyphCache::addGlyph(quint64 key)
+{
+    if (_atlas.isNull()) {
+        _atlas = QPixmap(ATLAS_COLUMNS * _cellWidth, ATLAS_ROWS * _cellHeight);
+        _atlas.fill(Qt::transparent);
+    }
+
+    const int cell = allocateCell();
+    _cellKeys[cell] = key;
+    _cells.insert(key, cell);
+    return cell;
+}
+
+bool GlyphCache::glyphFits(QChar character, const QFont& font)
+{
+    const quint32 key = (quint32(character.unicode()) << 16) | (font.bold() ? 1 : 0) |
+                        (font.italic() ? 8 : 0);
+
+    QHash<quint32, bool>::const_iterator iter = _glyphFits.constFind(key);
+    if (iter != _glyphFits.constEnd())
+        return iter.value();
+
+    // the glyph is drawn at the bottom of its cell, as drawText() does with
+    // Qt::AlignBottom, and must not extend beyond any side of it
+    const QFontMetrics metrics(font);
+    const QRect glyphRect = metrics.boundingRect(character)
+                                   .translated(0, _cellHeight - metrics.descent());
+    const bool fits = QRect(0, 0, _cellWidth, _cellHeight).contains(glyphRect);
+
+    _glyphFits.insert(key, fits);
+    return fits;
+}
+
+bool GlyphCache::drawGlyph(QPainter& painter, const QPoint& pos, QChar character,
+                           const QFont& font, const QColor& color)
+{
+    const quint64 key = (quint64(color.rgba()) << 32) | (quint64(character.unicode()) << 16) |
+                        (font.bold() ? 1 : 0) | (font.underline() ? 2 : 0) |
+                        (font.italic() ? 8 : 0);
+
+    int cell = _cells.value(key, -1);
+    if (cell == -1) {
+        if (!glyphFits(character, font))
+            return false;
+
+        cell = addGlyph(key);
+
+        const QRect rect = cellRect(cell);
+        QPainter atlasPainter(&_atlas);
+        atlasPainter.setCompositionMode(QPainter::CompositionMode_Source);
+        atlasPainter.fillRect(rect, Qt::transparent);
+        atlasPainter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+        atlasPainter.setClipRect(rect);
+        atlasPainter.setFont(font);
+        atlasPainter.setPen(color);
+        atlasPainter.setLayoutDirection(Qt::LeftToRight);
+        atlasPainter.drawText(rect, Qt::AlignBottom, QString(character));
+    } else {
+        _cellUsed[cell] = true;
+    }
+
+    painter.drawPixmap(pos, _atlas, cellRect(cell));
+    return true;
+}
+
+void GlyphCache::drawLineGlyph(QPainter& painter, const QPoint& pos, uchar code, const QPen& pen)
+{
+    if (!LineChars[code])
+        return;
+
+    // line glyphs are told apart from the font's glyphs of the same
+    // characters by the third bit
+    const quint64 key = (quint64(pen.color().rgba()) << 32) | (quint64(0x2500 + code) << 16) |
+                        (pen.width() > 1 ? 1 : 0) | 4;
+
+    int cell = _cells.value(key, -1);
+    if (cell == -1) {
+        cell = addGlyph(key);
+
+        const QRect rect = cellRect(cell);
+        QPainter atlasPainter(&_atlas);
+        atlasPainter.setCompositionMode(QPainter::CompositionMode_Source);
+        atlasPainter.fillRect(rect, Qt::transparent);
+        atlasPainter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+        atlasPainter.setClipRect(rect);
+        atlasPainter.setPen(pen);
+        drawLineChar(atlasPainter, rect.x(), rect.y(), _cellWidth, _cellHeight, code);
+    } else {
+        _cellUsed[cell] = true;
+    }
+
+    painter.drawPixmap(pos, _atlas, cellRect(cell));
+}
+
+bool GlyphCache::usesSubpixelAntialiasing(const QFont& font)
+{
+    // subpixel antialiasing draws the edges of black text on white in
+    // colors, where grayscale antialiasing only uses shades of gray
+    const QFontMetrics metrics(font);
+    const QString text("W/");
+    QPixmap pixmap(metrics.width(text) + 4, metrics.height() + 4);
+    pixmap.fill(Qt::white);
+
+    QPainter painter(&pixmap);
+    painter.setFont(font);
+    painter.setPen(Qt::black);
+    painter.drawText(pixmap.rect(), Qt::AlignCenter, text);
+    painter.end();
+
+    const QImage image = pixmap.toImage();
+    for (int y = 0; y < image.height(); y++) {
+        for (int x = 0; x < image.width(); x++) {
+            const QRgb pixel = image.pixel(x, y);
+            if (qRed(pixel) != qGreen(pixel) || qGreen(pixel) != qBlue(pixel))
+                return true;
+        }
+    }
+    return false;
+}
+
+/**
+ A table for emulating the simple (single width) unicode drawing chars.
+ It represents the 250x - 257x glyphs. If it's zero, we can't use it.
+ if it's not, it's encoded as follows: imagine a 5x5 grid where the points are numbered
+ 0 to 24 left to top, top to bottom. Each point is represented by the corresponding bit.
+
+ Then, the pixels basically have the following interpretation:
+ _|||_
+ -...-
+ -...-
+ -...-
+ _|||_
+
+where _ = none
+      | = vertical line.
+      - = horizontal line.
+ */
+
+
+enum LineEncode
+{
+    TopL  = (1<<1),
+    TopC  = (1<<2),
+    TopR  = (1<<3),
+
+    LeftT = (1<<5),
+    Int11 = (1<<6),
+    Int12 = (1<<7),
+    Int13 = (1<<8),
+    RightT = (1<<9),
+
+    LeftC = (1<<10),
+    Int21 = (1<<11),
+    Int22 = (1<<12),
+    Int23 = (1<<13),
+    RightC = (1<<14),
+
+    LeftB = (1<<15),
+    Int31 = (1<<16),
+    Int32 = (1<<17),
+    Int33 = (1<<18),
+    RightB = (1<<19),
+
+    BotL  = (1<<21),
+    BotC  = (1<<22),
+    BotR  = (1<<23)
+};
+
+
+void GlyphCache::drawLineChar(QPainter& paint, int x, int y, int w, int h, uchar code)
+{
+    //Calculate cell midpoints, end points.
+    int cx = x + w/2;
+    int cy = y + h/2;
+    int ex = x + w - 1;
+    int ey = y + h - 1;
+
+    quint32 toDraw = LineChars[code];
+
+    //Top _lines:
+    if (toDraw & TopL)
+        paint.drawLine(cx-1, y, cx-1, cy-2);
+    if (toDraw & TopC)
+        paint.drawLine(cx, y, cx, cy-2);
+    if (toDraw & TopR)
+        paint.drawLine(cx+1, y, cx+1, cy-2);
+
+    //Bot _lines:
+    if (toDraw & BotL)
+        paint.drawLine(cx-1, cy+2, cx-1, ey);
+    if (toDraw & BotC)
+        paint.drawLine(cx, cy+2, cx, ey);
+    if (toDraw & BotR)
+        paint.drawLine(cx+1, cy+2, cx+1, ey);
+
+    //Left _lines:
+    if (toDraw & LeftT)
+        paint.drawLine(x, cy-1, cx-2, cy-1);
+    if (toDraw & LeftC)
+        paint.drawLine(x, cy, cx-2, cy);
+    if (toDraw & LeftB)
+        paint.drawLine(x, cy+1, cx-2, cy+1);
+
+    //Right _lines:
+    if (toDraw & RightT)
+        paint.drawLine(cx+2, cy-1, ex, cy-1);
+    if (toDraw & RightC)
+        paint.drawLine(cx+2, cy, ex, cy);
+    if (toDraw & RightB)
+        paint.drawLine(cx+2, cy+1, ex, cy+1);
+
+    //Intersection points.
+    if (toDraw & Int11)
+        paint.drawPoint(cx-1, cy-1);
+    if (toDraw & Int12)
+        paint.drawPoint(cx, cy-1);
+    if (toDraw & Int13)
+        paint.drawPoint(cx+1, cy-1);
+
+    if (toDraw & Int21)
+        paint.drawPoint(cx-1, cy);
+    if (toDraw & Int22)
+        paint.drawPoint(cx, cy);
+    if (toDraw & Int23)
+        paint.drawPoint(cx+1, cy);
+
+    if (toDraw & Int31)
+        paint.drawPoint(cx-1, cy+1);
+    if (toDraw & Int32)
+        paint.drawPoint(cx, cy+1);
+    if (toDraw & Int33)
+        paint.drawPoint(cx+1, cy+1);
+
+}
@@ -0,0 +1,133 @@
+/*
+    Copyright 2012 by Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef GLYPHCACHE_H
+#define GLYPHCACHE_H
+
+// Qt
+#include <QtCore/QHash>
+#include <QtCore/QRect>
+#include <QtCore/QVector>
+#include <QtGui/QPixmap>
+
+class QColor;
+class QFont;
+class QPainter;
+class QPen;
+class QPoint;
+
+namespace Konsole
+{
+
+/**
+ * A cache of rendered glyphs for a terminal display using a fixed-pitch font.
+ *
+ * Each glyph is rendered once, in a given color and with the bold and
+ * underline settings of the font it is drawn with, into a cell of a large
+ * pixmap (an atlas).  Drawing a glyph which is in the cache is then a
+ * copy from the atlas, which avoids laying out the text again on every
+ * repaint.  Line graphics characters, which Konsole draws itself rather
+ * than using the font, are cached in the same way.
+ *
+ * When the atlas is full, the glyphs which have not been drawn recently are
+ * replaced.  The cache must be cleared with setCellSize() when the font of
+ * the display changes.
+ *
+ * Glyphs which extend beyond their cell, such as italic glyphs or glyphs
+ * from fallback fonts, are not cached, since they would be cut off.  The
+ * atlas is transparent, so the glyphs in it are antialiased in grayscale.
+ * With subpixel antialiasing, the text would look different depending on
+ * whether it came from the cache, so the cache should not be used when
+ * usesSubpixelAntialiasing() returns true for the font.
+ */
+class GlyphCache
+{
+public:
+    GlyphCache();
+
+    /**
+     * Sets the size of the cell which each glyph is drawn into and
+     * removes all glyphs from the cache.
+     */
+    void setCellSize(int width, int height);
+
+    /**
+     * Draws @p character into the cell whose top-left corner is at @p pos,
+     * using @p font and @p color.  The glyph is rendered and added to the
+     * cache if it is not already present.
+     *
+     * Returns false, without drawing anything, if the glyph does not fit
+     * into its cell.  It must then be drawn with QPainter::drawText().
+     */
+    bool drawGlyph(QPainter& painter, const QPoint& pos, QChar character,
+                   const QFont& font, const QColor& color);
+
+    /**
+     * Draws the line graphics character @p code, the low byte of a
+     * character from U+2500 to U+257F, into the cell whose top-left corner
+     * is at @p pos using @p pen.  The glyph is drawn with drawLineChar()
+     * and added to the cache if it is not already present.
+     */
+    void drawLineGlyph(QPainter& painter, const QPoint& pos, uchar code, const QPen& pen);
+
+    /** Removes all glyphs from the cache. */
+    void clear();
+
+    /**
+     * Draws the line graphics character @p code into the cell at (@p x, @p y)
+     * of size @p w x @p h with the painter's current pen, without using
+     * the cache.
+     */
+    static void drawLineChar(QPainter& painter, int x, int y, int w, int h, uchar code);
+
+    /**
+     * Returns true if text drawn with @p font onto an opaque background
+     * uses subpixel antialiasing, which the glyphs in the cache lose.
+     */
+    static bool usesSubpixelAntialiasing(const QFont& font);
+
+private:
+    // returns true if 'character' drawn with 'font' fits into a cell
+    bool glyphFits(QChar character, const QFont& font);
+    // returns the index of a free cell in the atlas, replacing a glyph
+    // which was not used recently if the atlas is full
+    int allocateCell();
+    // reserves a cell of the atlas for the glyph identified by 'key'
+    int addGlyph(quint64 key);
+    QRect cellRect(int cell) const;
+
+    int _cellWidth;
+    int _cellHeight;
+
+    QPixmap _atlas;
+    QHash<quint64, int> _cells;
+    // whether each glyph which was drawn fits into its cell, keyed by the
+    // character and the font style, but not the color
+    QHash<quint32, bool> _glyphFits;
+
+    // the key of the glyph in each cell of the atlas and whether it was
+    // drawn since the cell was last considered for replacement
+    QVector<quint64> _cellKeys;
+    QVector<bool> _cellUsed;
+    int _nextCell;
+};
+
+}
+
+#endif // GLYPHCACHE_H
@@ -26,11 +26,17 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
 
+// Qt
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QtEndian>
+
 // KDE
 #include <kde_file.h>
 #include <KDebug>
@@ -162,6 +168,7 @@ int HistoryFile::len() const
 
 HistoryScroll::HistoryScroll(HistoryType* t)
   : _historyType(t)
+  , _clearCount(0)
 {
 }
 
@@ -254,6 +261,377 @@ void HistoryScrollFile::addLine(bool previousWrapped)
   lineflags.add((unsigned char*)&flags,sizeof(unsigned char));
 }
 
+// History Scroll Journal //////////////////////////////////////
+
+// identifies the start of a record in the journal
+static const quint32 JOURNAL_RECORD_MAGIC = 0x4b4a524c; // "KJRL"
+
+// the sizes of a record header and of a cell in the journal
+static const int JOURNAL_HEADER_SIZE = 16;
+static const int JOURNAL_CELL_SIZE = 12;
+
+HistoryScrollJournal::HistoryScrollJournal(const QString& directory, const QString& name, bool truncate)
+  : HistoryScroll(new HistoryTypeJournal(directory, name)),
+    _journalLength(0),
+    _lineCount(0),
+    _cachedLine(-1),
+    _cachedCellsLine(-1)
+{
+  QDir().mkpath(directory);
+
+  QIODevice::OpenMode mode = QIODevice::ReadWrite | QIODevice::Unbuffered;
+  if ( truncate )
+    mode |= QIODevice::Truncate;
+
+  _journal.setFileName(HistoryTypeJournal::journalPath(directory, name));
+  _index.setFileName(_journal.fileName() + QLatin1String(".index"));
+
+  if ( !_journal.open(mode) || !_index.open(mode) )
+  {
+    kWarning() << "Unable to open history journal" << _journal.fileName();
+    _journal.close();
+    _index.close();
+    return;
+  }
+
+  recover();
+}
+
+HistoryScrollJournal::~HistoryScrollJournal()
+{
+}
+
+qint64 HistoryScrollJournal::recordSize(const RecordHeader& header)
+{
+  return JOURNAL_HEADER_SIZE + (qint64)header.length;
+}
+
+void HistoryScrollJournal::encodeHeader(const RecordHeader& header, char* data)
+{
+  uchar* bytes = (uchar*)data;
+  qToLittleEndian<quint32>(header.magic, bytes);
+  qToLittleEndian<quint32>(header.length, bytes + 4);
+  qToLittleEndian<quint32>(header.cellCount, bytes + 8);
+  bytes[12] = header.flags;
+  bytes[13] = header.reserved;
+  qToLittleEndian<quint16>(header.checksum, bytes + 14);
+}
+
+void HistoryScrollJournal::decodeHeader(const char* data, RecordHeader& header)
+{
+  const uchar* bytes = (const uchar*)data;
+  header.magic = qFromLittleEndian<quint32>(bytes);
+  header.length = qFromLittleEndian<quint32>(bytes + 4);
+  header.cellCount = qFromLittleEndian<quint32>(bytes + 8);
+  header.flags = bytes[12];
+  header.reserved = bytes[13];
+  header.checksum = qFromLittleEndian<quint16>(bytes + 14);
+}
+
+QByteArray HistoryScrollJournal::encodeCells(const QVector<Character>& cells)
+{
+  QByteArray data(cells.count() * JOURNAL_CELL_SIZE, 0);
+  QByteArray sequences;
+
+  for ( int i = 0; i < cells.count(); i++ )
+  {
+    const Character& cell = cells[i];
+    quint16 character = cell.character;
+    quint8 rendition = cell.rendition;
+
+    // the code points of combined characters follow the cells, in the
+    // order of the cells which use them
+    if ( rendition & RE_EXTENDED_CHAR )
+    {
+      ushort length = 0;
+      const ushort* chars = ExtendedCharTable::instance.lookupExtendedChar(character, length);
+      if ( chars )
+      {
+        const int start = sequences.size();
+        sequences.resize(start + 2 + length * 2);
+        uchar* bytes = (uchar*)sequences.data() + start;
+        qToLittleEndian<quint16>(length, bytes);
+        for ( int j = 0; j < length; j++ )
+          qToLittleEndian<quint16>(chars[j], bytes + 2 + j * 2);
+        character = 0;
+      }
+      else
+      {
+        character = ' ';
+        rendition &= ~RE_EXTENDED_CHAR;
+      }
+    }
+
+    uchar* bytes = (uchar*)data.data() + i * JOURNAL_CELL_SIZE;
+    qToLittleEndian<quint16>(character, bytes);
+    bytes[2] = rendition;
+    bytes[3] = cell.isRealCharacter ? 1 : 0;
+    bytes[4] = cell.foregroundColor._colorSpace;
+    bytes[5] = cell.foregroundColor._u;
+    bytes[6] = cell.foregroundColor._v;
+    bytes[7] = cell.foregroundColor._w;
+    bytes[8] = cell.backgroundColor._colorSpace;
+    bytes[9] = cell.backgroundColor._u;
+    bytes[10] = cell.backgroundColor._v;
+    bytes[11] = cell.backgroundColor._w;
+  }
+
+  return data + sequences;
+}
+
+void HistoryScrollJournal::decodeCells(const RecordHeader& header, const QByteArray& data, QVector<Character>& cells)
+{
+  const qint64 cellBytes = (qint64)header.cellCount * JOURNAL_CELL_SIZE;
+  if ( cellBytes > data.size() )
+  {
+    cells.fill(Character(), header.cellCount);
+    return;
+  }
+
+  cells.resize(header.cellCount);
+
+  const uchar* sequence = (const uchar*)data.constData() + cellBytes;
+  const uchar* end = (const uchar*)data.constData() + data.size();
+
+  for ( int i = 0; i < cells.count(); i++ )
+  {
+    const uchar* bytes = (const uchar*)data.constData() + i * JOURNAL_CELL_SIZE;
+    Character& cell = cells[i];
+
+    cell.character = qFromLittleEndian<quint16>(bytes);
+    cell.rendition = bytes[2];
+    cell.isRealCharacter = bytes[3] != 0;
+    cell.foregroundColor._colorSpace = bytes[4];
+    cell.foregroundColor._u = bytes[5];
+    cell.foregroundColor._v = bytes[6];
+    cell.foregroundColor._w = bytes[7];
+    cell.backgroundColor._colorSpace = bytes[8];
+    cell.backgroundColor._u = bytes[9];
+    cell.backgroundColor._v = bytes[10];
+    cell.backgroundColor._w = bytes[11];
+
+    // combined characters are added to this process's table again
+    if ( cell.rendition & RE_EXTENDED_CHAR )
+    {
+      const ushort length = (end - sequence >= 2) ? qFromLittleEndian<quint16>(sequence) : 0;
+      if ( length > 0 && end - sequence >= 2 + length * 2 )
+      {
+        QVector<ushort> chars(length);
+        for ( int j = 0; j < length; j++ )
+          chars[j] = qFromLittleEndian<quint16>(sequence + 2 + j * 2);
+        cell.character = ExtendedCharTable::instance.createExtendedChar(chars.data(), length);
+        sequence += 2 + length * 2;
+      }
+      else
+      {
+        cell.character = ' ';
+        cell.rendition &= ~RE_EXTENDED_CHAR;
+      }
+    }
+  }
+}
+
+bool HistoryScrollJournal::readRecord(qint64 offset, RecordHeader& header, QByteArray* data)
+{
+  if ( offset < 0 || offset + JOURNAL_HEADER_SIZE > _journalLength )
+    return false;
+
+  char headerData[JOURNAL_HEADER_SIZE];
+  if ( !_journal.seek(offset) ||
+       _journal.read(headerData, JOURNAL_HEADER_SIZE) != JOURNAL_HEADER_SIZE )
+    return false;
+  decodeHeader(headerData, header);
+
+  if ( header.magic != JOURNAL_RECORD_MAGIC || offset + recordSize(header) > _journalLength )
+    return false;
+
+  if ( data )
+  {
+    data->resize(header.length);
+    if ( _journal.read(data->data(), header.length) != header.length )
+      return false;
+
+    RecordHeader unchecked = header;
+    unchecked.checksum = 0;
+    QByteArray record(JOURNAL_HEADER_SIZE, 0);
+    encodeHeader(unchecked, record.data());
+    record += *data;
+    if ( qChecksum(record.constData(), record.size()) != header.checksum )
+      return false;
+  }
+
+  return true;
+}
+
+void HistoryScrollJournal::recover()
+{
+  _journalLength = _journal.size();
+  _lineCount = _index.size() / sizeof(qint64);
+
+  // the index is written after the journal, so it can only refer to
+  // records which are missing or damaged at its end
+  RecordHeader header;
+  QByteArray data;
+  qint64 end = 0;
+  while ( _lineCount > 0 )
+  {
+    const qint64 offset = recordOffset(_lineCount-1);
+    if ( readRecord(offset, header, &data) )
+    {
+      end = offset + recordSize(header);
+      break;
+    }
+    _lineCount--;
+  }
+
+  // index complete records which follow the last indexed one
+  _index.seek((qint64)_lineCount * sizeof(qint64));
+  while ( readRecord(end, header, &data) )
+  {
+    const quint64 entry = qToLittleEndian<quint64>(end);
+    _index.write((const char*)&entry, sizeof(qint64));
+    _lineCount++;
+    end += recordSize(header);
+  }
+
+  if ( end != _journalLength )
+    kWarning() << "Discarding" << (_journalLength - end) << "bytes of incomplete history in" << _journal.fileName();
+
+  _journal.resize(end);
+  _index.resize((qint64)_lineCount * sizeof(qint64));
+  _journalLength = end;
+  _cachedLine = -1;
+  _cachedCellsLine = -1;
+}
+
+qint64 HistoryScrollJournal::recordOffset(int lineno)
+{
+  quint64 entry = 0;
+  if ( !_index.seek((qint64)lineno * sizeof(qint64)) ||
+       _index.read((char*)&entry, sizeof(qint64)) != sizeof(qint64) )
+    return -1;
+  return qFromLittleEndian<quint64>(entry);
+}
+
+const HistoryScrollJournal::RecordHeader& HistoryScrollJournal::lineHeader(int lineno)
+{
+  Q_ASSERT( lineno >= 0 && lineno < _lineCount );
+
+  if ( lineno != _cachedLine )
+  {
+    if ( !readRecord(recordOffset(lineno), _cachedHeader, 0) )
+    {
+      kWarning() << "Unable to read line" << lineno << "from history journal" << _journal.fileName();
+      memset(&_cachedHeader, 0, sizeof(RecordHeader));
+    }
+    _cachedLine = lineno;
+  }
+  return _cachedHeader;
+}
+
+const QVector<Character>& HistoryScrollJournal::lineCells(int lineno)
+{
+  Q_ASSERT( lineno >= 0 && lineno < _lineCount );
+
+  if ( lineno != _cachedCellsLine )
+  {
+    const RecordHeader& header = lineHeader(lineno);
+    QByteArray data(header.length, 0);
+    const qint64 offset = recordOffset(lineno) + JOURNAL_HEADER_SIZE;
+
+    if ( !_journal.seek(offset) || _journal.read(data.data(), data.size()) != data.size() )
+    {
+      kWarning() << "Unable to read line" << lineno << "from history journal" << _journal.fileName();
+      _cachedCells.fill(Character(), header.cellCount);
+    }
+    else
+    {
+      decodeCells(header, data, _cachedCells);
+    }
+    _cachedCellsLine = lineno;
+  }
+  return _cachedCells;
+}
+
+int HistoryScrollJournal::getLines()
+{
+  return _lineCount;
+}
+
+int HistoryScrollJournal::getLineLen(int lineno)
+{
+  if ( lineno < 0 || lineno >= _lineCount )
+    return 0;
+  return lineHeader(lineno).cellCount;
+}
+
+bool HistoryScrollJournal::isWrappedLine(int lineno)
+{
+  if ( lineno < 0 || lineno >= _lineCount )
+    return false;
+  return lineHeader(lineno).flags & LINE_WRAPPED;
+}
+
+void HistoryScrollJournal::getCells(int lineno, int colno, int count, Character res[])
+{
+  if ( count == 0 )
+    return;
+
+  Q_ASSERT( colno >= 0 && colno + count <= getLineLen(lineno) );
+
+  const QVector<Character>& cells = lineCells(lineno);
+  qCopy(cells.constBegin() + colno, cells.constBegin() + colno + count, res);
+}
+
+void HistoryScrollJournal::addCells(const Character text[], int count)
+{
+  _pendingCells.resize(count);
+  qCopy(text, text+count, _pendingCells.begin());
+}
+
+void HistoryScrollJournal::addLine(bool previousWrapped)
+{
+  if ( !_journal.isOpen() )
+    return;
+
+  const QByteArray cells = encodeCells(_pendingCells);
+
+  RecordHeader header;
+  header.magic = JOURNAL_RECORD_MAGIC;
+  header.length = cells.size();
+  header.cellCount = _pendingCells.size();
+  header.flags = previousWrapped ? LINE_WRAPPED : LINE_DEFAULT;
+  header.reserved = 0;
+  header.checksum = 0;
+
+  // the record is written with a single call so that it is either
+  // completely in the journal or detected as incomplete by recover()
+  QByteArray record(JOURNAL_HEADER_SIZE, 0);
+  encodeHeader(header, record.data());
+  record += cells;
+  header.checksum = qChecksum(record.constData(), record.size());
+  encodeHeader(header, record.data());
+
+  _pendingCells.clear();
+
+  const qint64 offset = _journalLength;
+  if ( !_journal.seek(offset) || _journal.write(record) != record.size() )
+  {
+    kWarning() << "Unable to write to history journal" << _journal.fileName();
+    return;
+  }
+  _journalLength += record.size();
+
+  const quint64 entry = qToLittleEndian<quint64>(offset);
+  _index.seek((qint64)_lineCount * sizeof(qint64));
+  if ( _index.write((const char*)&entry, sizeof(qint64)) != sizeof(qint64) )
+  {
+    kWarning() << "Unable to write to history journal index" << _index.fileName();
+    return;
+  }
+  _lineCount++;
+}
+
 #if 0
 // History Scroll Buffer //////////////////////////////////////
 HistoryScrollBuffer::HistoryScrollBuffer(unsigned int maxLineCount)
@@ -434,13 +812,16 @@ void HistoryScrollNone::addLine(bool)
 {
 }
 
-#if 0
 // History Scroll BlockArray //////////////////////////////////////
 
+// the ring buffer is sized for lines of this many characters
+static const int TYPICAL_LINE_LENGTH = 80;
+
 HistoryScrollBlockArray::HistoryScrollBlockArray(size_t size)
-  : HistoryScroll(new HistoryTypeBlockArray(size))
+  : HistoryScroll(new HistoryTypeBlockArray(size)),
+    m_blockArray(size * (TYPICAL_LINE_LENGTH * sizeof(Character) + sizeof(quint64))),
+    m_maxLineCount(size)
 {
-  m_blockArray.setHistorySize(size); // nb. of lines.
 }
 
 HistoryScrollBlockArray::~HistoryScrollBlockArray()
@@ -449,20 +830,21 @@ HistoryScrollBlockArray::~HistoryScrollBlockArray()
 
 int  HistoryScrollBlockArray::getLines()
 {
-  return m_lineLengths.count();
+  return m_blockArray.count();
 }
 
 int  HistoryScrollBlockArray::getLineLen(int lineno)
 {
-    if ( m_lineLengths.contains(lineno) )
-        return m_lineLengths[lineno];
-    else
-        return 0;
+  if ( lineno < 0 || lineno >= m_blockArray.count() )
+    return 0;
+  return m_blockArray.length(lineno) / sizeof(Character);
 }
 
-bool HistoryScrollBlockArray::isWrappedLine(int /*lineno*/)
+bool HistoryScrollBlockArray::isWrappedLine(int lineno)
 {
-  return false;
+  if ( lineno < 0 || lineno >= m_blockArray.count() )
+    return false;
+  return m_blockArray.flags(lineno) & LINE_WRAPPED;
 }
 
 void HistoryScrollBlockArray::getCells(int lineno, int colno,
@@ -470,49 +852,56 @@ void HistoryScrollBlockArray::getCells(int lineno, int colno,
 {
   if (!count) return;
 
-  const Block *b = m_blockArray.at(lineno);
+  Q_ASSERT( colno >= 0 && colno + count <= getLineLen(lineno) );
 
-  if (!b) {
-    memset(res, 0, count * sizeof(Character)); // still better than random data
-    return;
-  }
-
-  assert(((colno + count) * sizeof(Character)) < ENTRIES);
-  memcpy(res, b->data + (colno * sizeof(Character)), count * sizeof(Character));
+  memcpy(res, m_blockArray.data(lineno) + colno * sizeof(Character), count * sizeof(Character));
 }
 
 void HistoryScrollBlockArray::addCells(const Character a[], int count)
 {
-  Block *b = m_blockArray.lastBlock();
-
-  if (!b) return;
-
-  // put cells in block's data
-  assert((count * sizeof(Character)) < ENTRIES);
+  // each line is stored as one record, so that adding a line never adds
+  // more than one line to the history.  Lines which are longer than the
+  // whole buffer are truncated.
+  const int maxCount = m_blockArray.maxRecordLength() / sizeof(Character);
+  if ( count > maxCount )
+  {
+    kWarning() << "Truncating a line of" << count << "characters to" << maxCount << "in the history";
+    count = maxCount;
+  }
 
-  memset(b->data, 0, ENTRIES);
+  unsigned char* data = m_blockArray.append(count * sizeof(Character), LINE_DEFAULT);
+  if (!data) return;
 
-  memcpy(b->data, a, count * sizeof(Character));
-  b->size = count * sizeof(Character);
+  memcpy(data, a, count * sizeof(Character));
 
-  size_t res = m_blockArray.newBlock();
-  assert (res > 0);
-  Q_UNUSED( res );
+  while ( (size_t)m_blockArray.count() > m_maxLineCount )
+    m_blockArray.removeFirst();
+}
 
-  m_lineLengths.insert(m_blockArray.getCurrent(), count);
+void HistoryScrollBlockArray::addLine(bool previousWrapped)
+{
+  const int lastLine = m_blockArray.count() - 1;
+  if ( lastLine >= 0 )
+    m_blockArray.setFlags(lastLine, previousWrapped ? LINE_WRAPPED : LINE_DEFAULT);
 }
 
-void HistoryScrollBlockArray::addLine(bool)
+qint64 HistoryScrollBlockArray::memoryUsage()
 {
+  return m_blockArray.memoryUsage();
 }
-#endif
+
 
 ////////////////////////////////////////////////////////////////
 // Compact History Scroll //////////////////////////////////////
 ////////////////////////////////////////////////////////////////
+// allocations from a block are aligned for the types stored in it, the
+// characters of narrow lines may have any length
+static const size_t ALLOCATION_ALIGNMENT = sizeof(double) > sizeof(void*) ? sizeof(double) : sizeof(void*);
+
 void* CompactHistoryBlock::allocate ( size_t length )
 {
  Q_ASSERT ( length > 0 );
+  length = (length + ALLOCATION_ALIGNMENT - 1) & ~(ALLOCATION_ALIGNMENT - 1);
   if ( tail-blockStart+length > blockLength )
     return NULL;
 
@@ -529,6 +918,54 @@ void CompactHistoryBlock::deallocate ( )
   Q_ASSERT ( allocCount >= 0 );
 }
 
+bool CompactHistoryBlock::spill ( QFile& file, int slot )
+{
+  Q_ASSERT ( !isSpilled() );
+
+  // fast compression, blocks may be restored while the user is scrolling
+  const QByteArray data = qCompress ( blockStart, tail-blockStart, 1 );
+  if ( data.size() >= ( int ) blockLength )
+    return false;
+
+  if ( !file.seek ( ( qint64 ) slot * blockLength ) || file.write ( data ) != data.size() )
+  {
+    kWarning() << "Unable to spill history block to" << file.fileName();
+    return false;
+  }
+
+  // replace the pages of the block with new, untouched ones
+  void* result = mmap ( blockStart, blockLength, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON|MAP_FIXED, -1, 0 );
+  Q_ASSERT ( result == blockStart ); Q_UNUSED ( result );
+
+  spillSlot = slot;
+  spillLength = data.size();
+  return true;
+}
+
+bool CompactHistoryBlock::restore ( QFile& file )
+{
+  Q_ASSERT ( isSpilled() );
+
+  QByteArray data ( spillLength, 0 );
+  if ( !file.seek ( ( qint64 ) spillSlot * blockLength ) || file.read ( data.data(), spillLength ) != spillLength )
+  {
+    kWarning() << "Unable to restore history block from" << file.fileName();
+    return false;
+  }
+
+  const QByteArray contents = qUncompress ( data );
+  if ( contents.size() != tail-blockStart )
+  {
+    kWarning() << "History block restored from" << file.fileName() << "is corrupt";
+    return false;
+  }
+  memcpy ( blockStart, contents.constData(), contents.size() );
+
+  spillSlot = -1;
+  spillLength = 0;
+  return true;
+}
+
 void* CompactHistoryBlockList::allocate(size_t size)
 {
   CompactHistoryBlock* block;
@@ -565,11 +1002,100 @@ void CompactHistoryBlockList::deallocate(void* ptr)
   if (!block->isInUse())
   {
     list.removeAt(i);
+    releaseSlot(block);
     delete block;
     //kDebug() << "block deleted, new size = " << list.size();
   }
 }
 
+void CompactHistoryBlockList::releaseSlot(CompactHistoryBlock* block)
+{
+  if ( block->isSpilled() )
+  {
+    freeSlots.append(block->slot());
+    spilledBlocks.remove(block->start());
+  }
+}
+
+qint64 CompactHistoryBlockList::residentMemory()
+{
+  qint64 total = 0;
+  foreach ( CompactHistoryBlock* block, list )
+  {
+    if ( !block->isSpilled() )
+      total += block->length();
+  }
+  return total;
+}
+
+qint64 CompactHistoryBlockList::spill(qint64 bytes)
+{
+  if ( !spillFile.isOpen() )
+  {
+    if ( !spillFile.open() )
+    {
+      kWarning() << "Unable to create a file to spill history to";
+      return 0;
+    }
+    spillFile.setAutoRemove(true);
+  }
+
+  qint64 released = 0;
+  for ( int i=0; i<list.size()-1 && released<bytes; i++ )
+  {
+    CompactHistoryBlock* block = list.at(i);
+    if ( block->isSpilled() )
+      continue;
+
+    const int slot = freeSlots.isEmpty() ? slotCount : freeSlots.last();
+    if ( block->spill(spillFile, slot) )
+    {
+      if ( freeSlots.isEmpty() )
+        slotCount++;
+      else
+        freeSlots.removeLast();
+
+      spilledBlocks.insert(block->start(), block);
+      released += block->length();
+    }
+  }
+  return released;
+}
+
+bool CompactHistoryBlockList::restoreBlock(const void* addr)
+{
+  // find the last spilled block which starts at or before 'addr'
+  QMap<const quint8*, CompactHistoryBlock*>::iterator iter =
+      spilledBlocks.upperBound(static_cast<const quint8*>(addr));
+  if ( iter == spilledBlocks.begin() )
+    return true;
+  --iter;
+
+  CompactHistoryBlock* block = iter.value();
+  if ( !block->contains(addr) )
+    return true;
+
+  const int slot = block->slot();
+  if ( !block->restore(spillFile) )
+    return false;
+
+  freeSlots.append(slot);
+  spilledBlocks.erase(iter);
+  return true;
+}
+
+void CompactHistoryBlockList::clear()
+{
+  qDeleteAll ( list.begin(), list.end() );
+  list.clear();
+
+  freeSlots.clear();
+  slotCount = 0;
+  spilledBlocks.clear();
+  if ( spillFile.isOpen() )
+    spillFile.resize(0);
+}
+
 CompactHistoryBlockList::~CompactHistoryBlockList()
 {
   qDeleteAll ( list.begin(), list.end() );
@@ -581,11 +1107,69 @@ void* CompactHistoryLine::operator new (size_t size, CompactHistoryBlockList& bl
   return blockList.allocate(size);
 }
 
-CompactHistoryLine::CompactHistoryLine ( const TextLine& line, CompactHistoryBlockList& bList ) 
+CompactHistoryFormatTable::CompactHistoryFormatTable()
+{
+  // the default format is always present, it is used for lines which
+  // are added once the table is full
+  addFormat ( Character() );
+}
+
+quint16 CompactHistoryFormatTable::addFormat ( const Character& c )
+{
+  CharacterFormat format;
+  format.setFormat ( c );
+
+  QHash<CharacterFormat, quint16>::const_iterator iter = indexes.constFind ( format );
+  if ( iter != indexes.constEnd() )
+  {
+    refCounts[iter.value()]++;
+    return iter.value();
+  }
+
+  quint16 index;
+  if ( !freeIndexes.isEmpty() )
+  {
+    index = freeIndexes.last();
+    freeIndexes.pop_back();
+    formats[index] = format;
+    refCounts[index] = 1;
+  }
+  else if ( formats.size() <= 0xffff )
+  {
+    index = formats.size();
+    formats.append ( format );
+    refCounts.append ( 1 );
+  }
+  else
+  {
+    refCounts[0]++;
+    return 0;
+  }
+
+  indexes.insert ( format, index );
+  return index;
+}
+
+void CompactHistoryFormatTable::releaseFormat ( quint16 index )
+{
+  Q_ASSERT ( refCounts[index] > 0 );
+  if ( --refCounts[index] == 0 && index != 0 )
+  {
+    indexes.remove ( formats[index] );
+    freeIndexes.append ( index );
+  }
+}
+
+CompactHistoryLine::CompactHistoryLine ( const TextLine& line, CompactHistoryBlockList& bList,
+                                         CompactHistoryFormatTable& fTable )
   : blockList(bList),
-    formatLength(0)
+    formatTable(fTable),
+    text(0),
+    formatLength(0),
+    narrow(true)
 {
   length=line.size();
+  wrapped=false;
 
   if (line.size() > 0) {
     formatLength=1;
@@ -604,18 +1188,26 @@ CompactHistoryLine::CompactHistoryLine ( const TextLine& line, CompactHistoryBlo
     }
 
     //kDebug() << "number of different formats in string: " << formatLength;
-    formatArray = (CharacterFormat*) blockList.allocate(sizeof(CharacterFormat)*formatLength);
-    Q_ASSERT (formatArray!=NULL);
-    text = (quint16*) blockList.allocate(sizeof(quint16)*line.size());
-    Q_ASSERT (text!=NULL);
+    // most output is plain ASCII, which is stored with one byte per character
+    narrow=true;
+    for ( int i=0; i<length; i++ )
+    {
+      if ( line[i].character > 0xff )
+      {
+        narrow=false;
+        break;
+      }
+    }
 
-    length=line.size();
-    wrapped=false;
+    formatRuns = (FormatRun*) blockList.allocate(sizeof(FormatRun)*formatLength);
+    Q_ASSERT (formatRuns!=NULL);
+    text = blockList.allocate((narrow ? sizeof(quint8) : sizeof(quint16))*line.size());
+    Q_ASSERT (text!=NULL);
 
     // record formats and their positions in the format array
     c=line[0];
-    formatArray[0].setFormat ( c );
-    formatArray[0].startPos=0;                        // there's always at least 1 format (for the entire line, unless a change happens)
+    formatRuns[0].format = formatTable.addFormat ( c );
+    formatRuns[0].startPos=0;                        // there's always at least 1 format (for the entire line, unless a change happens)
 
     k=1;                                              // look for possible format changes
     int j=1;
@@ -624,19 +1216,25 @@ CompactHistoryLine::CompactHistoryLine ( const TextLine& line, CompactHistoryBlo
       if (!(line[k].equalsFormat(c)))
       {
         c=line[k];
-        formatArray[j].setFormat(c);
-        formatArray[j].startPos=k;
-        //kDebug() << "format entry " << j << " at pos " << formatArray[j].startPos << " " << &(formatArray[j].startPos) ;
+        formatRuns[j].format = formatTable.addFormat ( c );
+        formatRuns[j].startPos=k;
         j++;
       }
       k++;
     }
 
     // copy character values
-    for ( int i=0; i<line.size(); i++ )
+    if ( narrow )
     {
-      text[i]=line[i].character;
-      //kDebug() << "char " << i << " at mem " << &(text[i]);
+      quint8* narrowText = (quint8*) text;
+      for ( int i=0; i<line.size(); i++ )
+        narrowText[i]=line[i].character;
+    }
+    else
+    {
+      quint16* wideText = (quint16*) text;
+      for ( int i=0; i<line.size(); i++ )
+        wideText[i]=line[i].character;
     }
   }
   //kDebug() << "line created, length " << length << " at " << &(length);
@@ -645,41 +1243,101 @@ CompactHistoryLine::CompactHistoryLine ( const TextLine& line, CompactHistoryBlo
 CompactHistoryLine::~CompactHistoryLine()
 {
   if (length>0) {
+    for ( int i=0; i<formatLength; i++ )
+      formatTable.releaseFormat ( formatRuns[i].format );
+
     blockList.deallocate(text);
-    blockList.deallocate(formatArray);
+    blockList.deallocate(formatRuns);
   }
   blockList.deallocate(this);  
 }
 
+int CompactHistoryLine::formatIndex ( int column ) const
+{
+  // format runs are stored in order of their start positions, so the run
+  // containing 'column' is the last one which starts at or before it
+  int low=0;
+  int high=formatLength-1;
+  while ( low < high )
+  {
+    const int mid = ( low+high+1 ) / 2;
+    if ( formatRuns[mid].startPos <= column )
+      low=mid;
+    else
+      high=mid-1;
+  }
+  return low;
+}
+
 void CompactHistoryLine::getCharacter ( int index, Character& r )
 {
   Q_ASSERT ( index < length );
-  int formatPos=0;
-  while ( ( formatPos+1 ) < formatLength && index >= formatArray[formatPos+1].startPos )
-    formatPos++;
+  const CharacterFormat& format = formatTable.format ( formatRuns[formatIndex ( index )].format );
 
-  r.character=text[index];
-  r.rendition = formatArray[formatPos].rendition;
-  r.foregroundColor = formatArray[formatPos].fgColor;
-  r.backgroundColor = formatArray[formatPos].bgColor;
-  r.isRealCharacter = formatArray[formatPos].isRealCharacter;
+  r.character = narrow ? ((const quint8*) text)[index] : ((const quint16*) text)[index];
+  r.rendition = format.rendition;
+  r.foregroundColor = format.fgColor;
+  r.backgroundColor = format.bgColor;
+  r.isRealCharacter = format.isRealCharacter;
+}
+
+// fills 'count' characters of 'array' with the characters from 'text'
+// and the same format.  The loop does not depend on the width of the
+// text, so the narrow and wide cases are simple widening copies.
+template <typename T>
+static inline void decodeRun ( Character* array, const T* text, int count, const CharacterFormat& format )
+{
+  for ( int i=0; i<count; i++ )
+  {
+    Character& r = array[i];
+    r.character = text[i];
+    r.rendition = format.rendition;
+    r.foregroundColor = format.fgColor;
+    r.backgroundColor = format.bgColor;
+    r.isRealCharacter = format.isRealCharacter;
+  }
 }
 
-void CompactHistoryLine::getCharacters ( Character* array, int length, int startColumn )
+void CompactHistoryLine::getCharacters ( Character* array, int count, int startColumn )
 {
-  Q_ASSERT ( startColumn >= 0 && length >= 0 );
-  Q_ASSERT ( startColumn+length <= ( int ) getLength() );
+  Q_ASSERT ( startColumn >= 0 && count >= 0 );
+  Q_ASSERT ( startColumn+count <= ( int ) getLength() );
+
+  if ( count == 0 )
+    return;
+
+  // find the first format run once and then decode the requested
+  // characters one run at a time, rather than searching for the run of
+  // every character
+  const int end = startColumn+count;
+  int formatPos = formatIndex ( startColumn );
+  int i = startColumn;
 
-  for ( int i=startColumn; i<length+startColumn; i++ )
+  while ( i < end )
   {
-    getCharacter ( i, array[i-startColumn] );
+    const int runEnd = ( formatPos+1 < formatLength ) ? qMin ( end, int ( formatRuns[formatPos+1].startPos ) ) : end;
+    const CharacterFormat& format = formatTable.format ( formatRuns[formatPos].format );
+
+    if ( narrow )
+      decodeRun ( array + i - startColumn, ( const quint8* ) text + i, runEnd - i, format );
+    else
+      decodeRun ( array + i - startColumn, ( const quint16* ) text + i, runEnd - i, format );
+
+    i = runEnd;
+    formatPos++;
   }
 }
 
+// enough lines to cover the window of a very tall terminal display
+static const int DECODED_LINE_CACHE_SIZE = 256;
+
 CompactHistoryScroll::CompactHistoryScroll ( unsigned int maxLineCount )
     : HistoryScroll ( new CompactHistoryType ( maxLineCount ) )
     ,lines()
     ,blockList()
+    ,formatTable()
+    ,_decodedLines(DECODED_LINE_CACHE_SIZE)
+    ,_restoreFailed(false)
 {
   //kDebug() << "scroll of length " << maxLineCount << " created";
   setMaxNbLines ( maxLineCount );
@@ -687,22 +1345,75 @@ CompactHistoryScroll::CompactHistoryScroll ( unsigned int maxLineCount )
 
 CompactHistoryScroll::~CompactHistoryScroll()
 {
-  qDeleteAll ( lines.begin(), lines.end() );
+  _decodedLines.clear();
+  // the lines are allocated from the block list, which releases all of
+  // its blocks when destroyed.  The lines do not need to be deleted one by
+  // one, which would also mean restoring any spilled blocks first.
   lines.clear();
 }
 
 void CompactHistoryScroll::addCellsVector ( const TextLine& cells )
 {
+  if ( _restoreFailed )
+    clearLines();
+
   CompactHistoryLine* line;
-  line = new(blockList) CompactHistoryLine ( cells, blockList );
+  line = new(blockList) CompactHistoryLine ( cells, blockList, formatTable );
 
   if ( lines.size() > ( int ) _maxLineCount )
   {
-    delete lines.takeAt ( 0 );
+    removeFirstLine();
   }
   lines.append ( line );
 }
 
+void CompactHistoryScroll::removeFirstLine()
+{
+  CompactHistoryLine* line = residentLine ( 0 );
+  lines.removeFirst();
+  _decodedLines.remove ( line );
+  delete line;
+}
+
+CompactHistoryLine* CompactHistoryScroll::residentLine ( int lineNumber )
+{
+  if ( _restoreFailed )
+    return 0;
+
+  CompactHistoryLine* line = lines[lineNumber];
+  if ( !blockList.ensureResident ( line ) || !line->ensureResident() )
+  {
+    kWarning() << "The history could not be read back from its spill file and is cleared";
+    _restoreFailed = true;
+    _decodedLines.clear();
+    return 0;
+  }
+  return line;
+}
+
+void CompactHistoryScroll::clearLines()
+{
+  // the lines are released together with the blocks holding them, their
+  // memory may not be readable any more
+  _decodedLines.clear();
+  lines.clear();
+  blockList.clear();
+  formatTable = CompactHistoryFormatTable();
+  _restoreFailed = false;
+  _clearCount++;
+}
+
+qint64 CompactHistoryScroll::memoryUsage()
+{
+  return blockList.residentMemory();
+}
+
+qint64 CompactHistoryScroll::releaseMemory ( qint64 bytes )
+{
+  _decodedLines.clear();
+  return blockList.spill ( bytes );
+}
+
 void CompactHistoryScroll::addCells ( const Character a[], int count )
 {
   TextLine newLine ( count );
@@ -712,9 +1423,10 @@ void CompactHistoryScroll::addCells ( const Character a[], int count )
 
 void CompactHistoryScroll::addLine ( bool previousWrapped )
 {
-  CompactHistoryLine* line = lines.last();
+  CompactHistoryLine* line = residentLine ( lines.size()-1 );
   //kDebug() << "last line at address " << line;
-  line->setWrapped(previousWrapped);
+  if ( line )
+    line->setWrapped(previousWrapped);
 }
 
 int CompactHistoryScroll::getLines()
@@ -725,9 +1437,9 @@ int CompactHistoryScroll::getLines()
 int CompactHistoryScroll::getLineLen ( int lineNumber )
 {
   Q_ASSERT ( lineNumber >= 0 && lineNumber < lines.size() );
-  CompactHistoryLine* line = lines[lineNumber];
+  CompactHistoryLine* line = residentLine ( lineNumber );
   //kDebug() << "request for line at address " << line;
-  return line->getLength();
+  return line ? line->getLength() : 0;
 }
 
 
@@ -737,16 +1449,36 @@ void CompactHistoryScroll::getCells ( int lineNumber, int startColumn, int count
   Q_ASSERT ( lineNumber < lines.size() );
   CompactHistoryLine* line = lines[lineNumber];
   Q_ASSERT ( startColumn >= 0 );
-  Q_ASSERT ( (unsigned int)startColumn <= line->getLength() - count );
-  line->getCharacters ( buffer, count, startColumn );
+
+  // the line is only accessed (and restored if spilled) when it is not cached
+  const TextLine* decodedLine = _decodedLines.object ( line );
+  if ( !decodedLine )
+  {
+    if ( !residentLine ( lineNumber ) )
+    {
+      qFill ( buffer, buffer + count, Character() );
+      return;
+    }
+    TextLine* newLine = new TextLine ( line->getLength() );
+    line->getCharacters ( newLine->data(), newLine->size(), 0 );
+    _decodedLines.insert ( line, newLine );
+    decodedLine = newLine;
+  }
+
+  Q_ASSERT ( startColumn <= decodedLine->size() - count );
+
+  memcpy ( buffer, decodedLine->constData() + startColumn, count * sizeof ( Character ) );
 }
 
 void CompactHistoryScroll::setMaxNbLines ( unsigned int lineCount )
 {
   _maxLineCount = lineCount;
 
+  if ( _restoreFailed )
+    clearLines();
+
   while (lines.size() > (int) lineCount) {
-    delete lines.takeAt(0);
+    removeFirstLine();
   }
   //kDebug() << "set max lines to: " << _maxLineCount;
 }
@@ -754,7 +1486,8 @@ void CompactHistoryScroll::setMaxNbLines ( unsigned int lineCount )
 bool CompactHistoryScroll::isWrappedLine ( int lineNumber )
 {
   Q_ASSERT ( lineNumber < lines.size() );
-  return lines[lineNumber]->isWrapped();
+  const CompactHistoryLine* line = residentLine ( lineNumber );
+  return line && line->isWrapped();
 }
 
 
@@ -792,7 +1525,6 @@ int HistoryTypeNone::maximumLineCount() const
   return 0;
 }
 
-#if 0
 //////////////////////////////
 
 HistoryTypeBlockArray::HistoryTypeBlockArray(size_t size)
@@ -812,10 +1544,44 @@ int HistoryTypeBlockArray::maximumLineCount() const
 
 HistoryScroll* HistoryTypeBlockArray::scroll(HistoryScroll *old) const
 {
+  if (old)
+  {
+    HistoryScrollBlockArray* oldBuffer = dynamic_cast<HistoryScrollBlockArray*>(old);
+    if (oldBuffer && (size_t)oldBuffer->getType().maximumLineCount() == m_size)
+      return old; // Unchanged.
+  }
+
+  HistoryScroll* newScroll = new HistoryScrollBlockArray(m_size);
+
+  // copy the most recent lines of the previous history
+  int lines = (old != 0) ? old->getLines() : 0;
+  int startLine = 0;
+  if (lines > (int) m_size)
+     startLine = lines - m_size;
+
+  Character line[LINE_SIZE];
+  for(int i = startLine; i < lines; i++)
+  {
+     int size = old->getLineLen(i);
+     if (size > LINE_SIZE)
+     {
+        Character* tmp_line = new Character[size];
+        old->getCells(i, 0, size, tmp_line);
+        newScroll->addCells(tmp_line, size);
+        newScroll->addLine(old->isWrappedLine(i));
+        delete [] tmp_line;
+     }
+     else
+     {
+        old->getCells(i, 0, size, line);
+        newScroll->addCells(line, size);
+        newScroll->addLine(old->isWrappedLine(i));
+     }
+  }
+
   delete old;
-  return new HistoryScrollBlockArray(m_size);
+  return newScroll;
 }
-#endif
 
 #if 0
 //////////////////////////////
@@ -929,6 +1695,98 @@ int HistoryTypeFile::maximumLineCount() const
 
 //////////////////////////////
 
+HistoryTypeJournal::HistoryTypeJournal(const QString& directory, const QString& name)
+  : m_directory(directory),
+    m_name(name)
+{
+}
+
+bool HistoryTypeJournal::isEnabled() const
+{
+  return true;
+}
+
+int HistoryTypeJournal::maximumLineCount() const
+{
+  return -1;
+}
+
+QString HistoryTypeJournal::directory() const
+{
+  return m_directory;
+}
+
+QString HistoryTypeJournal::name() const
+{
+  return m_name;
+}
+
+QString HistoryTypeJournal::journalPath(const QString& directory, const QString& name)
+{
+  return QDir(directory).filePath(name + QLatin1String(".journal"));
+}
+
+void HistoryTypeJournal::removeJournal(const QString& directory, const QString& name)
+{
+  const QString path = journalPath(directory, name);
+  QFile::remove(path);
+  QFile::remove(path + QLatin1String(".index"));
+}
+
+void HistoryTypeJournal::removeStaleJournals(const QString& directory, const QString& keepName, int days)
+{
+  const QDateTime oldest = QDateTime::currentDateTime().addDays(-days);
+  const QFileInfoList journals = QDir(directory).entryInfoList(QStringList() << QLatin1String("*.journal"),
+                                                                QDir::Files);
+  foreach ( const QFileInfo& journal , journals )
+  {
+    if ( journal.completeBaseName() != keepName && journal.lastModified() < oldest )
+      removeJournal(directory, journal.completeBaseName());
+  }
+}
+
+HistoryScroll* HistoryTypeJournal::scroll(HistoryScroll* old) const
+{
+  HistoryScrollJournal* oldJournal = dynamic_cast<HistoryScrollJournal*>(old);
+  if (oldJournal)
+  {
+    const HistoryTypeJournal& oldType = static_cast<const HistoryTypeJournal&>(oldJournal->getType());
+    if (oldType.directory() == m_directory && oldType.name() == m_name)
+      return old; // Unchanged.
+  }
+
+  // without a previous history the journal is started afresh (eg. when
+  // the history is cleared), otherwise lines already in the journal are kept
+  // and the previous history is appended to them
+  HistoryScroll* newScroll = new HistoryScrollJournal(m_directory, m_name, old == 0);
+
+  Character line[LINE_SIZE];
+  int lines = (old != 0) ? old->getLines() : 0;
+  for(int i = 0; i < lines; i++)
+  {
+     int size = old->getLineLen(i);
+     if (size > LINE_SIZE)
+     {
+        Character* tmp_line = new Character[size];
+        old->getCells(i, 0, size, tmp_line);
+        newScroll->addCells(tmp_line, size);
+        newScroll->addLine(old->isWrappedLine(i));
+        delete [] tmp_line;
+     }
+     else
+     {
+        old->getCells(i, 0, size, line);
+        newScroll->addCells(line, size);
+        newScroll->addLine(old->isWrappedLine(i));
+     }
+  }
+
+  delete old;
+  return newScroll;
+}
+
+//////////////////////////////
+
 CompactHistoryType::CompactHistoryType ( unsigned int nbLines )
     : m_nbLines ( nbLines )
 {
@@ -22,19 +22,24 @@
 #define TEHISTORY_H
 
 // System
+#include <string.h>
 #include <sys/mman.h>
 
 // Qt
 #include <QtCore/QBitRef>
+#include <QtCore/QCache>
+#include <QtCore/QFile>
 #include <QtCore/QHash>
+#include <QtCore/QMap>
 #include <QtCore/QVector>
 
 // KDE
 #include <KTemporaryFile>
 
 // Konsole
-//#include "BlockArray.h"
+#include "BlockArray.h"
 #include "Character.h"
+#include "konsole_export.h"
 
 namespace Konsole
 {
@@ -86,7 +91,7 @@ private:
 //////////////////////////////////////////////////////////////////////
 class HistoryType;
 
-class HistoryScroll
+class KONSOLEPRIVATE_EXPORT HistoryScroll
 {
 public:
   HistoryScroll(HistoryType*);
@@ -111,6 +116,28 @@ public:
 
   virtual void addLine(bool previousWrapped=false) = 0;
 
+  /**
+   * Returns the number of bytes of memory currently used to hold the lines
+   * of the history.  Histories which keep their lines on disk return 0.
+   */
+  virtual qint64 memoryUsage() { return 0; }
+  /**
+   * Moves the oldest lines of the history out of memory until at least
+   * @p bytes have been released, or nothing more can be released.  Lines
+   * which have been moved out of memory are read back when accessed.
+   *
+   * Returns the number of bytes which were released.
+   */
+  virtual qint64 releaseMemory(qint64 bytes) { Q_UNUSED(bytes); return 0; }
+
+  /**
+   * Returns the number of times the history has discarded all of its
+   * lines by itself, for example because lines which were moved out of
+   * memory could not be read back.  Users which keep track of the lines in
+   * the history compare it before and after adding a line.
+   */
+  int clearCount() const { return _clearCount; }
+
   //
   // FIXME:  Passing around constant references to HistoryType instances
   // is very unsafe, because those references will no longer
@@ -120,6 +147,7 @@ public:
 
 protected:
   HistoryType* _historyType;
+  int _clearCount;
 
 };
 
@@ -150,6 +178,96 @@ private:
   HistoryFile lineflags; // flags Row(unsigned char)
 };
 
+//////////////////////////////////////////////////////////////////////
+// Journal-based history (persistent on-disk log, no limitation in length)
+//////////////////////////////////////////////////////////////////////
+
+/*
+   Each line is appended to the journal as a record consisting of a
+   header (with the record's length, the cell count, line flags and a
+   checksum of the record) followed by the line's cells and the code
+   points of any combined characters in it.  Records are written byte by
+   byte in little-endian order, so they do not depend on the layout of
+   Character in memory or on the table of combined characters of the
+   process which wrote them.  A separate index file holds the offset of
+   every record so that lines can be read randomly without scanning the
+   journal.
+
+   Records are written before their index entries, so if Konsole is
+   killed at most the tail of the journal is incomplete.  When an existing
+   journal is opened only that tail is verified and repaired, the remaining
+   lines are read from disk on demand.  The journal is not synced to disk
+   after each line, so lines written shortly before a crash of the whole
+   system may be lost.  Like the file-based history, the journal is not
+   limited in size.
+*/
+class KONSOLEPRIVATE_EXPORT HistoryScrollJournal : public HistoryScroll
+{
+public:
+  /**
+   * Opens the journal called @p name in @p directory.  If @p truncate is true
+   * any lines already in the journal are discarded, otherwise they become the
+   * first lines of the history.
+   */
+  HistoryScrollJournal(const QString& directory, const QString& name, bool truncate);
+  virtual ~HistoryScrollJournal();
+
+  virtual int  getLines();
+  virtual int  getLineLen(int lineno);
+  virtual void getCells(int lineno, int colno, int count, Character res[]);
+  virtual bool isWrappedLine(int lineno);
+
+  virtual void addCells(const Character a[], int count);
+  virtual void addLine(bool previousWrapped=false);
+
+private:
+  struct RecordHeader
+  {
+    quint32 magic;
+    quint32 length;     // the number of bytes after the header
+    quint32 cellCount;
+    quint8  flags;
+    quint8  reserved;
+    quint16 checksum;
+  };
+
+  static qint64 recordSize(const RecordHeader& header);
+  static void encodeHeader(const RecordHeader& header, char* data);
+  static void decodeHeader(const char* data, RecordHeader& header);
+  // encodes the cells of a line into the part of a record after the header
+  static QByteArray encodeCells(const QVector<Character>& cells);
+  // decodes the part of a record after 'header' into 'cells'
+  static void decodeCells(const RecordHeader& header, const QByteArray& data, QVector<Character>& cells);
+
+  // reads the header of the record at 'offset'.  If 'data' is not null the
+  // rest of the record is read into it and checked against the header's
+  // checksum.
+  bool readRecord(qint64 offset, RecordHeader& header, QByteArray* data);
+  qint64 recordOffset(int lineno);
+  // returns the header of the record for 'lineno', the most recently
+  // used header is cached since lines are usually read one at a time
+  const RecordHeader& lineHeader(int lineno);
+  // returns the cells of 'lineno', those of the most recently read line
+  // are cached
+  const QVector<Character>& lineCells(int lineno);
+  // drops index entries of incomplete records and indexes complete records
+  // which were written to the journal but not to the index before a crash
+  void recover();
+
+  QFile _journal;
+  QFile _index;
+  qint64 _journalLength;
+  int _lineCount;
+
+  // cells passed to addCells() which are written by the following addLine()
+  QVector<Character> _pendingCells;
+
+  int _cachedLine;
+  RecordHeader _cachedHeader;
+  int _cachedCellsLine;
+  QVector<Character> _cachedCells;
+};
+
 #if 0
 //////////////////////////////////////////////////////////////////////
 // Buffer-based history (limited to a fixed nb of lines)
@@ -226,11 +344,12 @@ public:
   virtual void addLine(bool previousWrapped=false);
 };
 
-#if 0
 //////////////////////////////////////////////////////////////////////
 // BlockArray-based history
+// Lines are kept in a ring buffer of fixed size which is allocated
+// up front, the oldest lines are dropped when the buffer is full
 //////////////////////////////////////////////////////////////////////
-class HistoryScrollBlockArray : public HistoryScroll
+class KONSOLEPRIVATE_EXPORT HistoryScrollBlockArray : public HistoryScroll
 {
 public:
   HistoryScrollBlockArray(size_t size);
@@ -244,11 +363,12 @@ public:
   virtual void addCells(const Character a[], int count);
   virtual void addLine(bool previousWrapped=false);
 
+  virtual qint64 memoryUsage();
+
 protected:
   BlockArray m_blockArray;
-  QHash<int,size_t> m_lineLengths;
+  size_t m_maxLineCount;
 };
-#endif
 
 //////////////////////////////////////////////////////////////////////
 // History using compact storage
@@ -260,12 +380,9 @@ typedef QVector<Character> TextLine;
 class CharacterFormat
 {
 public:
-  bool equalsFormat(const CharacterFormat& other) const {
-    return (other.rendition & ~RE_EXTENDED_CHAR)==(rendition & ~RE_EXTENDED_CHAR) && other.fgColor==fgColor && other.bgColor==bgColor;
-  }
-
-  bool equalsFormat(const Character& c) const {
-    return (c.rendition & ~RE_EXTENDED_CHAR)==(rendition & ~RE_EXTENDED_CHAR) && c.foregroundColor==fgColor && c.backgroundColor==bgColor;
+  bool operator==(const CharacterFormat& other) const {
+    return other.rendition==rendition && other.fgColor==fgColor && other.bgColor==bgColor
+        && other.isRealCharacter==isRealCharacter;
   }
 
   void setFormat(const Character& c) {
@@ -276,11 +393,45 @@ public:
   }
 
   CharacterColor fgColor, bgColor;
-  quint16 startPos;
   quint8 rendition;
   bool isRealCharacter;
 };
 
+inline uint qHash(const CharacterFormat& format)
+{
+  quint32 fg, bg;
+  memcpy(&fg, &format.fgColor, sizeof(fg));
+  memcpy(&bg, &format.bgColor, sizeof(bg));
+  return ( fg * 31 + bg ) ^ ( uint(format.rendition) << 24 ) ^ format.isRealCharacter;
+}
+
+/*
+   The formats used by the lines of a history.  Most output uses only a
+   handful of different formats, so each format is stored once and the
+   lines refer to it by its index in the table.  Formats are reference
+   counted and their entries are reused once no line refers to them.
+*/
+class KONSOLEPRIVATE_EXPORT CompactHistoryFormatTable
+{
+public:
+  CompactHistoryFormatTable();
+
+  // returns the index of the format of 'c', adding it to the table if
+  // necessary, and takes a reference to it
+  quint16 addFormat(const Character& c);
+  // drops a reference to the format at 'index'
+  void releaseFormat(quint16 index);
+
+  const CharacterFormat& format(quint16 index) const { return formats[index]; }
+  int count() const { return indexes.size(); }
+
+private:
+  QVector<CharacterFormat> formats;
+  QVector<quint32> refCounts;
+  QHash<CharacterFormat, quint16> indexes;
+  QVector<quint16> freeIndexes;
+};
+
 class CompactHistoryBlock
 {
 public:
@@ -292,6 +443,8 @@ public:
     Q_ASSERT(head != MAP_FAILED);
     tail = blockStart = head;
     allocCount=0;
+    spillSlot=-1;
+    spillLength=0;
   }
 
   virtual ~CompactHistoryBlock(){
@@ -302,56 +455,120 @@ public:
   virtual unsigned int remaining(){ return blockStart+blockLength-tail;}
   virtual unsigned  length() { return blockLength; }
   virtual void* allocate(size_t length);
-  virtual bool contains(void* addr) {return addr>=blockStart && addr<(blockStart+blockLength);}
+  virtual bool contains(const void* addr) {return addr>=blockStart && addr<(blockStart+blockLength);}
   virtual void deallocate();
   virtual bool isInUse(){ return allocCount!=0; } ;
 
+  // compresses the used part of the block into 'file' at the position of
+  // 'slot' and releases the block's memory.  The address range of the block
+  // stays reserved, so pointers into the block remain valid once it is restored.
+  bool spill(QFile& file, int slot);
+  // reads the block's contents back from 'file', returns false if they
+  // could not be read
+  bool restore(QFile& file);
+  bool isSpilled() const { return spillSlot != -1; }
+  int slot() const { return spillSlot; }
+  quint8* start() const { return blockStart; }
+
 private:
   size_t blockLength;
   quint8* head;
   quint8* tail;
   quint8* blockStart;
   int allocCount;
+  int spillSlot;
+  int spillLength;
 };
 
+/*
+   Blocks can be spilled to a temporary file to reduce the memory used by
+   histories which are not looked at.  Users of the blocks must call
+   ensureResident() with the address of the data they are about to access,
+   which restores the block containing it if necessary.
+*/
 class CompactHistoryBlockList {
 public:
-  CompactHistoryBlockList() {};
+  CompactHistoryBlockList() : slotCount(0) {};
   ~CompactHistoryBlockList();
 
   void* allocate( size_t size );
   void deallocate(void *);
   int length() {return list.size();}
+
+  // returns the number of bytes of memory held by blocks which are not spilled
+  qint64 residentMemory();
+  // spills blocks, starting with the oldest one, until at least 'bytes'
+  // have been released.  The block which is currently being filled is never spilled.
+  qint64 spill(qint64 bytes);
+  // returns false if the block could not be restored, its contents are lost
+  bool ensureResident(const void* addr) { return spilledBlocks.isEmpty() || restoreBlock(addr); }
+  // releases all the blocks, without their allocations being deallocated
+  void clear();
+
 private:
+  bool restoreBlock(const void* addr);
+  void releaseSlot(CompactHistoryBlock* block);
+
   QList<CompactHistoryBlock*> list;
+
+  KTemporaryFile spillFile;
+  QList<int> freeSlots;
+  int slotCount;
+  // the spilled blocks keyed by their start address, so that the block
+  // containing an address is found without searching the whole list
+  QMap<const quint8*, CompactHistoryBlock*> spilledBlocks;
 };
 
 class CompactHistoryLine
 {
 public:
-  CompactHistoryLine(const TextLine&, CompactHistoryBlockList& blockList);
+  CompactHistoryLine(const TextLine&, CompactHistoryBlockList& blockList,
+                     CompactHistoryFormatTable& formatTable);
   virtual ~CompactHistoryLine();
 
   // custom new operator to allocate memory from custom pool instead of heap
   static void* operator new( size_t size, CompactHistoryBlockList& blockList);
   static void operator delete( void *) { /* do nothing, deallocation from pool is done in destructor*/ } ;
 
-  virtual void getCharacters(Character* array, int length, int startColumn) ;
+  virtual void getCharacters(Character* array, int count, int startColumn) ;
   virtual void getCharacter(int index, Character& r) ;
   virtual bool isWrapped() const {return wrapped;};
   virtual void setWrapped(bool isWrapped) { wrapped=isWrapped;};
   virtual unsigned int getLength() const {return length;};
 
+  // restores the blocks holding the text and formats of this line if they
+  // were spilled.  The line itself must already be resident.  Returns false
+  // if they could not be restored.
+  bool ensureResident() {
+    return length == 0 ||
+           ( blockList.ensureResident(text) && blockList.ensureResident(formatRuns) );
+  }
+
 protected:
+  // a run of characters with the same format, which starts at 'startPos'
+  // and uses the format at index 'format' in the format table
+  struct FormatRun
+  {
+    quint16 startPos;
+    quint16 format;
+  };
+
+  // returns the index in formatRuns of the format run which contains 'column'
+  int formatIndex(int column) const;
+
   CompactHistoryBlockList& blockList;
-  CharacterFormat* formatArray;
+  CompactHistoryFormatTable& formatTable;
+  FormatRun* formatRuns;
   quint16 length;
-  quint16* text;
+  // the characters of the line, stored as quint8 if they are all in the
+  // Latin-1 range and as quint16 otherwise
+  void* text;
   quint16 formatLength;
   bool wrapped;
+  bool narrow;
 };
 
-class CompactHistoryScroll : public HistoryScroll
+class KONSOLEPRIVATE_EXPORT CompactHistoryScroll : public HistoryScroll
 {
   typedef QList<CompactHistoryLine*> HistoryArray;
 
@@ -368,21 +585,44 @@ public:
   virtual void addCellsVector(const TextLine& cells);
   virtual void addLine(bool previousWrapped=false);
 
+  virtual qint64 memoryUsage();
+  virtual qint64 releaseMemory(qint64 bytes);
+
   void setMaxNbLines(unsigned int nbLines);
 
 private:
   bool hasDifferentColors(const TextLine& line) const;
+  // returns the line at 'lineNumber', restoring its memory if it was spilled,
+  // or 0 if the memory of the history could not be restored
+  CompactHistoryLine* residentLine(int lineNumber);
+  // removes the oldest line from the history
+  void removeFirstLine();
+  // removes all lines, without accessing their memory, once a spilled
+  // block could not be restored
+  void clearLines();
+
   HistoryArray lines;
   CompactHistoryBlockList blockList;
+  CompactHistoryFormatTable formatTable;
+
+  // expanded copies of the most recently read lines.  When the view is
+  // scrolled back, the same window of lines is requested on every repaint,
+  // so this avoids decoding them from the compact representation each time.
+  QCache<const CompactHistoryLine*, TextLine> _decodedLines;
 
   unsigned int _maxLineCount;
+
+  // true once a spilled block could not be read back.  The lines read as
+  // empty until the history is cleared when the next line is added, so
+  // that the number of lines does not change while they are being read.
+  bool _restoreFailed;
 };
 
 //////////////////////////////////////////////////////////////////////
 // History type
 //////////////////////////////////////////////////////////////////////
 
-class HistoryType
+class KONSOLEPRIVATE_EXPORT HistoryType
 {
 public:
   HistoryType();
@@ -419,10 +659,14 @@ public:
   virtual HistoryScroll* scroll(HistoryScroll *) const;
 };
 
-#if 0
-class HistoryTypeBlockArray : public HistoryType
+class KONSOLEPRIVATE_EXPORT HistoryTypeBlockArray : public HistoryType
 {
 public:
+  /**
+   * Constructs a history type which keeps up to @p size lines in a ring
+   * buffer.  The buffer is sized for lines of a typical width, so fewer
+   * lines are kept if the lines are longer.
+   */
   HistoryTypeBlockArray(size_t size);
 
   virtual bool isEnabled() const;
@@ -433,7 +677,6 @@ public:
 protected:
   size_t m_size;
 };
-#endif
 
 class HistoryTypeFile : public HistoryType
 {
@@ -449,6 +692,40 @@ protected:
   QString m_fileName;
 };
 
+class KONSOLEPRIVATE_EXPORT HistoryTypeJournal : public HistoryType
+{
+public:
+  /**
+   * Constructs a persistent history type which stores lines in the journal
+   * called @p name inside @p directory.  Reattaching to an existing journal
+   * only reads the end of it, earlier lines are read from disk on demand.
+   */
+  HistoryTypeJournal(const QString& directory, const QString& name);
+
+  virtual bool isEnabled() const;
+  virtual int maximumLineCount() const;
+
+  virtual HistoryScroll* scroll(HistoryScroll *) const;
+
+  QString directory() const;
+  QString name() const;
+
+  /** Returns the path of the journal file for @p name in @p directory. */
+  static QString journalPath(const QString& directory, const QString& name);
+  /** Removes the journal called @p name in @p directory from disk. */
+  static void removeJournal(const QString& directory, const QString& name);
+  /**
+   * Removes the journals in @p directory which have not been written to
+   * for @p days days, except the one called @p keepName.  These are left
+   * behind by saved sessions which were never restored.
+   */
+  static void removeStaleJournals(const QString& directory, const QString& keepName, int days);
+
+protected:
+  QString m_directory;
+  QString m_name;
+};
+
 #if 0
 class HistoryTypeBuffer : public HistoryType
 {
@@ -467,7 +744,7 @@ protected:
 };
 #endif
 
-class CompactHistoryType : public HistoryType
+class KONSOLEPRIVATE_EXPORT CompactHistoryType : public HistoryType
 {
 public:
   CompactHistoryType(unsigned int size);
@@ -0,0 +1,108 @@
+/*
+    Copyright 2012 by Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "HistoryMemoryGovernor.h"
+
+// Qt
+#include <QtCore/QTimer>
+
+// Konsole
+#include "Session.h"
+
+using namespace Konsole;
+
+// interval at which the memory used by the histories is checked
+static const int CHECK_INTERVAL = 5000;
+// once the budget is exceeded, history is moved out of memory until the
+// usage is this percentage of the budget.  Lines which are read back do
+// not then make the usage exceed the budget again at the next check.
+static const int LOW_WATER_PERCENT = 75;
+
+HistoryMemoryGovernor::HistoryMemoryGovernor(QObject* parent)
+    : QObject(parent)
+    , _budget(0)
+{
+    _timer = new QTimer(this);
+    _timer->setInterval(CHECK_INTERVAL);
+    connect(_timer, SIGNAL(timeout()), this, SLOT(enforceBudget()));
+}
+
+void HistoryMemoryGovernor::setBudget(qint64 bytes)
+{
+    _budget = qMax(bytes, (qint64)0);
+
+    if (_budget > 0)
+        _timer->start();
+    else
+        _timer->stop();
+}
+
+qint64 HistoryMemoryGovernor::budget() const
+{
+    return _budget;
+}
+
+void HistoryMemoryGovernor::addSession(Session* session)
+{
+    // new sessions are assumed to be viewed straight away
+    _sessions.append(session);
+    connect(session, SIGNAL(destroyed(QObject*)), this, SLOT(sessionDestroyed(QObject*)));
+}
+
+void HistoryMemoryGovernor::sessionDestroyed(QObject* session)
+{
+    _sessions.removeAll(static_cast<Session*>(session));
+}
+
+void HistoryMemoryGovernor::sessionViewed(Session* session)
+{
+    if (_sessions.removeOne(session))
+        _sessions.append(session);
+}
+
+qint64 HistoryMemoryGovernor::memoryUsage() const
+{
+    qint64 total = 0;
+    foreach(Session* session, _sessions)
+        total += session->historyMemoryUsage();
+    return total;
+}
+
+void HistoryMemoryGovernor::enforceBudget()
+{
+    if (_budget <= 0)
+        return;
+
+    const qint64 usage = memoryUsage();
+    if (usage <= _budget)
+        return;
+
+    qint64 excess = usage - _budget * LOW_WATER_PERCENT / 100;
+
+    foreach(Session* session, _sessions)
+    {
+        if (excess <= 0)
+            break;
+
+        excess -= session->releaseHistoryMemory(excess);
+    }
+}
+
+#include "HistoryMemoryGovernor.moc"
@@ -0,0 +1,92 @@
+/*
+    Copyright 2012 by Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef HISTORYMEMORYGOVERNOR_H
+#define HISTORYMEMORYGOVERNOR_H
+
+// Qt
+#include <QtCore/QList>
+#include <QtCore/QObject>
+
+// Konsole
+#include "konsole_export.h"
+
+class QTimer;
+
+namespace Konsole
+{
+
+class Session;
+
+/**
+ * Limits the memory used by the history stores of all sessions.
+ *
+ * The governor keeps track of the order in which sessions were last viewed.
+ * When the memory used by the histories of all sessions exceeds the budget
+ * set with setBudget(), the oldest lines in the histories of the least
+ * recently viewed sessions are moved out of memory into compressed
+ * temporary files.  They are read back when those lines are accessed again.
+ */
+class KONSOLEPRIVATE_EXPORT HistoryMemoryGovernor : public QObject
+{
+Q_OBJECT
+
+public:
+    HistoryMemoryGovernor(QObject* parent = 0);
+
+    /**
+     * Sets the number of bytes of memory which the histories of all sessions
+     * may use together.  A budget of 0 means that the memory is not limited.
+     */
+    void setBudget(qint64 bytes);
+    /** Returns the budget set with setBudget() */
+    qint64 budget() const;
+
+    /** Adds @p session to the sessions whose history memory is limited. */
+    void addSession(Session* session);
+    /**
+     * Marks @p session as the most recently viewed session, its history
+     * is the last one to be moved out of memory.
+     */
+    void sessionViewed(Session* session);
+
+    /** Returns the number of bytes of memory used by the histories of all sessions. */
+    qint64 memoryUsage() const;
+
+public slots:
+    /**
+     * If the memory used exceeds the budget, moves history out of memory,
+     * starting with the least recently viewed session, until the memory used
+     * is well below the budget.
+     */
+    void enforceBudget();
+
+private slots:
+    void sessionDestroyed(QObject* session);
+
+private:
+    // sessions ordered from the least to the most recently viewed
+    QList<Session*> _sessions;
+    QTimer* _timer;
+    qint64 _budget;
+};
+
+}
+
+#endif // HISTORYMEMORYGOVERNOR_H
@@ -0,0 +1,316 @@
+/*
+    Copyright 2012 by Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "HistorySearchIndex.h"
+
+// Qt
+#include <QtCore/QVector>
+
+// Konsole
+#include "Character.h"
+#include "konsole_wcwidth.h"
+
+// System
+#include <limits.h>
+
+using namespace Konsole;
+
+// each block has a signature of 2^SIGNATURE_SHIFT bits.  With a few
+// thousand trigrams in the text of a block, about one bit in six is set
+// and a search for ten characters rarely finds a block which does not
+// contain them.
+static const int SIGNATURE_SHIFT = 13;
+static const int SIGNATURE_BITS = 1 << SIGNATURE_SHIFT;
+
+static const qint64 BLOCK_BYTES = SIGNATURE_BITS / 8 + 32;
+
+static inline uint trigramBit(ushort a , ushort b , ushort c)
+{
+    uint hash = a;
+    hash = hash * 0x9E3779B1U ^ b;
+    hash = hash * 0x9E3779B1U ^ c;
+    hash *= 0x9E3779B1U;
+    return hash >> (32 - SIGNATURE_SHIFT);
+}
+
+// the lines of the index are divided into segments: the lines before the
+// first block, which have not been indexed, each block and the lines after
+// the last one.  Consecutive segments joined by wrapped lines make up a
+// chain, which is searched as a whole if its text may contain a match.
+struct Segment
+{
+    int start;
+    int end;
+    const QBitArray* signature;  // 0 if the lines are not indexed
+    bool continued;
+};
+
+static QString foldCase(const QString& text)
+{
+    QString folded(text);
+    for (int i = 0 ; i < folded.length() ; i++)
+        folded[i] = folded[i].toCaseFolded();
+    return folded;
+}
+
+HistorySearchIndex::HistorySearchIndex()
+    : _firstBlock(0)
+    , _addedLines(0)
+    , _removedLines(0)
+    , _recentCount(0)
+    , _lastLineWrapped(false)
+    , _memoryLimit(0)
+{
+}
+
+void HistorySearchIndex::setMemoryLimit(qint64 bytes)
+{
+    _memoryLimit = bytes;
+    enforceLimit();
+}
+
+qint64 HistorySearchIndex::memoryLimit() const
+{
+    return _memoryLimit;
+}
+
+qint64 HistorySearchIndex::memoryUsage() const
+{
+    return _blocks.count() * BLOCK_BYTES;
+}
+
+void HistorySearchIndex::clear()
+{
+    _blocks.clear();
+    _firstBlock = 0;
+    _addedLines = 0;
+    _removedLines = 0;
+    _recentCount = 0;
+    _lastLineWrapped = false;
+}
+
+void HistorySearchIndex::reset(int lineCount , bool lastLineWrapped)
+{
+    clear();
+
+    // the lines are put before the first block, where lines which are
+    // not indexed are
+    _addedLines = lineCount;
+    _lastLineWrapped = lastLineWrapped;
+}
+
+void HistorySearchIndex::enforceLimit()
+{
+    while ( !_blocks.isEmpty() && memoryUsage() > _memoryLimit )
+    {
+        _blocks.removeFirst();
+        _firstBlock++;
+    }
+}
+
+inline void HistorySearchIndex::addCharacter(Block* block , ushort character)
+{
+    const ushort folded = QChar::toCaseFolded(character);
+
+    if ( block && _recentCount == 2 )
+        block->signature.setBit( trigramBit(_recent[0], _recent[1], folded) );
+
+    _recent[0] = _recent[1];
+    _recent[1] = folded;
+    _recentCount = qMin(_recentCount + 1, 2);
+}
+
+void HistorySearchIndex::addLine(const Character* characters , int count , bool wrapped)
+{
+    const qint64 line = _addedLines++;
+    const bool continued = _lastLineWrapped;
+    _lastLineWrapped = wrapped;
+
+    // the text at the end of the previous line belongs to the same line of
+    // output, so the trigrams which span the two are indexed as well
+    if ( !continued )
+        _recentCount = 0;
+
+    if ( line % BLOCK_LINES == 0 && BLOCK_BYTES <= _memoryLimit )
+    {
+        if ( _blocks.isEmpty() )
+            _firstBlock = line / BLOCK_LINES;
+
+        Block block;
+        block.signature = QBitArray(SIGNATURE_BITS);
+        block.continued = continued;
+        _blocks << block;
+
+        enforceLimit();
+    }
+
+    // the block of this line may have been discarded, the end of the line
+    // is still needed if it is wrapped
+    Block* block = 0;
+    if ( !_blocks.isEmpty() && _firstBlock + _blocks.count() - 1 == line / BLOCK_LINES )
+        block = &_blocks.last();
+    else if ( !wrapped )
+        return;
+
+    // the characters are taken in the same way as PlainTextDecoder decodes
+    // them for a search, without decoding the line into a string first
+    int guard = -1;
+    for (int i = count - 1 ; i >= 0 ; i--)
+    {
+        if ( characters[i].isRealCharacter && characters[i].character != '\n' )
+        {
+            guard = i;
+            break;
+        }
+    }
+
+    for (int i = 0 ; i < count ; )
+    {
+        const Character& character = characters[i];
+        if ( character.rendition & RE_EXTENDED_CHAR )
+        {
+            ushort length = 0;
+            const ushort* chars = ExtendedCharTable::instance.lookupExtendedChar(character.character, length);
+            if ( !chars )
+            {
+                i++;
+                continue;
+            }
+
+            for (int k = 0 ; k < length ; k++)
+                addCharacter(block, chars[k]);
+            i += qMax(1, string_width(QString::fromUtf16(chars, length)));
+        }
+        else if ( character.isRealCharacter || i <= guard )
+        {
+            addCharacter(block, character.character);
+            i += qMax(1, konsole_wcwidth(character.character));
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+void HistorySearchIndex::removeFirstLine()
+{
+    if ( lineCount() == 0 )
+        return;
+
+    _removedLines++;
+
+    while ( !_blocks.isEmpty() && (_firstBlock + 1) * BLOCK_LINES <= _removedLines )
+    {
+        _blocks.removeFirst();
+        _firstBlock++;
+    }
+}
+
+int HistorySearchIndex::lineCount() const
+{
+    return _addedLines - _removedLines;
+}
+
+QList< QPair<int,int> > HistorySearchIndex::candidateLines(const QString& text ,
+                                                         int firstLine , int lastLine) const
+{
+    QList< QPair<int,int> > ranges;
+    if ( firstLine > lastLine )
+        return ranges;
+
+    // text on separate lines of output is never indexed together
+    if ( text.length() < 3 || text.contains('\n') )
+    {
+        ranges << qMakePair(firstLine, lastLine);
+        return ranges;
+    }
+
+    QVector<uint> bits;
+    const QString folded = foldCase(text);
+    const ushort* chars = folded.utf16();
+    for (int i = 0 ; i + 2 < folded.length() ; i++)
+        bits << trigramBit(chars[i], chars[i+1], chars[i+2]);
+
+    const int count = lineCount();
+    QVector<Segment> segments;
+
+    const int headEnd = _blocks.isEmpty() ? count :
+                        int(qMax<qint64>(0, _firstBlock * BLOCK_LINES - _removedLines));
+    if ( headEnd > 0 )
+    {
+        const Segment head = { 0 , headEnd - 1 , 0 , false };
+        segments << head;
+    }
+    for (int i = 0 ; i < _blocks.count() ; i++)
+    {
+        const qint64 blockStart = (_firstBlock + i) * BLOCK_LINES - _removedLines;
+        const Segment segment = { int(qMax<qint64>(0, blockStart)) ,
+                                  int(qMin<qint64>(count - 1, blockStart + BLOCK_LINES - 1)) ,
+                                  &_blocks[i].signature ,
+                                  _blocks[i].continued && (blockStart >= 0) };
+        segments << segment;
+    }
+    const Segment tail = { count , INT_MAX , 0 , _lastLineWrapped };
+    segments << tail;
+
+    int chainStart = 0;
+    while ( chainStart < segments.count() )
+    {
+        int chainEnd = chainStart;
+        while ( chainEnd + 1 < segments.count() && segments[chainEnd + 1].continued )
+            chainEnd++;
+
+        const int start = segments[chainStart].start;
+        const int end = segments[chainEnd].end;
+
+        if ( start <= lastLine && end >= firstLine )
+        {
+            bool indexed = true;
+            for (int i = chainStart ; i <= chainEnd ; i++)
+                indexed = indexed && segments[i].signature;
+
+            // the lines which are not indexed may contain anything, otherwise
+            // each trigram must occur in one of the segments
+            bool found = true;
+            for (int k = 0 ; indexed && found && k < bits.count() ; k++)
+            {
+                found = false;
+                for (int i = chainStart ; i <= chainEnd && !found ; i++)
+                    found = segments[i].signature->testBit(bits[k]);
+            }
+
+            if ( found )
+            {
+                const int rangeStart = qMax(start, firstLine);
+                const int rangeEnd = qMin(end, lastLine);
+
+                if ( !ranges.isEmpty() && ranges.last().second + 1 >= rangeStart )
+                    ranges.last().second = rangeEnd;
+                else
+                    ranges << qMakePair(rangeStart, rangeEnd);
+            }
+        }
+
+        chainStart = chainEnd + 1;
+    }
+
+    return ranges;
+}
@@ -0,0 +1,141 @@
+/*
+    Copyright 2012 by Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef HISTORYSEARCHINDEX_H
+#define HISTORYSEARCHINDEX_H
+
+// Qt
+#include <QtCore/QBitArray>
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QString>
+
+// Konsole
+#include "konsole_export.h"
+
+namespace Konsole
+{
+
+class Character;
+
+/**
+ * An index of the trigrams in the lines of a history store, which is used
+ * to skip the parts of the history which cannot contain the text being
+ * searched for.
+ *
+ * The lines are indexed in blocks of BLOCK_LINES lines as they are added to
+ * the history.  Each block has a signature with one bit set for every
+ * trigram of its text, ignoring case, so a block can only contain a piece
+ * of text if the bits of all the trigrams of that text are set.  Text which
+ * continues from a wrapped line onto the next one is indexed as one line.
+ *
+ * The memory used by the index is limited with setMemoryLimit().  When the
+ * limit is reached, the blocks of the oldest lines are discarded and those
+ * lines are treated as if they might contain any text.
+ */
+class KONSOLEPRIVATE_EXPORT HistorySearchIndex
+{
+public:
+    HistorySearchIndex();
+
+    /** The number of lines in each block of the index */
+    static const int BLOCK_LINES = 32;
+
+    /**
+     * Sets the number of bytes of memory which the index may use.  The
+     * blocks of the oldest lines are discarded if the index is larger.
+     */
+    void setMemoryLimit(qint64 bytes);
+    /** Returns the limit set with setMemoryLimit() */
+    qint64 memoryLimit() const;
+    /** Returns the number of bytes of memory used by the index. */
+    qint64 memoryUsage() const;
+
+    /** Removes all the lines from the index. */
+    void clear();
+    /**
+     * Removes all the lines from the index and adds @p lineCount lines which
+     * are not indexed and may contain any text, the last of which continues
+     * on the next line if @p lastLineWrapped is true.  Only the lines added
+     * after them are indexed.
+     */
+    void reset(int lineCount , bool lastLineWrapped);
+
+    /**
+     * Adds a line of history to the index.
+     *
+     * @param characters The characters of the line, as stored in the history
+     * @param count The number of characters in the line
+     * @param wrapped Whether the line continues on the next line
+     */
+    void addLine(const Character* characters, int count, bool wrapped);
+    /**
+     * Removes the oldest line from the index, when it is dropped from the
+     * history.
+     */
+    void removeFirstLine();
+    /** Returns the number of lines which have been added and not removed. */
+    int lineCount() const;
+
+    /**
+     * Returns the ranges of lines from @p firstLine to @p lastLine which may
+     * contain @p text, where line 0 is the oldest line in the index.  Lines
+     * after the last line in the index are assumed to follow it and may
+     * contain anything.
+     *
+     * The ranges are ordered and do not overlap.  If @p text is too short
+     * to be looked up in the index, the whole range of lines is returned.
+     */
+    QList< QPair<int,int> > candidateLines(const QString& text, int firstLine, int lastLine) const;
+
+private:
+    struct Block
+    {
+        QBitArray signature;
+        // the first line of the block continues the last line of the
+        // previous one
+        bool continued;
+    };
+
+    // adds the trigram which ends with 'character' to 'block', if there is one
+    void addCharacter(Block* block, ushort character);
+    void enforceLimit();
+
+    QList<Block> _blocks;
+    // the number of the first block in _blocks, counting every block
+    // since the index was cleared
+    qint64 _firstBlock;
+
+    // the number of lines which have been added or removed since the
+    // index was cleared
+    qint64 _addedLines;
+    qint64 _removedLines;
+
+    // the last two characters added, case folded, which form trigrams
+    // with the characters of the next line if the last line is wrapped
+    ushort _recent[2];
+    int _recentCount;
+    bool _lastLineWrapped;
+
+    qint64 _memoryLimit;
+};
+
+}
+
+#endif // HISTORYSEARCHINDEX_H
@@ -28,6 +28,8 @@
 #include <QtGui/QWidget>
 
 // KDE
+#include <KGlobal>
+#include <KLocale>
 #include <KLocalizedString>
 #include <KNumInput>
 
@@ -42,6 +44,7 @@ HistorySizeDialog::HistorySizeDialog( QWidget* parent )
     ,  _fixedHistoryButton(0)
     ,  _unlimitedHistoryButton(0)
     ,  _lineCountBox(0)
+    ,  _searchIndexLabel(0)
 {
     // basic dialog properties
     setPlainCaption( i18n("Adjust Scrollback") );
@@ -96,6 +99,11 @@ HistorySizeDialog::HistorySizeDialog( QWidget* parent )
     dialogLayout->addWidget(_unlimitedHistoryButton);
     dialogLayout->insertSpacing(-1, 10);
 
+    // only shown for sessions whose history is indexed
+    _searchIndexLabel = new QLabel(this);
+    _searchIndexLabel->setVisible(false);
+    dialogLayout->addWidget(_searchIndexLabel);
+
     connect(this,SIGNAL(accepted()),this,SLOT(emitOptionsChanged()));
 }
 
@@ -145,5 +153,15 @@ void HistorySizeDialog::setLineCount(int lines)
     _lineCountBox->setSingleStep( lines / 10 );
 }
 
+void HistorySizeDialog::setSearchIndexUsage(qint64 bytes, qint64 limit)
+{
+    const KLocale* locale = KGlobal::locale();
+    _searchIndexLabel->setText( i18nc("@info:status Memory used by the index of the scrollback",
+                                      "Search index: %1 of %2",
+                                      locale->formatByteSize(bytes),
+                                      locale->formatByteSize(limit)) );
+    _searchIndexLabel->setVisible(true);
+}
+
 
 #include "HistorySizeDialog.moc"
@@ -24,6 +24,7 @@
 #include <KDialog>
 
 class QAbstractButton;
+class QLabel;
 class KIntSpinBox;
 
 namespace Konsole
@@ -76,6 +77,11 @@ public:
     int lineCount() const;
     /** Sets the number of lines for the fixed size history mode. */
     void setLineCount(int lines);
+    /**
+     * Shows the number of bytes of memory used by the index of the session's
+     * history and the limit on it.
+     */
+    void setSearchIndexUsage(qint64 bytes, qint64 limit);
 
 signals:
     /**
@@ -99,6 +105,7 @@ private:
     QAbstractButton* _fixedHistoryButton;
     QAbstractButton* _unlimitedHistoryButton;
     KIntSpinBox* _lineCountBox;
+    QLabel* _searchIndexLabel;
 
     // 1000 lines was the default in the KDE 3 series
     static const int defaultLineCount = 1000;
@@ -44,6 +44,8 @@ IncrementalSearchBar::IncrementalSearchBar(QWidget* parent)
     ,_caseSensitive(0)
     ,_regExpression(0)
     ,_highlightMatches(0)
+    ,_progressLabel(0)
+    ,_matchCountLabel(0)
 {
     QHBoxLayout* layout = new QHBoxLayout(this);
 
@@ -108,6 +110,14 @@ IncrementalSearchBar::IncrementalSearchBar(QWidget* parent)
     layout->addWidget(findPrev);
     layout->addWidget(optionsButton);
 
+    _progressLabel = new QLabel(this);
+    _progressLabel->hide();
+    layout->addWidget(_progressLabel);
+
+    _matchCountLabel = new QLabel(this);
+    _matchCountLabel->hide();
+    layout->addWidget(_matchCountLabel);
+
     // Fill the options menu
     QMenu* optionsMenu = new QMenu(this);
     optionsButton->setMenu(optionsMenu);
@@ -193,6 +203,40 @@ void IncrementalSearchBar::setFoundMatch( bool match )
     }
 }
 
+void IncrementalSearchBar::setSearchProgress( int percent )
+{
+    if ( percent < 0 )
+    {
+        _progressLabel->hide();
+    }
+    else
+    {
+        _progressLabel->setText( i18nc("@info:status Progress of a search through the output",
+                                       "Searching... %1%", percent) );
+        _progressLabel->show();
+    }
+}
+
+void IncrementalSearchBar::setMatchCount( int current , int count , bool complete )
+{
+    if ( count < 0 )
+    {
+        _matchCountLabel->hide();
+        return;
+    }
+
+    if ( !complete )
+        _matchCountLabel->setText( i18nc("@info:status Number of matches found so far",
+                                         "Counting matches... %1", count) );
+    else if ( current > 0 )
+        _matchCountLabel->setText( i18nc("@info:status The selected match and the number of matches",
+                                         "%1 of %2", current, count) );
+    else
+        _matchCountLabel->setText( i18ncp("@info:status Number of matches",
+                                          "%1 match", "%1 matches", count) );
+    _matchCountLabel->show();
+}
+
 void IncrementalSearchBar::clearLineEdit()
 {
     _searchEdit->setStyleSheet( QString() );
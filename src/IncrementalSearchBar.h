@@ -93,6 +93,25 @@ public:
      */
     void setFoundMatch( bool match );
 
+    /**
+     * Shows how far a search through the output has got.
+     *
+     * @param percent The percentage of the output searched so far, or -1
+     * to hide the indicator once the search has finished.
+     */
+    void setSearchProgress( int percent );
+
+    /**
+     * Shows the number of matches for the search text in the output.
+     *
+     * @param current The number of the selected match, starting from 1, or 0
+     * if no match is selected
+     * @param count The number of matches, or -1 to hide the indicator
+     * @param complete False if the output is still being searched and
+     * more matches may be found
+     */
+    void setMatchCount( int current , int count , bool complete = true );
+
     /** Returns the current search text */
     QString searchText();
 
@@ -137,6 +156,8 @@ private:
     QAction* _caseSensitive;
     QAction* _regExpression;
     QAction* _highlightMatches;
+    QLabel* _progressLabel;
+    QLabel* _matchCountLabel;
 
     QTimer* _searchTimer;
 };
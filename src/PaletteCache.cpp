@@ -0,0 +1,79 @@
+/*
+    Copyright 2012 by Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "PaletteCache.h"
+
+using namespace Konsole;
+
+// the maximum number of RGB colors which are kept, applications which
+// draw gradients can use many more colors than are on screen at once
+static const int MAX_RGB_COLORS = 1024;
+
+PaletteCache::PaletteCache()
+    : _palette(TABLE_COLORS + 256)
+{
+    setColorTable(base_color_table);
+}
+
+void PaletteCache::setColorTable(const ColorEntry* table)
+{
+    for (int i = 0; i < TABLE_COLORS; i++)
+        _palette[i] = Entry(table[i].color);
+
+    for (int i = 0; i < 256; i++)
+        _palette[TABLE_COLORS + i] = Entry(color256(i, table));
+}
+
+const PaletteCache::Entry& PaletteCache::entry(const CharacterColor& color)
+{
+    const int index = color.paletteIndex();
+    if (index >= 0)
+        return _palette[index];
+
+    if (!color.isValid())
+        return _undefined;
+
+    const QColor rgbColor = color.color(0);
+    const QRgb key = rgbColor.rgb();
+
+    QHash<QRgb, Entry>::const_iterator iter = _rgbColors.constFind(key);
+    if (iter != _rgbColors.constEnd())
+        return iter.value();
+
+    if (_rgbColors.count() >= MAX_RGB_COLORS)
+        _rgbColors.clear();
+
+    return *_rgbColors.insert(key, Entry(rgbColor));
+}
+
+QColor PaletteCache::color(const CharacterColor& color)
+{
+    return entry(color).color;
+}
+
+QPen PaletteCache::pen(const CharacterColor& color)
+{
+    return entry(color).pen;
+}
+
+QBrush PaletteCache::brush(const CharacterColor& color)
+{
+    return entry(color).brush;
+}
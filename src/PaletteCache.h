@@ -0,0 +1,90 @@
+/*
+    Copyright 2012 by Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef PALETTECACHE_H
+#define PALETTECACHE_H
+
+// Qt
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+#include <QtGui/QBrush>
+#include <QtGui/QColor>
+#include <QtGui/QPen>
+
+// Konsole
+#include "CharacterColor.h"
+#include "konsole_export.h"
+
+namespace Konsole
+{
+
+/**
+ * Resolves the colors of characters into the colors, pens and brushes
+ * used to draw them.
+ *
+ * The colors of the color table, in both normal and intense variants,
+ * and of the 256 color palette are resolved once when the color table
+ * is set.  Colors specified as RGB values are resolved when they are
+ * first used and kept in a small cache.  The pens and brushes are
+ * created at the same time, so that drawing text in any color only
+ * copies existing pens and brushes rather than allocating new ones.
+ */
+class KONSOLEPRIVATE_EXPORT PaletteCache
+{
+public:
+    PaletteCache();
+
+    /**
+     * Resolves all the colors of the palette using @p table, which
+     * contains TABLE_COLORS entries.  This must be called again whenever
+     * any entry of the table changes.
+     */
+    void setColorTable(const ColorEntry* table);
+
+    /** Returns the color used to draw @p color. */
+    QColor color(const CharacterColor& color);
+    /** Returns a pen which draws in @p color. */
+    QPen pen(const CharacterColor& color);
+    /** Returns a solid brush which fills with @p color. */
+    QBrush brush(const CharacterColor& color);
+
+private:
+    struct Entry
+    {
+        Entry() {}
+        explicit Entry(const QColor& entryColor)
+            : color(entryColor), pen(entryColor), brush(entryColor) {}
+
+        QColor color;
+        QPen pen;
+        QBrush brush;
+    };
+
+    const Entry& entry(const CharacterColor& color);
+
+    // the color table in both intensities followed by the 256 color palette
+    QVector<Entry> _palette;
+    // colors specified as RGB values
+    QHash<QRgb, Entry> _rgbColors;
+    Entry _undefined;
+};
+
+}
+
+#endif // PALETTECACHE_H
@@ -40,6 +40,7 @@
 #include <KStandardDirs>
 
 // Konsole
+#include "Filter.h"
 #include "ShellCommand.h"
 
 using namespace Konsole;
@@ -61,6 +62,17 @@ static const char CURSOR_GROUP[]      = "Cursor Options";
 static const char INTERACTION_GROUP[] = "Interaction Options";
 static const char ENCODING_GROUP[]    = "Encoding Options";
 
+// hotspot filters are stored one per group, numbered from 1, with their
+// number in the HotSpotFilters entry of the interaction group.  Their
+// regular expressions would not survive being stored as the items of a
+// list, which KConfig separates with commas.
+static const char HOTSPOT_FILTER_GROUP[] = "HotSpotFilter %1";
+
+static QString hotSpotFilterGroup(int number)
+{
+    return QString(HOTSPOT_FILTER_GROUP).arg(number);
+}
+
 const Profile::PropertyInfo Profile::DefaultPropertyNames[] =
 {
     // General
@@ -98,6 +110,8 @@ const Profile::PropertyInfo Profile::DefaultPropertyNames[] =
     // Scrolling
     , { HistoryMode , "HistoryMode" , SCROLLING_GROUP , QVariant::Int }
     , { HistorySize , "HistorySize" , SCROLLING_GROUP , QVariant::Int } 
+    , { HistoryJournalDirectory , "HistoryJournalDirectory" , SCROLLING_GROUP , QVariant::String }
+    , { HistorySearchIndexSize , "HistorySearchIndexSize" , SCROLLING_GROUP , QVariant::Int }
     , { ScrollBarPosition , "ScrollBarPosition" , SCROLLING_GROUP , QVariant::Int }
 
        // Terminal Features
@@ -116,6 +130,7 @@ const Profile::PropertyInfo Profile::DefaultPropertyNames[] =
     , { WordCharacters , "WordCharacters" , INTERACTION_GROUP , QVariant::String }
     , { TripleClickMode , "TripleClickMode" , INTERACTION_GROUP , QVariant::Int }
     , { UnderlineLinksEnabled , "UnderlineLinksEnabled" , INTERACTION_GROUP , QVariant::Bool }
+    , { HotSpotFilters , "HotSpotFilters" , 0 , QVariant::StringList }
 
     // Encoding
     , { DefaultEncoding , "DefaultEncoding" , ENCODING_GROUP , QVariant::String }
@@ -174,12 +189,15 @@ FallbackProfile::FallbackProfile()
 
     setProperty(HistoryMode,FixedSizeHistory);
     setProperty(HistorySize,1000);
+    setProperty(HistoryJournalDirectory,QString());
+    setProperty(HistorySearchIndexSize,0);
     setProperty(ScrollBarPosition,ScrollBarRight);
 
     setProperty(FlowControlEnabled,true);
     setProperty(AllowProgramsToResizeWindow,true);
     setProperty(BlinkingTextEnabled,true);
     setProperty(UnderlineLinksEnabled,true);
+    setProperty(HotSpotFilters,QStringList());
     setProperty(TripleClickMode,SelectWholeLine);
 
     setProperty(BlinkingCursorEnabled,false);
@@ -354,9 +372,43 @@ bool KDE4ProfileWriter::writeProfile(const QString& path , const Profile::Ptr pr
 
     // Write remaining properties
     writeProperties(config,profile,Profile::DefaultPropertyNames);
+    writeHotSpotFilters(config,profile);
 
     return true;
 }
+void KDE4ProfileWriter::writeHotSpotFilters(KConfig& config, const Profile::Ptr profile)
+{
+    KConfigGroup interaction = config.group(INTERACTION_GROUP);
+
+    // remove the filters written before, there may have been more of them
+    const int oldCount = interaction.readEntry("HotSpotFilters", 0);
+    for (int i = 1 ; i <= oldCount ; i++)
+        config.deleteGroup(hotSpotFilterGroup(i));
+
+    if ( !profile->isPropertySet(Profile::HotSpotFilters) )
+    {
+        interaction.deleteEntry("HotSpotFilters");
+        return;
+    }
+
+    int count = 0;
+    foreach( const QString& definition , profile->property<QStringList>(Profile::HotSpotFilters) )
+    {
+        const QStringList fields = UserFilter::definitionFields(definition);
+        if ( fields.isEmpty() )
+        {
+            kWarning() << "Not saving incomplete hotspot filter definition" << definition;
+            continue;
+        }
+
+        KConfigGroup group = config.group(hotSpotFilterGroup(++count));
+        group.writeEntry("Name", fields[0]);
+        group.writeEntry("Action", fields[1]);
+        group.writeEntry("RegExp", fields[2]);
+        group.writeEntry("Template", fields[3]);
+    }
+    interaction.writeEntry("HotSpotFilters", count);
+}
 
 QStringList KDE4ProfileReader::findProfiles()
 {
@@ -412,9 +464,30 @@ bool KDE4ProfileReader::readProfile(const QString& path , Profile::Ptr profile ,
 
     // Read remaining properties
     readProperties(config,profile,Profile::DefaultPropertyNames);
+    readHotSpotFilters(config,profile);
 
     return true;
 }
+void KDE4ProfileReader::readHotSpotFilters(const KConfig& config, Profile::Ptr profile)
+{
+    const KConfigGroup interaction = config.group(INTERACTION_GROUP);
+    if ( !interaction.hasKey("HotSpotFilters") )
+        return;
+
+    QStringList definitions;
+    const int count = interaction.readEntry("HotSpotFilters", 0);
+    for (int i = 1 ; i <= count ; i++)
+    {
+        const KConfigGroup group = config.group(hotSpotFilterGroup(i));
+        definitions << UserFilter::joinDefinitionFields(QStringList()
+                                                        << group.readEntry("Name")
+                                                        << group.readEntry("Action")
+                                                        << group.readEntry("RegExp")
+                                                        << group.readEntry("Template"));
+    }
+
+    profile->setProperty(Profile::HotSpotFilters, definitions);
+}
 QStringList KDE3ProfileReader::findProfiles()
 {
     return KGlobal::dirs()->findAllResources("data", "konsole/*.desktop", 
@@ -134,9 +134,19 @@ public:
         HistoryMode,
         /** (int) Specifies the number of lines of output to remember in terminal sessions
          * using this profile.  Once the limit is reached, the oldest lines are lost.
-         * Only applicable if the HistoryMode property is FixedSizeHistory
+         * Only applicable if the HistoryMode property is FixedSizeHistory or RingBufferHistory
          */
         HistorySize,
+        /** (QString) The directory in which the history journals of terminal sessions
+         * using this profile are kept.  If empty, a directory in the user's KDE data
+         * directory is used.  Only applicable if the HistoryMode property is PersistentHistory
+         */
+        HistoryJournalDirectory,
+        /** (int) Specifies the number of megabytes of memory used to index the history
+         * of terminal sessions using this profile, which speeds up searches of large
+         * histories.  If 0, the history is not indexed.
+         */
+        HistorySearchIndexSize,
         /** (ScrollBarPositionEnum) Specifies the position of the scroll bar in
          * terminal displays using this profile.
          */
@@ -183,6 +193,11 @@ public:
          * hovered by the mouse pointer.
          */
         UnderlineLinksEnabled,
+        /** (QStringList) Definitions of filters which turn text matching a regular
+         * expression into hotspots, in the form described by UserFilter.  Each
+         * definition is saved in a "HotSpotFilter N" group of its own.
+         */
+        HotSpotFilters,
         /** (String) Default text codec */
         DefaultEncoding,
         /** (bool) Whether fonts should be aliased or not */
@@ -253,7 +268,17 @@ public:
          * Typically this means that lines are recorded to
          * a file as they are scrolled off-screen.
          */
-        UnlimitedHistory = 2
+        UnlimitedHistory = 2,
+        /** All output is remembered in a journal on disk which is kept when the
+         * session is saved, so that the output is still available after the
+         * session is restored or Konsole crashes.
+         */
+        PersistentHistory = 3,
+        /** Like FixedSizeHistory, but the lines are kept in a ring buffer which
+         * is allocated up front, so the memory used by the history does not
+         * grow after the session starts.
+         */
+        RingBufferHistory = 4
     };
 
     /**
@@ -575,7 +600,7 @@ public:
     virtual bool readProfile(const QString& path , Profile::Ptr profile, QString& parentProfile);
 };
 /** Reads a KDE 4 .profile file. */
-class KDE4ProfileReader : public ProfileReader
+class KONSOLEPRIVATE_EXPORT KDE4ProfileReader : public ProfileReader
 {
 public:
     virtual QStringList findProfiles();
@@ -583,6 +608,7 @@ public:
 private:
     void readProperties(const KConfig& config, Profile::Ptr profile, 
                         const Profile::PropertyInfo* properties);
+    void readHotSpotFilters(const KConfig& config, Profile::Ptr profile);
 };
 /** Interface for all classes which can write profile settings to a file. */
 class ProfileWriter
@@ -602,7 +628,7 @@ public:
     virtual bool writeProfile(const QString& path , const Profile::Ptr profile) = 0;
 };
 /** Writes a KDE 4 .profile file. */
-class KDE4ProfileWriter : public ProfileWriter
+class KONSOLEPRIVATE_EXPORT KDE4ProfileWriter : public ProfileWriter
 {
 public:
     virtual QString getPath(const Profile::Ptr profile);
@@ -611,6 +637,7 @@ public:
 private:
     void writeProperties(KConfig& config, const Profile::Ptr profile, 
                          const Profile::PropertyInfo* properties);
+    void writeHotSpotFilters(KConfig& config, const Profile::Ptr profile);
 };
 
 /**
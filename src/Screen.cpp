@@ -42,6 +42,7 @@
 #include "konsole_wcwidth.h"
 #include "TerminalCharacterDecoder.h"
 #include "History.h"
+#include "HistorySearchIndex.h"
 
 using namespace Konsole;
 
@@ -74,7 +75,11 @@ Screen::Screen(int l, int c):
     screenLines(new ImageLine[lines+1] ),
     _scrolledLines(0),
     _droppedLines(0),
+    _totalDroppedLines(0),
+    _historyGeneration(0),
+    _imageRevision(0),
     history(new HistoryScrollNone()),
+    _searchIndex(0),
     cuX(0), cuY(0),
     currentRendition(0),
     _topMargin(0), _bottomMargin(0),
@@ -96,6 +101,7 @@ Screen::~Screen()
 {
     delete[] screenLines;
     delete history;
+    delete _searchIndex;
 }
 
 void Screen::cursorUp(int n)
@@ -191,6 +197,7 @@ void Screen::eraseChars(int n)
 
 void Screen::deleteChars(int n)
 {
+    _imageRevision++;
     Q_ASSERT( n >= 0 );
 
     // always delete at least one char
@@ -212,6 +219,7 @@ void Screen::deleteChars(int n)
 
 void Screen::insertChars(int n)
 {
+    _imageRevision++;
     if (n == 0) n = 1; // Default
 
     if ( screenLines[cuY].size() < cuX )
@@ -238,6 +246,9 @@ void Screen::insertLines(int n)
 void Screen::setMode(int m)
 {
     currentModes[m] = true;
+    // the colors of the whole image are reversed in screen mode
+    if ( m == MODE_Screen )
+        _imageRevision++;
     switch(m)
     {
         case MODE_Origin : cuX = 0; cuY = _topMargin; break; //FIXME: home
@@ -247,6 +258,8 @@ void Screen::setMode(int m)
 void Screen::resetMode(int m)
 {
     currentModes[m] = false;
+    if ( m == MODE_Screen )
+        _imageRevision++;
     switch(m)
     {
         case MODE_Origin : cuX = 0; cuY = 0; break; //FIXME: home
@@ -479,10 +492,8 @@ void Screen::getImage( Character* dest, int size, int startLine, int endLine ) c
             reverseRendition(dest[i]); // for reverse display
     }
 
-    // mark the character at the current cursor position
-    int cursorIndex = loc(cuX, cuY + linesInHistoryBuffer);
-    if(getMode(MODE_Cursor) && cursorIndex < columns*mergedLines)
-        dest[cursorIndex].rendition |= RE_CURSOR;
+    // the cursor is not marked in the image, views draw it separately at
+    // the position given by ScreenWindow::cursorWindowPosition()
 }
 
 QVector<LineProperty> Screen::getLineProperties( int startLine , int endLine ) const
@@ -554,6 +565,7 @@ void Screen::backspace()
 
     if (BS_CLEARS) 
     {
+        _imageRevision++;
         screenLines[cuY][cuX].character = ' ';
         screenLines[cuY][cuX].rendition = screenLines[cuY][cuX].rendition & ~RE_EXTENDED_CHAR;
     }
@@ -624,6 +636,7 @@ void Screen::checkSelection(int from, int to)
 
 void Screen::displayCharacter(unsigned short c)
 {
+    _imageRevision++;
     // Note that VT100 does wrapping BEFORE putting the character.
     // This has impact on the assumption of valid cursor positions.
     // We indicate the fact that a newline has to be triggered by
@@ -756,6 +769,18 @@ void Screen::resetDroppedLines()
 {
     _droppedLines = 0;
 }
+qint64 Screen::totalDroppedLines() const
+{
+    return _totalDroppedLines;
+}
+int Screen::historyGeneration() const
+{
+    return _historyGeneration;
+}
+int Screen::imageRevision() const
+{
+    return _imageRevision;
+}
 void Screen::resetScrolledLines()
 {
     _scrolledLines = 0;
@@ -848,6 +873,8 @@ int Screen::getCursorY() const
 
 void Screen::clearImage(int loca, int loce, char c)
 { 
+    _imageRevision++;
+
     int scr_TL=loc(0,history->getLines());
     //FIXME: check positions
 
@@ -893,6 +920,7 @@ void Screen::clearImage(int loca, int loce, char c)
 
 void Screen::moveImage(int dest, int sourceBegin, int sourceEnd)
 {
+    _imageRevision++;
     Q_ASSERT( sourceBegin <= sourceEnd );
 
     int lines=(sourceEnd-sourceBegin)/columns;
@@ -1052,6 +1080,7 @@ void Screen::setBackColor(int space, int color)
 
 void Screen::clearSelection() 
 {
+    _imageRevision++;
     selBottomRight = -1;
     selTopLeft = -1;
     selBegin = -1;
@@ -1085,6 +1114,7 @@ void Screen::getSelectionEnd(int& column , int& line) const
 }
 void Screen::setSelectionStart(const int x, const int y, const bool mode)
 {
+    _imageRevision++;
     selBegin = loc(x,y); 
     /* FIXME, HACK to correct for x too far to the right... */
     if (x == columns) selBegin--;
@@ -1096,6 +1126,7 @@ void Screen::setSelectionStart(const int x, const int y, const bool mode)
 
 void Screen::setSelectionEnd( const int x, const int y)
 {
+    _imageRevision++;
     if (selBegin == -1) 
         return;
 
@@ -1311,35 +1342,69 @@ void Screen::writeLinesToStream(TerminalCharacterDecoder* decoder, int fromLine,
     writeToStream(decoder,loc(0,fromLine),loc(columns-1,toLine));
 }
 
+void Screen::writeLineToStream(TerminalCharacterDecoder* decoder, int line) const
+{
+    copyLineToStream(line, 0, columns, decoder, false, false);
+}
+
 void Screen::addHistLine()
 {
+    _imageRevision++;
     // add line to history buffer
     // we have to take care about scrolling, too...
 
     if (hasScroll())
     {
         int oldHistLines = history->getLines();
+        const int oldClearCount = history->clearCount();
 
         history->addCellsVector(screenLines[0]);
         history->addLine( lineProperties[0] & LINE_WRAPPED );
 
         int newHistLines = history->getLines();
 
+        // the history has discarded its lines, so nothing which refers
+        // to them by number is valid any more
+        if ( history->clearCount() != oldClearCount )
+        {
+            clearSelection();
+            _droppedLines += oldHistLines;
+            _totalDroppedLines = 0;
+            _historyGeneration++;
+            if ( _searchIndex )
+            {
+                _searchIndex->reset(0, false);
+                _searchIndex->addLine( screenLines[0].constData() , screenLines[0].count() ,
+                                       lineProperties[0] & LINE_WRAPPED );
+            }
+            return;
+        }
+
+        // one line has been added, but a history which is full drops its
+        // oldest lines, possibly several of them to make room for a long line
+        const int dropped = qBound(0, oldHistLines + 1 - newHistLines, oldHistLines);
+
+        if ( _searchIndex )
+        {
+            for ( int i = 0 ; i < dropped ; i++ )
+                _searchIndex->removeFirstLine();
+            if ( newHistLines > oldHistLines - dropped )
+                _searchIndex->addLine( screenLines[0].constData() , screenLines[0].count() ,
+                                       lineProperties[0] & LINE_WRAPPED );
+        }
+
         bool beginIsTL = (selBegin == selTopLeft);
 
         // If the history is full, increment the count
         // of dropped lines
-        if ( newHistLines == oldHistLines )
-            _droppedLines++;
+        _droppedLines += dropped;
+        _totalDroppedLines += dropped;
 
         // Adjust selection for the new point of reference
-        if (newHistLines > oldHistLines)
+        if (selBegin != -1)
         {
-            if (selBegin != -1)
-            {
-                selTopLeft += columns;
-                selBottomRight += columns;
-            }
+            selTopLeft += (newHistLines - oldHistLines) * columns;
+            selBottomRight += (newHistLines - oldHistLines) * columns;
         }
 
         if (selBegin != -1)
@@ -1377,16 +1442,24 @@ int Screen::getHistLines() const
 
 void Screen::setScroll(const HistoryType& t , bool copyPreviousScroll)
 {
+    _imageRevision++;
     clearSelection();
 
+    HistoryScroll* oldScroll = history;
     if ( copyPreviousScroll )
         history = t.scroll(history);
     else
     {
-        HistoryScroll* oldScroll = history;
         history = t.scroll(0);
         delete oldScroll;
     }
+
+    _totalDroppedLines = 0;
+    _historyGeneration++;
+
+    // the index still describes the history if it has been kept as it is
+    if ( _searchIndex && history != oldScroll )
+        resetSearchIndex();
 }
 
 bool Screen::hasScroll() const
@@ -1399,8 +1472,71 @@ const HistoryType& Screen::getScroll() const
     return history->getType();
 }
 
+qint64 Screen::historyMemoryUsage() const
+{
+    return history->memoryUsage();
+}
+
+qint64 Screen::releaseHistoryMemory(qint64 bytes)
+{
+    return history->releaseMemory(bytes);
+}
+
+void Screen::setHistorySearchIndexLimit(qint64 bytes)
+{
+    if ( bytes <= 0 )
+    {
+        delete _searchIndex;
+        _searchIndex = 0;
+        return;
+    }
+
+    if ( _searchIndex && _searchIndex->memoryLimit() == bytes )
+        return;
+
+    // a larger limit applies to the lines added from now on, a smaller
+    // one discards the blocks of the oldest lines straight away
+    if ( !_searchIndex )
+    {
+        _searchIndex = new HistorySearchIndex();
+        resetSearchIndex();
+    }
+    _searchIndex->setMemoryLimit(bytes);
+}
+
+qint64 Screen::historySearchIndexLimit() const
+{
+    return _searchIndex ? _searchIndex->memoryLimit() : 0;
+}
+
+qint64 Screen::historySearchIndexMemoryUsage() const
+{
+    return _searchIndex ? _searchIndex->memoryUsage() : 0;
+}
+
+void Screen::resetSearchIndex()
+{
+    // only the lines added to the history from now on are indexed, the
+    // lines which are in it already are searched as if they might contain
+    // anything.  Indexing them would decode the whole history at once.
+    const int lines = history->getLines();
+    _searchIndex->reset(lines, lines > 0 && history->isWrappedLine(lines - 1));
+}
+
+QList< QPair<int,int> > Screen::searchCandidates(const QString& text, int fromLine, int toLine) const
+{
+    if ( _searchIndex )
+        return _searchIndex->candidateLines(text, fromLine, toLine);
+
+    QList< QPair<int,int> > ranges;
+    if ( fromLine <= toLine )
+        ranges << qMakePair(fromLine, toLine);
+    return ranges;
+}
+
 void Screen::setLineProperty(LineProperty property , bool enable)
 {
+    _imageRevision++;
     if ( enable )
         lineProperties[cuY] = (LineProperty)(lineProperties[cuY] | property);
     else
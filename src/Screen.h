@@ -25,6 +25,8 @@
 
 // Qt
 #include <QtCore/QRect>
+#include <QtCore/QList>
+#include <QtCore/QPair>
 #include <QtCore/QSet>
 #include <QtCore/QVector>
 #include <QtCore/QBitArray>
@@ -33,6 +35,7 @@
 
 // Konsole
 #include "Character.h"
+#include "konsole_export.h"
 
 #define MODE_Origin    0
 #define MODE_Wrap      1
@@ -49,6 +52,7 @@ class TerminalCharacterDecoder;
 class TerminalDisplay;
 class HistoryType;
 class HistoryScroll;
+class HistorySearchIndex;
 
 /**
     \brief An image of characters with associated attributes.
@@ -73,7 +77,7 @@ class HistoryScroll;
     using selectedText().  When getImage() is used to retrieve the visible image,
     characters which are part of the selection have their colors inverted.
 */
-class Screen
+class KONSOLEPRIVATE_EXPORT Screen
 {
 public:
     /** Construct a new screen image of size @p lines by @p columns. */
@@ -402,6 +406,33 @@ public:
      * in a history buffer.
      */
     bool hasScroll() const;
+    /**
+     * Returns the number of bytes of memory used to keep lines in the history.
+     * See HistoryScroll::memoryUsage()
+     */
+    qint64 historyMemoryUsage() const;
+    /**
+     * Moves the oldest lines in the history out of memory until at least
+     * @p bytes have been released.  See HistoryScroll::releaseMemory()
+     */
+    qint64 releaseHistoryMemory(qint64 bytes);
+    /**
+     * Sets the number of bytes of memory which the index of the lines in the
+     * history may use.  A limit of 0 disables the index.  Only the lines added
+     * to the history after the index is enabled are indexed.  See HistorySearchIndex
+     */
+    void setHistorySearchIndexLimit(qint64 bytes);
+    /** Returns the limit set with setHistorySearchIndexLimit() */
+    qint64 historySearchIndexLimit() const;
+    /** Returns the number of bytes of memory used by the index of the history. */
+    qint64 historySearchIndexMemoryUsage() const;
+    /**
+     * Returns the ranges of lines from @p fromLine to @p toLine which may contain
+     * @p text, where line 0 is the first line in the history.  The lines on the
+     * screen are always included.  Without an index of the history, the whole
+     * range is returned.
+     */
+    QList< QPair<int,int> > searchCandidates(const QString& text, int fromLine, int toLine) const;
 
     /**
      * Sets the start of the selection.
@@ -457,6 +488,16 @@ public:
      */
     void writeLinesToStream(TerminalCharacterDecoder* decoder, int fromLine, int toLine) const;
 
+    /**
+     * Copies a single line of the output to a stream, as it is shown in the
+     * screen's columns.  Unlike writeLinesToStream(), no new-line character
+     * is added at the end of the line.
+     *
+     * @param decoder A decoder which converts terminal characters into text
+     * @param line The line to retrieve, where line 0 is the first line in the history
+     */
+    void writeLineToStream(TerminalCharacterDecoder* decoder, int line) const;
+
     /**
      * Copies the selected characters, set using @see setSelBeginXY and @see setSelExtentXY
      * into a stream.
@@ -541,6 +582,26 @@ public:
      */
     void resetDroppedLines();
 
+    /**
+     * Returns the number of lines which have been dropped from the history
+     * since it was last replaced with setScroll().  Unlike droppedLines(),
+     * this is never reset.
+     */
+    qint64 totalDroppedLines() const;
+    /**
+     * Returns a number which changes whenever the history is replaced with
+     * setScroll() or discards all of its lines, after which the lines in it
+     * may be different.
+     */
+    int historyGeneration() const;
+    /**
+     * Returns a number which changes whenever the characters, line
+     * properties or selection of the screen or its history change, or the
+     * screen is reversed.  Moving the cursor does not change it, so users
+     * of the image can tell when only the cursor has moved.
+     */
+    int imageRevision() const;
+
     /**
       * Fills the buffer @p dest with @p count instances of the default (ie. blank)
       * Character style.
@@ -616,6 +677,8 @@ private:
     TerminalDisplay* _currentTerminalDisplay;
 
     void addHistLine();
+    // starts indexing the lines added to the history from now on
+    void resetSearchIndex();
 
     void initTabStops();
 
@@ -646,11 +709,15 @@ private:
     QRect _lastScrolledRegion;
 
     int _droppedLines;
+    qint64 _totalDroppedLines;
+    int _historyGeneration;
+    int _imageRevision;
 
     QVarLengthArray<LineProperty,64> lineProperties;    
 
     // history buffer ---------------
     HistoryScroll* history;
+    HistorySearchIndex* _searchIndex;  // 0 unless enabled
 
     // cursor location
     int cuX;
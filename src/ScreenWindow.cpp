@@ -37,6 +37,7 @@ ScreenWindow::ScreenWindow(QObject* parent)
     , _currentLine(0)
     , _trackOutput(true)
     , _scrollCount(0)
+    , _imageRevision(-1)
 {
 }
 ScreenWindow::~ScreenWindow()
@@ -204,6 +205,18 @@ QPoint ScreenWindow::cursorPosition() const
     return position; 
 }
 
+QPoint ScreenWindow::cursorWindowPosition() const
+{
+    if ( !_screen->getMode(MODE_Cursor) )
+        return QPoint(-1,-1);
+
+    const int line = _screen->getHistLines() + _screen->getCursorY() - currentLine();
+    if ( line < 0 || line >= windowLines() )
+        return QPoint(-1,-1);
+
+    return QPoint( _screen->getCursorX() , line );
+}
+
 int ScreenWindow::currentLine() const
 {
     return qBound(0,_currentLine,lineCount()-windowLines());
@@ -275,6 +288,17 @@ QRect ScreenWindow::scrollRegion() const
 
 void ScreenWindow::notifyOutputChanged()
 {
+    // if only the cursor has moved, the image of the window is the same
+    // and does not need to be read and compared again
+    if ( !_bufferNeedsUpdate && _scrollCount == 0 &&
+         _screen->imageRevision() == _imageRevision &&
+         _windowBufferSize == windowLines() * windowColumns() )
+    {
+        emit cursorMoved();
+        return;
+    }
+    _imageRevision = _screen->imageRevision();
+
     // move window to the bottom of the screen and update scroll count
     // if this window is currently tracking the bottom of the screen
     if ( _trackOutput )
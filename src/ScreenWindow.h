@@ -27,6 +27,7 @@
 
 // Konsole
 #include "Character.h"
+#include "konsole_export.h"
 
 namespace Konsole
 {
@@ -50,7 +51,7 @@ class Screen;
  * be called.  This in turn will update the window's position and emit the outputChanged() signal
  * if necessary.
  */
-class ScreenWindow : public QObject
+class KONSOLEPRIVATE_EXPORT ScreenWindow : public QObject
 {
 Q_OBJECT
 
@@ -174,6 +175,16 @@ public:
      */
     QPoint cursorPosition() const;
 
+    /**
+     * Returns the position of the cursor relative to the top-left corner
+     * of the window, or (-1,-1) if the cursor is hidden or the window is
+     * scrolled so that the cursor is not inside it.
+     *
+     * The cursor is not marked in the image returned by getImage(), so that
+     * moving it does not change the image.
+     */
+    QPoint cursorWindowPosition() const;
+
     /**
      * Convenience method. Returns true if the window is currently at the bottom
      * of the screen.
@@ -231,7 +242,8 @@ public slots:
     /**
      * Notifies the window that the contents of the associated terminal screen have changed.
      * This moves the window to the bottom of the screen if trackOutput() is true and causes
-     * the outputChanged() signal to be emitted.
+     * the outputChanged() signal to be emitted, or the cursorMoved() signal if only the
+     * cursor has moved since the last notification.
      */
     void notifyOutputChanged();
 
@@ -241,6 +253,12 @@ signals:
      */
     void outputChanged();
 
+    /**
+     * Emitted instead of outputChanged() when only the position of the cursor
+     * has changed.  The image returned by getImage() is the same as before.
+     */
+    void cursorMoved();
+
     /**
      * Emitted when the screen window is scrolled to a different position.
      *
@@ -265,6 +283,7 @@ private:
     bool _trackOutput; // see setTrackOutput() , trackOutput() 
     int  _scrollCount; // count of lines which the window has been scrolled by since
                        // the last call to resetScrollCount()
+    int  _imageRevision; // the revision of the screen's image at the last outputChanged()
 };
 
 }
@@ -0,0 +1,362 @@
+/*
+    Copyright 2012 by Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "SearchMatchIndex.h"
+
+// Qt
+#include <QtCore/QTextStream>
+
+// Konsole
+#include "konsole_wcwidth.h"
+#include "Screen.h"
+#include "ScreenWindow.h"
+#include "TerminalCharacterDecoder.h"
+
+using namespace Konsole;
+
+SearchMatchIndex::SearchMatchIndex()
+    : _matchesEmpty(false)
+    , _screen(0)
+    , _historyGeneration(0)
+    , _droppedLines(0)
+    , _firstMatch(0)
+    , _indexedEnd(0)
+    , _indexedEndComplete(true)
+    , _tailStart(0)
+    , _tailEnd(0)
+    , _historyLines(0)
+{
+}
+
+void SearchMatchIndex::setRegExp(const QRegExp& regExp)
+{
+    _regExp = regExp;
+
+    // searching for an expression which matches the empty string
+    // would not get anywhere
+    static const QString emptyString("");
+    _matchesEmpty = _regExp.exactMatch(emptyString);
+
+    clear();
+}
+
+QRegExp SearchMatchIndex::regExp() const
+{
+    return _regExp;
+}
+
+void SearchMatchIndex::clear()
+{
+    _screen = 0;
+    _matches.clear();
+    _firstMatch = 0;
+    _indexedEnd = 0;
+    _indexedEndComplete = true;
+    _tailMatches.clear();
+    _tailStart = 0;
+    _tailEnd = 0;
+    _historyLines = 0;
+}
+
+bool SearchMatchIndex::isWrapped(const Screen* screen, qint64 line) const
+{
+    const int screenLine = line - _droppedLines;
+    return screen->getLineProperties(screenLine, screenLine).value(0) & LINE_WRAPPED;
+}
+
+bool SearchMatchIndex::update(const Screen* screen, int maxLines)
+{
+    Q_ASSERT( screen );
+
+    if ( screen != _screen || screen->historyGeneration() != _historyGeneration )
+    {
+        clear();
+        _screen = screen;
+        _historyGeneration = screen->historyGeneration();
+        _indexedEnd = screen->totalDroppedLines();
+    }
+
+    _droppedLines = screen->totalDroppedLines();
+
+    if ( _regExp.isEmpty() || _matchesEmpty )
+        return true;
+
+    // forget the matches in lines which have been dropped from the history
+    while ( _firstMatch < _matches.count() && _matches[_firstMatch].startLine < _droppedLines )
+        _firstMatch++;
+    if ( _firstMatch > 0 && _firstMatch * 2 >= _matches.count() )
+    {
+        _matches.remove(0, _firstMatch);
+        _firstMatch = 0;
+    }
+    if ( _indexedEnd < _droppedLines )
+    {
+        _indexedEnd = _droppedLines;
+        _indexedEndComplete = true;
+    }
+
+    // the lines on the screen may still change, and so may the lines in
+    // the history which are wrapped onto them
+    const qint64 historyEnd = _droppedLines + screen->getHistLines();
+    qint64 tailStart = historyEnd;
+    while ( tailStart > _indexedEnd && historyEnd - tailStart < MAX_WRAPPED_LINES &&
+            isWrapped(screen, tailStart - 1) )
+        tailStart--;
+
+    if ( _indexedEnd < tailStart && maxLines > 0 )
+    {
+        qint64 start = _indexedEnd;
+
+        // the lines wrapped onto the line where the previous update stopped
+        // are searched again, together with the rest of the line
+        if ( !_indexedEndComplete )
+        {
+            for (int i = 0 ; i < MAX_WRAPPED_LINES && start > _droppedLines && isWrapped(screen, start - 1) ; i++)
+                start--;
+            while ( _matches.count() > _firstMatch && _matches.last().startLine >= start )
+                _matches.remove(_matches.count() - 1);
+        }
+
+        // stop at the end of a line of output if there is one nearby
+        qint64 end = qMin(tailStart, start + maxLines);
+        for (int i = 0 ; i < MAX_WRAPPED_LINES && end < tailStart && isWrapped(screen, end - 1) ; i++)
+            end++;
+
+        searchLines(screen, start, end - 1, _matches);
+        _indexedEnd = end;
+        _indexedEndComplete = !isWrapped(screen, end - 1);
+    }
+
+    _tailStart = qMax(tailStart, _indexedEnd);
+    _tailEnd = historyEnd + screen->getLines();
+    _historyLines = screen->getHistLines();
+    _tailMatches.clear();
+    searchLines(screen, _tailStart, _tailEnd - 1, _tailMatches);
+
+    return isComplete();
+}
+
+bool SearchMatchIndex::isComplete() const
+{
+    return _indexedEnd >= _tailStart;
+}
+
+void SearchMatchIndex::searchLines(const Screen* screen, qint64 firstLine, qint64 lastLine,
+                                   QVector<StoredMatch>& matches) const
+{
+    if ( firstLine > lastLine )
+        return;
+
+    const int first = firstLine - _droppedLines;
+    const int last = lastLine - _droppedLines;
+
+    // the lines are decoded as they are for filters, without trailing
+    // whitespace, and with a new-line between lines which are not wrapped
+    const QVector<LineProperty> properties = screen->getLineProperties(first, last);
+
+    QString text;
+    QTextStream stream(&text);
+    QVector<int> linePositions;
+
+    PlainTextDecoder decoder;
+    decoder.setTrailingWhitespace(false);
+    decoder.begin(&stream);
+    for (int line = first ; line <= last ; line++)
+    {
+        stream.flush();
+        linePositions << text.length();
+        screen->writeLineToStream(&decoder, line);
+        if ( !(properties[line - first] & LINE_WRAPPED) )
+            stream << QChar('\n');
+    }
+    decoder.end();
+    stream.flush();
+
+    // the width of the text before each position, to convert positions to columns
+    QVector<int> widths(text.length() + 1);
+    int width = 0;
+    for (int i = 0 ; i < text.length() ; i++)
+    {
+        widths[i] = width;
+        width += konsole_wcwidth(text.at(i).unicode());
+    }
+    widths[text.length()] = width;
+
+    int pos = 0;
+    while ( (pos = _regExp.indexIn(text, pos)) != -1 )
+    {
+        const int length = _regExp.matchedLength();
+        if ( length == 0 )
+            break;
+
+        const int startIndex = qUpperBound(linePositions.begin(), linePositions.end(), pos)
+                               - linePositions.begin() - 1;
+        const int endIndex = qUpperBound(linePositions.begin(), linePositions.end(), pos + length)
+                             - linePositions.begin() - 1;
+
+        StoredMatch match;
+        match.startLine = firstLine + startIndex;
+        match.startColumn = widths[pos] - widths[linePositions[startIndex]];
+        match.endLine = firstLine + endIndex;
+        match.endColumn = widths[pos + length] - widths[linePositions[endIndex]];
+        matches << match;
+
+        pos += length;
+    }
+}
+
+int SearchMatchIndex::count() const
+{
+    return _matches.count() - _firstMatch + _tailMatches.count();
+}
+
+const SearchMatchIndex::StoredMatch& SearchMatchIndex::stored(int index) const
+{
+    const int indexed = _matches.count() - _firstMatch;
+    return index < indexed ? _matches[_firstMatch + index] : _tailMatches[index - indexed];
+}
+
+SearchMatchIndex::Match SearchMatchIndex::toMatch(const StoredMatch& match) const
+{
+    Match result;
+    result.startLine = match.startLine - _droppedLines;
+    result.startColumn = match.startColumn;
+    result.endLine = match.endLine - _droppedLines;
+    result.endColumn = match.endColumn;
+    return result;
+}
+
+SearchMatchIndex::Match SearchMatchIndex::at(int index) const
+{
+    Q_ASSERT( index >= 0 && index < count() );
+    return toMatch(stored(index));
+}
+
+int SearchMatchIndex::lowerBound(qint64 line, int column) const
+{
+    int low = 0;
+    int high = count();
+    while ( low < high )
+    {
+        const int middle = (low + high) / 2;
+        const StoredMatch& match = stored(middle);
+        if ( match.startLine < line || (match.startLine == line && match.startColumn < column) )
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+int SearchMatchIndex::findNext(int line, int column) const
+{
+    return lowerBound(line + _droppedLines, column + 1);
+}
+
+int SearchMatchIndex::findPrevious(int line, int column) const
+{
+    return lowerBound(line + _droppedLines, column) - 1;
+}
+
+bool SearchMatchIndex::covers(const Screen* screen, int firstLine, int lastLine) const
+{
+    if ( screen != _screen || screen->historyGeneration() != _historyGeneration ||
+         screen->totalDroppedLines() != _droppedLines || _regExp.isEmpty() || _matchesEmpty )
+        return false;
+
+    // once the whole history has been searched, the matches on the screen
+    // found by the last update() are used for as long as no lines have
+    // been added to the history or the screen since
+    qint64 end = _indexedEnd;
+    if ( isComplete() && screen->getHistLines() == _historyLines &&
+         _droppedLines + _historyLines + screen->getLines() == _tailEnd )
+        end = _tailEnd;
+    // matches in the last lines searched may continue on lines which have not been
+    else if ( !_indexedEndComplete )
+        end -= MAX_WRAPPED_LINES;
+
+    return firstLine >= 0 && lastLine + _droppedLines < end;
+}
+
+QList<SearchMatchIndex::Match> SearchMatchIndex::matchesInLines(int firstLine, int lastLine) const
+{
+    const qint64 first = firstLine + _droppedLines;
+    const qint64 last = lastLine + _droppedLines;
+
+    // include matches which start on earlier lines and end on the first one
+    int index = lowerBound(first, 0);
+    while ( index > 0 && stored(index - 1).endLine >= first )
+        index--;
+
+    QList<Match> matches;
+    for ( ; index < count() && stored(index).startLine <= last ; index++)
+        matches << toMatch(stored(index));
+    return matches;
+}
+
+SearchMatchFilter::SearchMatchFilter(const SearchMatchIndex* index, ScreenWindow* window)
+    : _index(index)
+    , _window(window)
+{
+}
+
+void SearchMatchFilter::process()
+{
+    ScreenWindow* window = _window;
+    if ( window && window->screen() )
+    {
+        int firstLine = 0;
+        int lastLine = 0;
+        int column = 0;
+        getLineColumn(0, firstLine, column);
+        getLineColumn(qMax(0, buffer()->length() - 1), lastLine, column);
+
+        // lines which the index has searched are not searched again
+        const int offset = window->currentLine();
+        if ( _index->covers(window->screen(), offset + firstLine, offset + lastLine) )
+        {
+            foreach( const SearchMatchIndex::Match& match ,
+                     _index->matchesInLines(offset + firstLine, offset + lastLine) )
+            {
+                int startLine = match.startLine - offset;
+                int startColumn = match.startColumn;
+                int endLine = match.endLine - offset;
+                int endColumn = match.endColumn;
+
+                // matches which continue outside of the block are cut off
+                if ( startLine < firstLine )
+                {
+                    startLine = firstLine;
+                    startColumn = 0;
+                }
+                if ( endLine > lastLine )
+                {
+                    endLine = lastLine;
+                    endColumn = window->columnCount();
+                }
+
+                addHotSpot( newHotSpot(startLine, startColumn, endLine, endColumn) );
+            }
+            return;
+        }
+    }
+
+    RegExpFilter::process();
+}
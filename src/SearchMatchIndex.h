@@ -0,0 +1,194 @@
+/*
+    Copyright 2012 by Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef SEARCHMATCHINDEX_H
+#define SEARCHMATCHINDEX_H
+
+// Qt
+#include <QtCore/QList>
+#include <QtCore/QPointer>
+#include <QtCore/QRegExp>
+#include <QtCore/QVector>
+
+// Konsole
+#include "Filter.h"
+#include "konsole_export.h"
+
+namespace Konsole
+{
+
+class Screen;
+class ScreenWindow;
+
+/**
+ * A sorted index of the matches of a regular expression in the whole output
+ * of a terminal screen, including its history.
+ *
+ * Lines in the history do not change once they have been added to it, so
+ * they are searched only once, a limited number at a time, by update().
+ * The lines on the screen, which may change, are searched again each time
+ * update() is called.  Lines dropped from the history take their matches
+ * with them.
+ *
+ * Lines which are wrapped onto the next line are searched together with it,
+ * up to MAX_WRAPPED_LINES lines, so matches may span more than one line.
+ */
+class KONSOLEPRIVATE_EXPORT SearchMatchIndex
+{
+public:
+    /**
+     * The position of a match.  Line 0 is the first line in the history, and
+     * the end column is that of the first character after the match.
+     */
+    struct Match
+    {
+        int startLine;
+        int startColumn;
+        int endLine;
+        int endColumn;
+    };
+
+    SearchMatchIndex();
+
+    /** The number of lines wrapped onto each other which are searched together */
+    static const int MAX_WRAPPED_LINES = 100;
+
+    /**
+     * Sets the regular expression to search for and removes all matches.
+     * Expressions which match the empty string do not match anything.
+     */
+    void setRegExp(const QRegExp& regExp);
+    /** Returns the regular expression set with setRegExp() */
+    QRegExp regExp() const;
+
+    /**
+     * Brings the index up to date with the output of @p screen.  The lines on
+     * the screen and at most @p maxLines lines of the history which have not
+     * been searched yet are searched.  If @p screen is not the screen which
+     * was indexed before, or its history has been replaced, the index is
+     * rebuilt.
+     *
+     * Returns true if the whole output has been searched.
+     */
+    bool update(const Screen* screen, int maxLines);
+    /** Returns true if the whole output was searched by the last call to update() */
+    bool isComplete() const;
+
+    /** Returns the number of matches found */
+    int count() const;
+    /** Returns the match at @p index, in the order in which they occur in the output */
+    Match at(int index) const;
+    /**
+     * Returns the index of the first match which starts after @p line and
+     * @p column, or count() if there is none.
+     */
+    int findNext(int line, int column) const;
+    /**
+     * Returns the index of the last match which starts before @p line and
+     * @p column, or -1 if there is none.
+     */
+    int findPrevious(int line, int column) const;
+
+    /**
+     * Returns true if the lines from @p firstLine to @p lastLine of @p screen
+     * have been searched and have not moved since, so that matchesInLines()
+     * returns all the matches in them.  Lines on the screen are covered once
+     * the whole history has been searched, as they were when update() was
+     * last called.
+     */
+    bool covers(const Screen* screen, int firstLine, int lastLine) const;
+    /** Returns the matches which cover any of the lines from @p firstLine to @p lastLine */
+    QList<Match> matchesInLines(int firstLine, int lastLine) const;
+
+private:
+    // matches are stored with line numbers which count the lines dropped
+    // from the history, so that they do not change when lines are dropped
+    struct StoredMatch
+    {
+        qint64 startLine;
+        int startColumn;
+        qint64 endLine;
+        int endColumn;
+    };
+
+    void clear();
+    bool isWrapped(const Screen* screen, qint64 line) const;
+    // searches lines from firstLine to lastLine, numbered as in StoredMatch
+    void searchLines(const Screen* screen, qint64 firstLine, qint64 lastLine,
+                     QVector<StoredMatch>& matches) const;
+    const StoredMatch& stored(int index) const;
+    // returns the index of the first match which starts at or after
+    // 'line' and 'column'
+    int lowerBound(qint64 line, int column) const;
+    Match toMatch(const StoredMatch& match) const;
+
+    QRegExp _regExp;
+    bool _matchesEmpty;
+
+    // the screen which was indexed and the state of its history then
+    const Screen* _screen;
+    int _historyGeneration;
+    qint64 _droppedLines;
+
+    // matches in the lines of the history before _indexedEnd, the first
+    // _firstMatch of which have been dropped from the history
+    QVector<StoredMatch> _matches;
+    int _firstMatch;
+    qint64 _indexedEnd;
+    // false if the last line searched is wrapped onto a line which has not
+    // been searched yet
+    bool _indexedEndComplete;
+
+    // matches in the lines from _tailStart, the lines on the screen
+    // and those in the history which are wrapped onto them
+    QVector<StoredMatch> _tailMatches;
+    qint64 _tailStart;
+    // the end of the lines searched by the last update(), and the number
+    // of lines in the history then
+    qint64 _tailEnd;
+    int _historyLines;
+};
+
+/**
+ * A filter which highlights the matches found by a SearchMatchIndex.
+ *
+ * For blocks of lines which the index covers, including those on the
+ * screen, the matches are taken from the index instead of searching the
+ * lines again.  Other blocks are
+ * searched like a RegExpFilter.
+ */
+class KONSOLEPRIVATE_EXPORT SearchMatchFilter : public RegExpFilter
+{
+public:
+    /**
+     * Constructs a filter which highlights the matches of @p index in the
+     * image of @p window.
+     */
+    SearchMatchFilter(const SearchMatchIndex* index, ScreenWindow* window);
+
+    virtual void process();
+
+private:
+    const SearchMatchIndex* _index;
+    QPointer<ScreenWindow> _window;
+};
+
+}
+
+#endif // SEARCHMATCHINDEX_H
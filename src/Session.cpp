@@ -35,11 +35,13 @@
 #include <QtCore/QDir>
 #include <QtCore/QFile>
 #include <QtCore/QRegExp>
+#include <QtCore/QSet>
 #include <QtCore/QStringList>
 #include <QtDBus/QtDBus>
 #include <QtCore/QDate>
 
 // KDE
+#include <KApplication>
 #include <KDebug>
 #include <KLocale>
 #include <KMessageBox>
@@ -67,6 +69,9 @@ using namespace Konsole;
 
 int Session::lastSessionId = 0;
 
+// the age in days after which journals of saved sessions are removed
+static const int STALE_JOURNAL_DAYS = 30;
+
 // HACK This is copied out of QUuid::createUuid with reseeding forced.
 // Required because color schemes repeatedly seed the RNG...
 // ...with a constant.
@@ -101,6 +106,7 @@ QUuid createUuid()
 
 Session::Session(QObject* parent) :
    QObject(parent)
+   , _historyJournalSaved(false)
    , _shellProcess(0)
    , _emulation(0)
    , _monitorActivity(false)
@@ -833,9 +839,17 @@ void Session::sendMouseEvent(int buttons, int column, int line, int eventType)
 
 Session::~Session()
 {
+    const HistoryTypeJournal* journal = dynamic_cast<const HistoryTypeJournal*>(&historyType());
+    const QString journalDirectory = journal ? journal->directory() : QString();
+    const QString journalName = journal ? journal->name() : QString();
+
     delete _foregroundProcessInfo;
     delete _sessionProcessInfo;
     delete _emulation;
+
+    if ( !journalName.isEmpty() && !_historyJournalSaved )
+        HistoryTypeJournal::removeJournal(journalDirectory, journalName);
+
     delete _shellProcess;
     delete _zmodemProc;
 }
@@ -846,6 +860,13 @@ void Session::done(int exitCode, QProcess::ExitStatus exitStatus)
     disconnect(_shellProcess, SIGNAL(finished(int,QProcess::ExitStatus)),
                this, SLOT(done(int,QProcess::ExitStatus)));
 
+    // the session has ended, so the journal which was kept for restoring
+    // it is removed with the session unless it is saved again.  When the
+    // desktop session is being saved, the shells end because they are hung
+    // up after the journal was saved, which must be kept for the restore
+    if ( !kapp || !kapp->sessionSaving() )
+        _historyJournalSaved = false;
+
     if ( !_autoClose )
     {
         _userTitle = i18nc("@info:shell This session is done", "Finished");
@@ -1095,7 +1116,58 @@ QString Session::iconText() const
 
 void Session::setHistoryType(const HistoryType& hType)
 {
+    const HistoryTypeJournal* journal = dynamic_cast<const HistoryTypeJournal*>(&historyType());
+    const QString journalDirectory = journal ? journal->directory() : QString();
+    const QString journalName = journal ? journal->name() : QString();
+
     _emulation->setHistory(hType);
+
+    // the previous journal is no longer used by this session
+    const HistoryTypeJournal* newJournal = dynamic_cast<const HistoryTypeJournal*>(&historyType());
+    if ( journal && (!newJournal || newJournal->directory() != journalDirectory
+                                 || newJournal->name() != journalName) )
+        HistoryTypeJournal::removeJournal(journalDirectory, journalName);
+}
+
+qint64 Session::historyMemoryUsage() const
+{
+    return _emulation->historyMemoryUsage();
+}
+
+qint64 Session::releaseHistoryMemory(qint64 bytes)
+{
+    return _emulation->releaseHistoryMemory(bytes);
+}
+
+void Session::setHistorySearchIndexLimit(qint64 bytes)
+{
+    _emulation->setHistorySearchIndexLimit(bytes);
+}
+
+qint64 Session::historySearchIndexLimit() const
+{
+    return _emulation->historySearchIndexLimit();
+}
+
+qint64 Session::historySearchIndexMemoryUsage() const
+{
+    return _emulation->historySearchIndexMemoryUsage();
+}
+
+void Session::setPersistentHistory(const QString& directory)
+{
+    // strip the braces from the identifier to get a friendlier file name
+    const QString name = _uniqueIdentifier.toString().mid(1, 36);
+    setHistoryType(HistoryTypeJournal(directory, name));
+
+    // journals of saved sessions which were never restored are removed
+    // once they are a month old, the first time each directory is used
+    static QSet<QString> cleanedDirectories;
+    if ( !cleanedDirectories.contains(directory) )
+    {
+        cleanedDirectories.insert(directory);
+        HistoryTypeJournal::removeStaleJournals(directory, name, STALE_JOURNAL_DAYS);
+    }
 }
 
 const HistoryType& Session::historyType() const
@@ -1409,6 +1481,11 @@ void Session::saveSession(KConfigGroup& group)
     group.writeEntry("RemoteTab",      tabTitleFormat(RemoteTabTitle));
     group.writeEntry("SessionGuid",    _uniqueIdentifier.toString());
     group.writeEntry("Encoding",       QString(codec()));
+
+    // keep the history journal on disk so that it can be reattached
+    // when the session is restored
+    if ( dynamic_cast<const HistoryTypeJournal*>(&historyType()) )
+        _historyJournalSaved = true;
 }
 
 void Session::restoreSession(KConfigGroup& group)
@@ -1425,6 +1502,12 @@ void Session::restoreSession(KConfigGroup& group)
     if (!value.isEmpty()) _uniqueIdentifier = QUuid(value);
     value = group.readEntry("Encoding");
     if (!value.isEmpty()) setCodec(value.toUtf8());
+
+    // switch to the journal of the saved session, which is named after
+    // its identifier.  Only the end of the journal is read at this point.
+    const HistoryTypeJournal* journal = dynamic_cast<const HistoryTypeJournal*>(&historyType());
+    if ( journal )
+        setPersistentHistory(journal->directory());
 }
 
 SessionGroup::SessionGroup(QObject* parent)
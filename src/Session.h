@@ -220,6 +220,34 @@ public:
    * Clears the history store used by this session.
    */
   void clearHistory();
+  /**
+   * Sets the history store of this session to a persistent journal in
+   * @p directory.  The journal is named after the session's unique identifier,
+   * so a restored session reattaches to the journal of the saved session.
+   *
+   * The journal is removed when the session stops using it, unless the
+   * session has been saved with saveSession().
+   */
+  void setPersistentHistory(const QString& directory);
+  /** Returns the number of bytes of memory used by the history store of this session. */
+  qint64 historyMemoryUsage() const;
+  /**
+   * Moves the oldest lines in the history store of this session out of
+   * memory until at least @p bytes have been released.  The lines are read
+   * back when they are accessed again.
+   *
+   * Returns the number of bytes released.
+   */
+  qint64 releaseHistoryMemory(qint64 bytes);
+  /**
+   * Sets the number of bytes of memory which the index used to search the
+   * history store of this session may use.  A limit of 0 disables the index.
+   */
+  void setHistorySearchIndexLimit(qint64 bytes);
+  /** Returns the limit set with setHistorySearchIndexLimit() */
+  qint64 historySearchIndexLimit() const;
+  /** Returns the number of bytes of memory used by the index of the history store. */
+  qint64 historySearchIndexMemoryUsage() const;
 
   /**
    * Sets the key bindings used by this session.  The bindings
@@ -663,6 +691,7 @@ private:
   ProcessInfo* updateWorkingDirectory();
 
   QUuid            _uniqueIdentifier; // SHELL_SESSION_ID
+  bool             _historyJournalSaved; // see saveSession()
 
   Pty*          _shellProcess;
   Emulation*    _emulation;
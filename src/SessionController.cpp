@@ -22,9 +22,12 @@
 #include "SessionController.h"
 
 // Qt
+#include <QtCore/QtConcurrentRun>
 #include <QtGui/QApplication>
 #include <QtGui/QMenu>
 #include <QtGui/QKeyEvent>
+#include <QtCore/QPointer>
+#include <QtCore/QTimer>
 
 // KDE
 #include <KAction>
@@ -54,11 +57,14 @@
 #include "HistorySizeDialog.h"
 #include "IncrementalSearchBar.h"
 #include "RenameTabsDialog.h"
+#include "Screen.h"
 #include "ScreenWindow.h"
+#include "SearchMatchIndex.h"
 #include "Session.h"
 #include "ProfileList.h"
 #include "TerminalDisplay.h"
 #include "SessionManager.h"
+#include "HistoryMemoryGovernor.h"
 
 // for SaveHistoryTask
 #include <KFileDialog>
@@ -75,6 +81,10 @@ QSet<SessionController*> SessionController::_allControllers;
 //QPointer<SearchHistoryThread> SearchHistoryTask::_thread;
 int SessionController::_lastControllerId;
 
+// the number of lines of history searched for matches to highlight
+// before the user interface is updated
+static const int SEARCH_MATCH_LINES = 5000;
+
 SessionController::SessionController(Session* session , TerminalDisplay* view, QObject* parent)
     : ViewProperties(parent)
     , KXMLGUIClient()
@@ -85,6 +95,8 @@ SessionController::SessionController(Session* session , TerminalDisplay* view, Q
     , _previousState(-1)
     , _viewUrlFilter(0)
     , _searchFilter(0)
+    , _searchMatches(0)
+    , _searchMatchTimer(0)
     , _searchToggleAction(0)
     , _findNextAction(0)
     , _findPreviousAction(0)
@@ -163,6 +175,12 @@ SessionController::SessionController(Session* session , TerminalDisplay* view, Q
     connect( _view , SIGNAL(keyPressedSignal(QKeyEvent*)) , activityTimer , SLOT(start()) );
     connect( activityTimer , SIGNAL(timeout()) , this , SLOT(snapshot()) );
 
+    // the history is searched for matches to highlight a few thousand lines
+    // at a time, whenever the event loop is idle
+    _searchMatchTimer = new QTimer(this);
+    _searchMatchTimer->setSingleShot(true);
+    connect( _searchMatchTimer , SIGNAL(timeout()) , this , SLOT(updateSearchMatches()) );
+
     _allControllers.insert(this);
 }
 
@@ -316,6 +334,10 @@ bool SessionController::eventFilter(QObject* watched , QEvent* event)
             // used by the view manager to update the title of the MainWindow widget containing the view
             emit focused(this);
 
+            // the history of the session in the focused view is the last
+            // to be moved out of memory
+            SessionManager::instance()->historyMemoryGovernor()->sessionViewed(_session);
+
             // when the view is focused, set bell events from the associated session to be delivered
             // by the focused view
 
@@ -369,6 +391,13 @@ void SessionController::removeSearchFilter()
     _view->filterChain()->removeFilter(_searchFilter);
     delete _searchFilter;
     _searchFilter = 0;
+
+    _searchMatchTimer->stop();
+    delete _searchMatches;
+    _searchMatches = 0;
+
+    if ( _searchBar )
+        _searchBar->setMatchCount(0, -1);
 }
 
 void SessionController::setSearchBar(IncrementalSearchBar* searchBar)
@@ -870,10 +899,104 @@ void SessionController::updateSearchFilter()
     {
         Q_ASSERT( searchBar() && searchBar()->isVisible() );
 
+        updateSearchMatches();
         _view->processFilters();
     }
 }
 
+void SessionController::updateSearchMatches()
+{
+    if ( !_searchMatches || !_searchBar )
+        return;
+
+    // matches are only counted while they are highlighted
+    if ( !_searchBar->optionsChecked().at(IncrementalSearchBar::HighlightMatches) ||
+         _searchMatches->regExp().isEmpty() )
+    {
+        _searchMatchTimer->stop();
+        _searchBar->setMatchCount(0, -1);
+        return;
+    }
+
+    const Screen* screen = _view->screenWindow()->screen();
+    const bool complete = _searchMatches->update(screen, SEARCH_MATCH_LINES);
+    if ( complete )
+        _searchMatchTimer->stop();
+    else if ( !_searchMatchTimer->isActive() )
+        _searchMatchTimer->start(0);
+
+    // show which match is selected, if any
+    int current = 0;
+    int column = 0;
+    int line = 0;
+    screen->getSelectionStart(column, line);
+    if ( screen->isSelected(column, line) )
+    {
+        const int index = _searchMatches->findNext(line, column - 1);
+        if ( index < _searchMatches->count() &&
+             _searchMatches->at(index).startLine == line &&
+             _searchMatches->at(index).startColumn == column )
+            current = index + 1;
+    }
+
+    _searchBar->setMatchCount(current, _searchMatches->count(), complete);
+}
+
+bool SessionController::findInSearchMatches(bool forwards)
+{
+    if ( !_searchMatches || !_searchMatches->isComplete() ||
+         !_searchBar->optionsChecked().at(IncrementalSearchBar::HighlightMatches) )
+        return false;
+
+    const int count = _searchMatches->count();
+    if ( count == 0 )
+    {
+        searchCompleted(false);
+        return true;
+    }
+
+    ScreenWindow* window = _view->screenWindow();
+    const Screen* screen = window->screen();
+
+    // continue from the selected match, or from the lines in view
+    int column = 0;
+    int line = 0;
+    screen->getSelectionStart(column, line);
+    if ( !screen->isSelected(column, line) )
+    {
+        line = window->currentLine() + ( forwards ? 0 : window->windowLines() );
+        column = -1;
+    }
+
+    int index = forwards ? _searchMatches->findNext(line, column) :
+                           _searchMatches->findPrevious(line, column);
+
+    // continue from the other end of the output
+    if ( index >= count )
+        index = 0;
+    else if ( index < 0 )
+        index = count - 1;
+
+    const SearchMatchIndex::Match match = _searchMatches->at(index);
+    int endLine = match.endLine;
+    int endColumn = match.endColumn - 1;
+    if ( endColumn < 0 && endLine > match.startLine )
+    {
+        endLine--;
+        endColumn = window->columnCount() - 1;
+    }
+
+    window->scrollTo(match.startLine);
+    window->setSelectionStart( match.startColumn , match.startLine - window->currentLine() , false );
+    window->setSelectionEnd( qMax(0, endColumn) , endLine - window->currentLine() );
+    window->setTrackOutput(false);
+    window->notifyOutputChanged();
+
+    _searchBar->setMatchCount(index + 1, count);
+    searchCompleted(true);
+    return true;
+}
+
 // searchHistory() may be called either as a result of clicking a menu item or
 // as a result of changing the search bar widget
 void SessionController::searchHistory(bool showSearchBar)
@@ -888,7 +1011,8 @@ void SessionController::searchHistory(bool showSearchBar)
 
             listenForScreenWindowUpdates();
 
-            _searchFilter = new RegExpFilter();
+            _searchMatches = new SearchMatchIndex();
+            _searchFilter = new SearchMatchFilter(_searchMatches, _view->screenWindow());
             _view->filterChain()->addFilter(_searchFilter);
             connect( _searchBar , SIGNAL(searchChanged(QString)) , this ,
                     SLOT(searchTextChanged(QString)) );
@@ -906,6 +1030,10 @@ void SessionController::searchHistory(bool showSearchBar)
         {
             setFindNextPrevEnabled(false);
 
+            if ( _searchTask )
+                _searchTask->cancel();
+            _searchBar->setSearchProgress(-1);
+
             disconnect( _searchBar , SIGNAL(searchChanged(QString)) , this ,
                     SLOT(searchTextChanged(QString)) );
 
@@ -934,7 +1062,16 @@ void SessionController::searchTextChanged(const QString& text)
 void SessionController::searchCompleted(bool success)
 {
     if ( _searchBar )
+    {
+        _searchBar->setSearchProgress(-1);
         _searchBar->setFoundMatch(success);
+    }
+}
+
+void SessionController::searchProgress(int percent)
+{
+    if ( _searchBar )
+        _searchBar->setSearchProgress(percent);
 }
 
 void SessionController::beginSearch(const QString& text , int direction)
@@ -950,16 +1087,31 @@ void SessionController::beginSearch(const QString& text , int direction)
     QRegExp regExp( text ,  caseHandling , syntax );
     _searchFilter->setRegExp(regExp);
 
-    if ( !regExp.isEmpty() )
+    // the matches found so far are kept when searching for the same text again
+    if ( _searchMatches->regExp() != regExp )
+        _searchMatches->setRegExp(regExp);
+    updateSearchMatches();
+
+    // a new search replaces the one which is still running, if any
+    if ( _searchTask )
+        _searchTask->cancel();
+    _searchBar->setSearchProgress(-1);
+
+    // once all the matches have been found, the next one is selected
+    // without searching the output again
+    if ( !regExp.isEmpty() &&
+         !findInSearchMatches(direction == SearchHistoryTask::ForwardsSearch) )
     {
         SearchHistoryTask* task = new SearchHistoryTask(this);
 
         connect( task , SIGNAL(completed(bool)) , this , SLOT(searchCompleted(bool)) );
+        connect( task , SIGNAL(progress(int)) , this , SLOT(searchProgress(int)) );
 
         task->setRegExp(regExp);
         task->setSearchDirection( (SearchHistoryTask::SearchDirection)direction );
         task->setAutoDelete(true);
         task->addScreenWindow( _session , _view->screenWindow() );
+        _searchTask = task;
         task->execute();
     }
 
@@ -967,6 +1119,10 @@ void SessionController::beginSearch(const QString& text , int direction)
 }
 void SessionController::highlightMatches(bool highlight)
 {
+    // the filter takes the matches on the screen from the index, so it is
+    // brought up to date first
+    updateSearchMatches();
+
     if ( highlight )
     {
         _view->filterChain()->addFilter(_searchFilter);
@@ -1024,6 +1180,12 @@ void SessionController::showHistoryOptions()
         dialog->setMode( HistorySizeDialog::NoHistory );
     }
 
+    if ( _session->historySearchIndexLimit() > 0 )
+    {
+        dialog->setSearchIndexUsage( _session->historySearchIndexMemoryUsage() ,
+                                     _session->historySearchIndexLimit() );
+    }
+
     connect( dialog , SIGNAL(optionsChanged(int,int)) ,
              this , SLOT(scrollBackOptionsChanged(int,int)) );
 
@@ -1156,15 +1318,22 @@ void SessionController::showDisplayContextMenu(const QPoint& position)
     if (popup)
     {
         // prepend content-specific actions such as "Open Link", "Copy Email Address" etc.
+        //
+        // the actions belong to a hotspot, which is deleted along with its
+        // actions if the filters find it again while the menu is open
         QList<QAction*> contentActions = _view->filterActions(position);
         QAction* contentSeparator = new QAction(popup);
         contentSeparator->setSeparator(true);
         contentActions << contentSeparator;
 
+        QList< QPointer<QAction> > contentActionPointers;
+        foreach (QAction* action,contentActions)
+            contentActionPointers << action;
+
         _preventClose = true;
 
         popup->insertActions(popup->actions().value(0,0),contentActions);
-        QAction* chosen = popup->exec( _view->mapToGlobal(position) );
+        QPointer<QAction> chosen = popup->exec( _view->mapToGlobal(position) );
 
 	// check for validity of the pointer to the popup menu
 	if (popup)
@@ -1174,8 +1343,11 @@ void SessionController::showDisplayContextMenu(const QPoint& position)
             // If the close action was chosen, the popup menu will be partially
             // destroyed at this point, and the rest will be destroyed later by
             // 'chosen->trigger()'
-            foreach (QAction* action,contentActions)
-		popup->removeAction(action);
+            foreach (const QPointer<QAction>& action,contentActionPointers)
+            {
+                if (action)
+                    popup->removeAction(action);
+            }
 
             delete contentSeparator;
 	}
@@ -1455,144 +1627,243 @@ void SaveHistoryTask::jobResult(KJob* job)
 }
 void SearchHistoryTask::addScreenWindow( Session* session , ScreenWindow* searchWindow )
 {
-   _windows.insert(session,searchWindow);
+   _windows << qMakePair(SessionPtr(session), ScreenWindowPtr(searchWindow));
 }
 void SearchHistoryTask::execute()
 {
-    QMapIterator< SessionPtr , ScreenWindowPtr > iter(_windows);
+    _cancelled = false;
+    searchNextWindow();
+}
+void SearchHistoryTask::cancel()
+{
+    _cancelled = true;
+    _windows.clear();
 
-    while ( iter.hasNext() )
-    {
-        iter.next();
-        executeOnScreenWindow( iter.key() , iter.value() );
-    }
+    // otherwise the task is finished with once the block being
+    // searched has been
+    if ( !_searcher->isRunning() && autoDelete() )
+        deleteLater();
 }
 
-void SearchHistoryTask::executeOnScreenWindow( SessionPtr session , ScreenWindowPtr window )
+// searches a block of decoded output, this runs on a worker thread
+static int searchBlock(const QString& text , const QRegExp& regExp , bool forwards)
 {
-    Q_ASSERT( session );
-    Q_ASSERT( window );
+    // QString works on its own copy of the expression
+    return forwards ? text.indexOf(regExp) : text.lastIndexOf(regExp);
+}
 
-    Emulation* emulation = session->emulation();
+void SearchHistoryTask::searchNextWindow()
+{
+    while ( !_windows.isEmpty() )
+    {
+        _session = _windows.first().first;
+        _window = _windows.first().second;
+        _windows.removeFirst();
 
-    int selectionColumn = 0;
-    int selectionLine = 0;
+        if ( !_session || !_window )
+            continue;
 
-    window->getSelectionEnd(selectionColumn , selectionLine);
+        if ( _regExp.isEmpty() )
+        {
+            emit completed(false);
+            continue;
+        }
 
-    if ( !_regExp.isEmpty() )
-    {
-        int pos = -1;
-        const bool forwards = ( _direction == ForwardsSearch );
-        int startLine = selectionLine + window->currentLine() + ( forwards ? 1 : -1 );
-        // Temporary fix for #205495
-        if (startLine < 0) startLine = 0;
-        const int lastLine = window->lineCount() - 1;
-        QString string;
+        int selectionColumn = 0;
+        int selectionLine = 0;
 
-        //text stream to read history into string for pattern or regular expression searching
-        QTextStream searchStream(&string);
+        _window->getSelectionEnd(selectionColumn , selectionLine);
 
-        PlainTextDecoder decoder;
-        decoder.setRecordLinePositions(true);
+        const bool forwards = ( _direction == ForwardsSearch );
+        _startLine = selectionLine + _window->currentLine() + ( forwards ? 1 : -1 );
+        // Temporary fix for #205495
+        if (_startLine < 0) _startLine = 0;
+        _lastLine = _window->lineCount() - 1;
 
         //setup first and last lines depending on search direction
-        int line = startLine;
+        _line = _startLine;
+        _endLine = _line;
+        _hasWrapped = false;  // set to true when we reach the top/bottom
+                              // of the output and continue from the other
+                              // end
+        _linesSearched = 0;
+
+        // text which any match must contain, for looking up in the index
+        // of the history
+        _indexText = RegExpFilter::literalPrefix(_regExp);
 
         //read through and search history in blocks of 10K lines.
         //this balances the need to retrieve lots of data from the history each time
         //(for efficient searching)
         //without using silly amounts of memory if the history is very large.
-        const int maxDelta = qMin(window->lineCount(),10000);
-        int delta = forwards ? maxDelta : -maxDelta;
+        const int maxDelta = qMin(_window->lineCount(),10000);
+        _delta = forwards ? maxDelta : -maxDelta;
 
-        int endLine = line;
-        bool hasWrapped = false;  // set to true when we reach the top/bottom
-                                  // of the output and continue from the other
-                                  // end
+        searchNextBlock();
+        return;
+    }
 
-        //loop through history in blocks of <delta> lines.
-        do
+    // all of the windows have been searched
+    if ( autoDelete() )
+        deleteLater();
+}
+
+void SearchHistoryTask::searchNextBlock()
+{
+    while ( true )
+    {
+        // the output may have been cleared since the previous block was read
+        const int lastLine = _window->lineCount() - 1;
+        if ( lastLine < _lastLine )
         {
-            // ensure that application does not appear to hang
-            // if searching through a lengthy output
-            QApplication::processEvents();
+            _lastLine = lastLine;
+            _startLine = qMin(_startLine, lastLine);
+            _line = qMin(_line, lastLine);
+            _endLine = qMin(_endLine, lastLine);
+        }
 
-            // calculate lines to search in this iteration
-            if ( hasWrapped )
-            {
-                if ( endLine == lastLine )
-                    line = 0;
-                else if ( endLine == 0 )
-                    line = lastLine;
+        // calculate lines to search in this iteration
+        if ( _hasWrapped )
+        {
+            if ( _endLine == _lastLine )
+                _line = 0;
+            else if ( _endLine == 0 )
+                _line = _lastLine;
 
-                endLine += delta;
+            _endLine += _delta;
 
-                if ( forwards )
-                   endLine = qMin( startLine , endLine );
-                else
-                   endLine = qMax( startLine , endLine );
-            }
+            if ( _direction == ForwardsSearch )
+               _endLine = qMin( _startLine , _endLine );
             else
+               _endLine = qMax( _startLine , _endLine );
+        }
+        else
+        {
+            _endLine += _delta;
+
+            if ( _endLine > _lastLine )
             {
-                endLine += delta;
+                _hasWrapped = true;
+                _endLine = _lastLine;
+            } else if ( _endLine < 0 )
+            {
+                _hasWrapped = true;
+                _endLine = 0;
+            }
+        }
 
-                if ( endLine > lastLine )
-                {
-                    hasWrapped = true;
-                    endLine = lastLine;
-                } else if ( endLine < 0 )
+        _linesSearched += qAbs(_endLine - _line);
+
+        // the index of the history, if there is one, rules out the lines
+        // which cannot contain a match
+        const QList< QPair<int,int> > ranges =
+            _session->emulation()->searchCandidates(_indexText, qMin(_endLine,_line) , qMax(_endLine,_line));
+
+        if ( !ranges.isEmpty() )
+        {
+            // the output is read here, the history is not safe to use from
+            // other threads
+            QString string;
+            QTextStream searchStream(&string);
+
+            _linePositions.clear();
+            _lineNumbers.clear();
+
+            PlainTextDecoder decoder;
+            decoder.setRecordLinePositions(true);
+
+            typedef QPair<int,int> LineRange;
+            foreach( const LineRange& range , ranges )
+            {
+                decoder.begin(&searchStream);
+                _session->emulation()->writeToStream(&decoder, range.first , range.second );
+                decoder.end();
+
+                // the decoder may record an extra position for the new-line
+                // after the last line
+                const QList<int> positions = decoder.linePositions();
+                for (int line = range.first ; line <= range.second ; line++)
                 {
-                    hasWrapped = true;
-                    endLine = 0;
+                    _linePositions << positions.value(line - range.first, string.length());
+                    _lineNumbers << line;
                 }
+
+                // keep matches from running on from one range to the next
+                searchStream << '\n';
             }
 
-            decoder.begin(&searchStream);
-            emulation->writeToStream(&decoder, qMin(endLine,line) , qMax(endLine,line) );
-            decoder.end();
+            _searcher->setFuture( QtConcurrent::run(searchBlock, string, _regExp,
+                                                    _direction == ForwardsSearch) );
+            return;
+        }
 
-            // line number search below assumes that the buffer ends with a new-line 
-            string.append('\n');
+        // nothing in this block can match, move to the next one
+        _line = _endLine;
 
-            pos = -1;
-            if (forwards)
-                pos = string.indexOf(_regExp);
-            else
-                pos = string.lastIndexOf(_regExp);
+        if ( _startLine == _endLine )
+        {
+            searchFailed();
+            return;
+        }
+    }
+}
 
-            //if a match is found, position the cursor on that line and update the screen
-            if ( pos != -1 )
-            {
-                int newLines = 0;
-                QList<int> linePositions = decoder.linePositions();
-                while (newLines < linePositions.count() && linePositions[newLines] <= pos)
-                    newLines++;
+void SearchHistoryTask::searchFailed()
+{
+    // if no match was found, clear selection to indicate this
+    _window->clearSelection();
+    _window->notifyOutputChanged();
+
+    emit completed(false);
+
+    searchNextWindow();
+}
+
+void SearchHistoryTask::blockSearched()
+{
+    if ( _cancelled )
+    {
+        if ( autoDelete() )
+            deleteLater();
+        return;
+    }
 
-                // ignore the new line at the start of the buffer
-                newLines--;
+    // the session or its view has gone away
+    if ( !_session || !_window )
+    {
+        searchNextWindow();
+        return;
+    }
 
-                int findPos = qMin(line,endLine) + newLines;
+    const int pos = _searcher->result();
 
-                highlightResult(window,findPos);
+    //if a match is found, position the cursor on that line and update the screen
+    if ( pos != -1 )
+    {
+        // find the last line which starts at or before the match
+        const int index = qUpperBound(_linePositions.begin(), _linePositions.end(), pos)
+                          - _linePositions.begin() - 1;
 
-                emit completed(true);
+        highlightResult(_window, _lineNumbers.value(qMax(0, index)));
 
-                return;
-            }
+        emit completed(true);
 
-            //clear the current block of text and move to the next one
-            string.clear();
-            line = endLine;
+        searchNextWindow();
+        return;
+    }
 
-        } while ( startLine != endLine );
+    //move to the next block of text
+    _line = _endLine;
 
-        // if no match was found, clear selection to indicate this
-        window->clearSelection();
-        window->notifyOutputChanged();
+    if ( _startLine == _endLine )
+    {
+        searchFailed();
+        return;
     }
 
-    emit completed(false);
+    emit progress( qMin(100, _linesSearched * 100 / qMax(1, _lastLine + 1)) );
+
+    searchNextBlock();
 }
 void SearchHistoryTask::highlightResult(ScreenWindowPtr window , int findPos)
 {
@@ -1612,8 +1883,21 @@ void SearchHistoryTask::highlightResult(ScreenWindowPtr window , int findPos)
 SearchHistoryTask::SearchHistoryTask(QObject* parent)
     : SessionTask(parent)
     , _direction(ForwardsSearch)
+    , _startLine(0)
+    , _lastLine(0)
+    , _line(0)
+    , _endLine(0)
+    , _delta(0)
+    , _hasWrapped(false)
+    , _linesSearched(0)
+    , _searcher(new QFutureWatcher<int>(this))
+    , _cancelled(false)
 {
-
+    connect( _searcher , SIGNAL(finished()) , this , SLOT(blockSearched()) );
+}
+SearchHistoryTask::~SearchHistoryTask()
+{
+    _searcher->waitForFinished();
 }
 void SearchHistoryTask::setSearchDirection( SearchDirection direction )
 {
@@ -23,7 +23,9 @@
 
 // Qt
 #include <QtGui/QIcon>
+#include <QtCore/QFutureWatcher>
 #include <QtCore/QList>
+#include <QtCore/QPair>
 #include <QtCore/QSet>
 #include <QtCore/QPointer>
 #include <QtCore/QString>
@@ -46,6 +48,7 @@ namespace KIO
 class QAction;
 class QTextCodec;
 class QKeyEvent;
+class QTimer;
 
 class KCodecAction;
 class KUrl;
@@ -64,7 +67,9 @@ class IncrementalSearchBar;
 class ProfileList;
 class UrlFilter;
 class RegExpFilter;
+class SearchMatchIndex;
 class HistorySizeDialog;
+class SearchHistoryTask;
 
 // SaveHistoryTask
 class TerminalCharacterDecoder;
@@ -217,6 +222,9 @@ private slots:
     void sessionTitleChanged();
     void searchTextChanged(const QString& text);
     void searchCompleted(bool success);
+    void searchProgress(int percent);
+    void updateSearchMatches(); // searches more of the output for matches
+                                // to highlight
     void searchClosed(); // called when the user clicks on the
                          // history search bar's close button 
 
@@ -249,6 +257,9 @@ private:
     void beginSearch(const QString& text , int direction);
     void setupActions();
     void removeSearchFilter(); // remove and delete the current search filter if set
+    // selects the next or previous highlighted match, returns false if
+    // the matches in the output have not all been found yet
+    bool findInSearchMatches(bool forwards);
     void setFindNextPrevEnabled(bool enabled);
     void listenForScreenWindowUpdates();
 
@@ -267,6 +278,9 @@ private:
 
     UrlFilter*      _viewUrlFilter;
     RegExpFilter*   _searchFilter; 
+    QPointer<SearchHistoryTask> _searchTask; // the search running in the background
+    SearchMatchIndex* _searchMatches; // the matches highlighted by _searchFilter
+    QTimer* _searchMatchTimer;
 
     KAction* _copyToAllTabsAction;
     KAction* _copyToSelectedAction;
@@ -405,11 +419,12 @@ private:
  * When execute() is called, the search begins in the direction specified by searchDirection(),
  * starting at the position of the current selection.
  *
+ * The output is decoded in blocks of lines, each of which is searched on a worker
+ * thread while the application continues to handle events.  The search can be
+ * stopped with cancel(), and reports its progress with the progress() signal.
+ *
  * FIXME - This is not a proper implementation of SessionTask, in that it ignores sessions specified
  * with addSession()
- *
- * TODO - Implementation requirements:
- *          May provide progress feedback to the user when searching very large output logs.
  */
 class SearchHistoryTask : public SessionTask
 {
@@ -432,6 +447,7 @@ public:
      * Constructs a new search task.
      */
     explicit SearchHistoryTask(QObject* parent = 0);
+    virtual ~SearchHistoryTask();
 
     /** Adds a screen window to the list to search when execute() is called. */
     void addScreenWindow( Session* session , ScreenWindow* searchWindow); 
@@ -450,25 +466,66 @@ public:
      * Performs a search through the session's history, starting at the position
      * of the current selection, in the direction specified by setSearchDirection().
      *
-     * If it finds a match, the ScreenWindow specified in the constructor is
-     * scrolled to the position where the match occurred and the selection
-     * is set to the matching text.  execute() then returns immediately.
+     * execute() returns immediately and the search continues in the background.
+     * When it finds a match, the ScreenWindow is scrolled to the position where
+     * the match occurred, the selection is set to the matching text and
+     * completed() is emitted.
      *
      * To continue the search looking for further matches, call execute() again.
      */
     virtual void execute();
 
+    /**
+     * Stops the search.  The selection of the screen windows is left as it is
+     * and completed() is not emitted.  If the task deletes itself automatically,
+     * it does so once the block of output being searched has been finished with.
+     */
+    void cancel();
+
+signals:
+    /** Emitted as the search goes on with the percentage of the output searched so far */
+    void progress(int percent);
+
+private slots:
+    void blockSearched();
+
 private:
     typedef QPointer<ScreenWindow> ScreenWindowPtr;
 
-    void executeOnScreenWindow( SessionPtr session , ScreenWindowPtr window );
+    // starts searching the next of the windows or, after the last one,
+    // finishes the task
+    void searchNextWindow();
+    // decodes the next block of lines of the current window's output and
+    // starts searching it
+    void searchNextBlock();
+    // reports that the current window does not contain a match and moves
+    // on to the next one
+    void searchFailed();
     void highlightResult( ScreenWindowPtr window , int position);
 
-    QMap< SessionPtr , ScreenWindowPtr > _windows;
+    QList< QPair<SessionPtr,ScreenWindowPtr> > _windows;
     QRegExp _regExp;
     SearchDirection _direction;
 
-    //static QPointer<SearchHistoryThread> _thread;
+    // the search of the current window, see searchNextBlock()
+    SessionPtr _session;
+    ScreenWindowPtr _window;
+    int _startLine;
+    int _lastLine;
+    int _line;
+    int _endLine;
+    int _delta;
+    bool _hasWrapped;
+    int _linesSearched;
+    QString _indexText;
+
+    // the block being searched, the position in the decoded text where
+    // each line starts and the number of the line
+    QList<int> _linePositions;
+    QList<int> _lineNumbers;
+    QFutureWatcher<int>* _searcher;
+
+    bool _cancelled;
 };
 
 }
@@ -46,6 +46,7 @@
 #include "ColorScheme.h"
 #include "Session.h"
 #include "History.h"
+#include "HistoryMemoryGovernor.h"
 
 using namespace Konsole;
 
@@ -88,6 +89,10 @@ SessionManager::SessionManager()
     const KConfigGroup group = konsoleConfig->group( "Desktop Entry" );
     QString defaultSessionFilename = group.readEntry("DefaultProfile","Shell.profile");
 
+    // limit on the memory used by the history of all sessions, in megabytes
+    _historyMemoryGovernor = new HistoryMemoryGovernor(this);
+    _historyMemoryGovernor->setBudget(group.readEntry("HistoryMemoryBudget",0) * (qint64)1024 * 1024);
+
     QString path = KStandardDirs::locate("data","konsole/"+defaultSessionFilename);
     if (!path.isEmpty())
     {
@@ -351,6 +356,7 @@ Session* SessionManager::createSession(Profile::Ptr profile)
     //add session to active list
     _sessions << session;
     _sessionProfiles.insert(session,profile);
+    _historyMemoryGovernor->addSession(session);
 
     Q_ASSERT( session );
 
@@ -513,7 +519,8 @@ void SessionManager::applyProfile(Session* session, const Profile::Ptr profile ,
                                     profile->property<QString>(Profile::RemoteTabTitleFormat));
 
     // History
-    if ( apply.shouldApply(Profile::HistoryMode) || apply.shouldApply(Profile::HistorySize) ) 
+    if ( apply.shouldApply(Profile::HistoryMode) || apply.shouldApply(Profile::HistorySize) ||
+         apply.shouldApply(Profile::HistoryJournalDirectory) )
     {
         int mode = profile->property<int>(Profile::HistoryMode);
         switch ((Profile::HistoryModeEnum)mode)
@@ -532,9 +539,31 @@ void SessionManager::applyProfile(Session* session, const Profile::Ptr profile ,
             case Profile::UnlimitedHistory:
                 session->setHistoryType( HistoryTypeFile() );
                 break;
+
+            case Profile::PersistentHistory:
+                {
+                    QString directory = profile->property<QString>(Profile::HistoryJournalDirectory);
+                    if ( directory.isEmpty() )
+                        directory = KGlobal::dirs()->saveLocation("data","konsole/history/");
+                    session->setPersistentHistory(directory);
+                }
+                break;
+
+            case Profile::RingBufferHistory:
+                {
+                    int lines = profile->property<int>(Profile::HistorySize);
+                    session->setHistoryType( HistoryTypeBlockArray(lines) );
+                }
+                break;
         }
     }
 
+    if ( apply.shouldApply(Profile::HistorySearchIndexSize) )
+    {
+        const int megabytes = profile->property<int>(Profile::HistorySearchIndexSize);
+        session->setHistorySearchIndexLimit( megabytes * (qint64)1024 * 1024 );
+    }
+
     // Terminal features
     if ( apply.shouldApply(Profile::FlowControlEnabled) )
         session->setFlowControlEnabled( profile->property<bool>(Profile::FlowControlEnabled) );
@@ -826,6 +855,11 @@ QKeySequence SessionManager::shortcut(Profile::Ptr profile) const
     return QKeySequence();
 }
 
+HistoryMemoryGovernor* SessionManager::historyMemoryGovernor() const
+{
+    return _historyMemoryGovernor;
+}
+
 void SessionManager::saveSessions(KConfig* config)
 {
     // The session IDs can't be restored.
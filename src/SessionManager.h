@@ -44,6 +44,7 @@ class QSignalMapper;
 namespace Konsole
 {
 
+class HistoryMemoryGovernor;
 class Session;
 
 /**
@@ -250,6 +251,12 @@ public:
      */
     static SessionManager* instance();
 
+    /**
+     * Returns the governor which limits the memory used by the
+     * history stores of all sessions.
+     */
+    HistoryMemoryGovernor* historyMemoryGovernor() const;
+
     // session management
     void saveSessions(KConfig* config);
     int  getRestoreId(Session* session);
@@ -356,6 +363,7 @@ private:
     bool _loadedAllProfiles; // set to true after loadAllProfiles has been called
     bool _loadedFavorites; // set to true after loadFavorites has been called
     QSignalMapper* _sessionMapper;
+    HistoryMemoryGovernor* _historyMemoryGovernor;
 };
 
 /** Utility class to simplify code in SessionManager::applyProfile(). */
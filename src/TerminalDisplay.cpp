@@ -57,12 +57,12 @@
 #include <KLocalizedString>
 
 // Konsole
+#include "DamageAccumulator.h"
 #include "Filter.h"
 #include "konsole_wcwidth.h"
 #include "TerminalCharacterDecoder.h"
 #include "Screen.h"
 #include "ScreenWindow.h"
-#include "LineFont.h"
 #include "SessionController.h"
 
 using namespace Konsole;
@@ -102,6 +102,10 @@ bool TerminalDisplay::HAVE_TRANSPARENCY = false;
 // more information can be found in: http://unicode.org/reports/tr9/ 
 const QChar LTR_OVERRIDE_CHAR( 0x202D );
 
+// unless its size is set, the line image cache holds the images of the
+// lines of this many screens
+const int LINE_IMAGE_CACHE_SCREENS = 2;
+
 /* ------------------------------------------------------------------------- */
 /*                                                                           */
 /*                                Colors                                     */
@@ -134,6 +138,7 @@ void TerminalDisplay::setScreenWindow(ScreenWindow* window)
     {
         connect( _screenWindow , SIGNAL(outputChanged()) , this , SLOT(updateLineProperties()) );
         connect( _screenWindow , SIGNAL(outputChanged()) , this , SLOT(updateImage()) );
+        connect( _screenWindow , SIGNAL(cursorMoved()) , this , SLOT(updateCursor()) );
         _screenWindow->setWindowLines(_lines);
     }
 }
@@ -145,6 +150,8 @@ const ColorEntry* TerminalDisplay::colorTable() const
 void TerminalDisplay::setBackgroundColor(const QColor& color)
 {
     _colorTable[DEFAULT_BACK_COLOR].color = color;
+    _paletteCache.setColorTable(_colorTable);
+    clearLineImageCache();
 
     QPalette p = palette();
     p.setColor( backgroundRole(), color );
@@ -158,6 +165,8 @@ void TerminalDisplay::setBackgroundColor(const QColor& color)
 void TerminalDisplay::setForegroundColor(const QColor& color)
 {
     _colorTable[DEFAULT_FORE_COLOR].color = color;
+    _paletteCache.setColorTable(_colorTable);
+    clearLineImageCache();
 
     update();
 }
@@ -211,6 +220,10 @@ void TerminalDisplay::fontChange(const QFont&)
 
   _fontAscent = fm.ascent();
 
+  _glyphCache.setCellSize(_fontWidth, _fontHeight);
+  _subpixelText = GlyphCache::usesSubpixelAntialiasing(font());
+  clearLineImageCache();
+
   emit changedFontMetricSignal( _fontHeight, _fontWidth );
   propagateSize();
   update();
@@ -302,6 +315,7 @@ TerminalDisplay::TerminalDisplay(QWidget* parent)
 ,_textBlinking(false)
 ,_cursorBlinking(false)
 ,_hasTextBlinker(false)
+,_cursorCell(-1,-1)
 ,_underlineLinks(true)
 ,_isFixedSize(false)
 ,_ctrlDrag(true)
@@ -314,10 +328,14 @@ TerminalDisplay::TerminalDisplay(QWidget* parent)
 ,_lineSpacing(0)
 ,_colorsInverted(false)
 ,_blendColor(qRgba(0,0,0,0xff))
+,_textLayerScrolled(false)
 ,_filterChain(new TerminalImageFilterChain())
 ,_cursorShape(BlockCursor)
 ,_antialiasText(true)
 ,_sessionController(0)
+,_lineImageCache(0)
+,_lineImageCacheSize(-1)
+,_drawingLineImage(false)
 {
   // terminal applications are not designed with Right-To-Left in mind,
   // so the layout is forced to Left-To-Right
@@ -387,138 +405,26 @@ TerminalDisplay::~TerminalDisplay()
 /*                                                                           */
 /* ------------------------------------------------------------------------- */
 
-/**
- A table for emulating the simple (single width) unicode drawing chars.
- It represents the 250x - 257x glyphs. If it's zero, we can't use it.
- if it's not, it's encoded as follows: imagine a 5x5 grid where the points are numbered
- 0 to 24 left to top, top to bottom. Each point is represented by the corresponding bit.
-
- Then, the pixels basically have the following interpretation:
- _|||_
- -...-
- -...-
- -...-
- _|||_
-
-where _ = none
-      | = vertical line.
-      - = horizontal line.
- */
-
-
-enum LineEncode
-{
-    TopL  = (1<<1),
-    TopC  = (1<<2),
-    TopR  = (1<<3),
-
-    LeftT = (1<<5),
-    Int11 = (1<<6),
-    Int12 = (1<<7),
-    Int13 = (1<<8),
-    RightT = (1<<9),
-
-    LeftC = (1<<10),
-    Int21 = (1<<11),
-    Int22 = (1<<12),
-    Int23 = (1<<13),
-    RightC = (1<<14),
-
-    LeftB = (1<<15),
-    Int31 = (1<<16),
-    Int32 = (1<<17),
-    Int33 = (1<<18),
-    RightB = (1<<19),
-
-    BotL  = (1<<21),
-    BotC  = (1<<22),
-    BotR  = (1<<23)
-};
-
-
-static void drawLineChar(QPainter& paint, int x, int y, int w, int h, uchar code)
-{
-    //Calculate cell midpoints, end points.
-    int cx = x + w/2;
-    int cy = y + h/2;
-    int ex = x + w - 1;
-    int ey = y + h - 1;
-
-    quint32 toDraw = LineChars[code];
-
-    //Top _lines:
-    if (toDraw & TopL)
-        paint.drawLine(cx-1, y, cx-1, cy-2);
-    if (toDraw & TopC)
-        paint.drawLine(cx, y, cx, cy-2);
-    if (toDraw & TopR)
-        paint.drawLine(cx+1, y, cx+1, cy-2);
-
-    //Bot _lines:
-    if (toDraw & BotL)
-        paint.drawLine(cx-1, cy+2, cx-1, ey);
-    if (toDraw & BotC)
-        paint.drawLine(cx, cy+2, cx, ey);
-    if (toDraw & BotR)
-        paint.drawLine(cx+1, cy+2, cx+1, ey);
-
-    //Left _lines:
-    if (toDraw & LeftT)
-        paint.drawLine(x, cy-1, cx-2, cy-1);
-    if (toDraw & LeftC)
-        paint.drawLine(x, cy, cx-2, cy);
-    if (toDraw & LeftB)
-        paint.drawLine(x, cy+1, cx-2, cy+1);
-
-    //Right _lines:
-    if (toDraw & RightT)
-        paint.drawLine(cx+2, cy-1, ex, cy-1);
-    if (toDraw & RightC)
-        paint.drawLine(cx+2, cy, ex, cy);
-    if (toDraw & RightB)
-        paint.drawLine(cx+2, cy+1, ex, cy+1);
-
-    //Intersection points.
-    if (toDraw & Int11)
-        paint.drawPoint(cx-1, cy-1);
-    if (toDraw & Int12)
-        paint.drawPoint(cx, cy-1);
-    if (toDraw & Int13)
-        paint.drawPoint(cx+1, cy-1);
-
-    if (toDraw & Int21)
-        paint.drawPoint(cx-1, cy);
-    if (toDraw & Int22)
-        paint.drawPoint(cx, cy);
-    if (toDraw & Int23)
-        paint.drawPoint(cx+1, cy);
-
-    if (toDraw & Int31)
-        paint.drawPoint(cx-1, cy+1);
-    if (toDraw & Int32)
-        paint.drawPoint(cx, cy+1);
-    if (toDraw & Int33)
-        paint.drawPoint(cx+1, cy+1);
-
-}
-
 void TerminalDisplay::drawLineCharString(QPainter& painter, int x, int y, const QString& str,
                                          const Character* attributes)
 {
-    const QPen& originalPen = painter.pen();
+    const QPen originalPen = painter.pen();
+    QPen pen(originalPen);
 
     if ( (attributes->rendition & RE_BOLD) && _boldIntense )
     {
-        QPen boldPen(originalPen);
-        boldPen.setWidth(3);
-        painter.setPen( boldPen );
+        pen.setWidth(3);
+        painter.setPen( pen );
     }
 
+    const bool useCache = canUseGlyphCache(painter);
     for (int i=0 ; i < str.length(); i++)
     {
         uchar code = str[i].cell();
-        if (LineChars[code])
-            drawLineChar(painter, x + (_fontWidth*i), y, _fontWidth, _fontHeight, code);
+        if ( useCache )
+            _glyphCache.drawLineGlyph(painter, QPoint(x + (_fontWidth*i), y), code, pen);
+        else
+            GlyphCache::drawLineChar(painter, x + (_fontWidth*i), y, _fontWidth, _fontHeight, code);
     }
 
     painter.setPen( originalPen );
@@ -570,6 +476,10 @@ void TerminalDisplay::setOpacity(qreal opacity)
 void TerminalDisplay::setWallpaper(ColorSchemeWallpaper::Ptr p)
 {
     _wallpaper = p;
+
+    if ( !useTextLayer() )
+        _textLayer = QPixmap();
+    _validTextLayer = QRegion();
 }
 
 void TerminalDisplay::drawBackground(QPainter& painter, const QRect& rect, const QColor& backgroundColor, bool useOpacitySetting )
@@ -662,6 +572,30 @@ void TerminalDisplay::drawCursor(QPainter& painter,
                          cursorRect.bottom());
 }
 
+bool TerminalDisplay::canUseGlyphCache(QPainter& painter) const
+{
+    // glyphs are drawn from the cache onto the screen, when the painter
+    // is not scaled (double width or double height lines).  The cache only
+    // holds grayscale antialiased glyphs.
+    if ( _subpixelText || painter.device()->devType() == QInternal::Printer )
+        return false;
+
+    return painter.worldTransform().type() <= QTransform::TxTranslate;
+}
+
+bool TerminalDisplay::canUseGlyphCache(QPainter& painter,
+                                       const QRect& rect,
+                                       const QString& text) const
+{
+    // glyphs are cached for single-width characters of a fixed-pitch font
+    // in left-to-right text, drawn without reordering
+    if ( !_fixedFont || _bidiEnabled || !canUseGlyphCache(painter) )
+        return false;
+
+    // sequences of characters in a single cell are laid out as usual
+    return text.length() * _fontWidth == rect.width();
+}
+
 void TerminalDisplay::drawCharacters(QPainter& painter,
                                      const QRect& rect,
                                      const QString& text,
@@ -692,19 +626,35 @@ void TerminalDisplay::drawCharacters(QPainter& painter,
 
     // setup pen
     const CharacterColor& textColor = ( invertCharacterColor ? style->backgroundColor : style->foregroundColor );
-    const QColor color = textColor.color(_colorTable);
-    QPen pen = painter.pen();
-    if ( pen.color() != color )
-    {
-        pen.setColor(color);
-        painter.setPen(color);
-    }
+    const QColor color = _paletteCache.color(textColor);
+    if ( painter.pen().color() != color )
+        painter.setPen(_paletteCache.pen(textColor));
 
     // draw text
     if ( isLineCharString(text) )
     {
         drawLineCharString(painter,rect.x(),rect.y(),text,style);
     }
+    else if ( canUseGlyphCache(painter,rect,text) )
+    {
+        // each character fills exactly one cell, so the text can be drawn
+        // as a series of pre-rendered glyphs without laying it out
+        for (int i = 0; i < text.length(); i++)
+        {
+            const QChar character = text.at(i);
+            if ( character.isSpace() && !useUnderline )
+                continue;
+
+            const QPoint pos(rect.x() + i*_fontWidth, rect.y());
+            if ( !_glyphCache.drawGlyph(painter, pos, character, font, color) )
+            {
+                // glyphs which extend beyond their cell are drawn as usual
+                painter.setLayoutDirection(Qt::LeftToRight);
+                painter.drawText(QRect(pos, QSize(_fontWidth, rect.height())),
+                                 Qt::AlignBottom, QString(character));
+            }
+        }
+    }
     else
     {
         // Force using LTR as the document layout for the terminal area, because
@@ -738,27 +688,21 @@ void TerminalDisplay::drawCharacters(QPainter& painter,
 void TerminalDisplay::drawTextFragment(QPainter& painter , 
                                        const QRect& rect,
                                        const QString& text, 
-                                       const Character* style)
+                                       const Character* style,
+                                       bool withBackground)
 {
     painter.save();
 
     // setup painter 
-    const QColor foregroundColor = style->foregroundColor.color(_colorTable);
-    const QColor backgroundColor = style->backgroundColor.color(_colorTable);
+    const QColor backgroundColor = _paletteCache.color(style->backgroundColor);
 
     // draw background if different from the display's background color
-    if ( backgroundColor != palette().background().color() )
+    if ( withBackground && backgroundColor != palette().background().color() )
         drawBackground(painter,rect,backgroundColor,
                        false /* do not use transparency */);
 
-    // draw cursor shape if the current character is the cursor
-    // this may alter the foreground and background colors
-    bool invertCharacterColor = false;
-    if ( style->rendition & RE_CURSOR )
-        drawCursor(painter,rect,foregroundColor,backgroundColor,invertCharacterColor);
-
-    // draw text
-    drawCharacters(painter,rect,text,style,invertCharacterColor);
+    // draw text, the cursor is drawn over it by drawCursorOverlay()
+    drawCharacters(painter,rect,text,style,false);
 
     painter.restore();
 }
@@ -836,6 +780,22 @@ void TerminalDisplay::scrollImage(int lines , const QRect& screenWindowRegion)
     Q_ASSERT( linesToMove > 0 );
     Q_ASSERT( bytesToMove > 0 );
 
+    // the runs of the lines which are moved move with them, only the lines
+    // which are exposed need their runs computed again
+    const int firstLine = region.top();
+    if ( lines > 0 )
+    {
+        for (int y = 0; y < linesToMove; y++)
+            _renderSpans[firstLine + y] = _renderSpans[firstLine + lines + y];
+        clearRenderSpans( firstLine + linesToMove , firstLine + region.height() - 1 );
+    }
+    else
+    {
+        for (int y = linesToMove - 1; y >= 0; y--)
+            _renderSpans[firstLine - lines + y] = _renderSpans[firstLine + y];
+        clearRenderSpans( firstLine , firstLine - lines - 1 );
+    }
+
     //scroll internal image
     if ( lines > 0 )
     {
@@ -867,8 +827,34 @@ void TerminalDisplay::scrollImage(int lines , const QRect& screenWindowRegion)
 
     Q_ASSERT(scrollRect.isValid() && !scrollRect.isEmpty());
 
-    //scroll the display vertically to match internal _image
-    scroll( 0 , _fontHeight * (-lines) , scrollRect );
+    if ( useTextLayer() )
+    {
+        // scroll the text layer and composite it over the wallpaper again,
+        // only the newly exposed lines need to be drawn
+        if ( _textLayer.size() == size() )
+        {
+            const int dy = _fontHeight * (-lines);
+            _textLayer.scroll( 0 , dy , scrollRect );
+            _validTextLayer = ((_validTextLayer & scrollRect).translated(0,dy) & scrollRect) |
+                              (_validTextLayer - scrollRect);
+            _textLayerScrolled = true;
+        }
+        update( scrollRect );
+    }
+    else
+    {
+        //scroll the display vertically to match internal _image
+        scroll( 0 , _fontHeight * (-lines) , scrollRect );
+
+        // the cursor is drawn over the image and has been moved along with
+        // it, repaint the cell it was moved to and the cell where it belongs
+        const QRect cursorRect = cursorCellRect(_cursorCell);
+        if ( cursorRect.intersects(scrollRect) )
+        {
+            update( cursorRect );
+            update( cursorRect.translated(0 , _fontHeight * (-lines)) );
+        }
+    }
 }
 
 QRegion TerminalDisplay::hotSpotRegion() const 
@@ -922,7 +908,6 @@ void TerminalDisplay::processFilters()
                             _screenWindow->windowLines(),
                             _screenWindow->windowColumns(),
                             _screenWindow->getLineProperties() );
-    _filterChain->process();
 
     QRegion postUpdateHotSpots = hotSpotRegion();
 
@@ -937,12 +922,9 @@ void TerminalDisplay::updateImage()
   // optimization - scroll the existing image where possible and 
   // avoid expensive text drawing for parts of the image that 
   // can simply be moved up or down
-  if (_wallpaper->isNull())
-  {
-      scrollImage( _screenWindow->scrollCount() ,
-		   _screenWindow->scrollRegion() );
-      _screenWindow->resetScrollCount();
-  }
+  scrollImage( _screenWindow->scrollCount() ,
+               _screenWindow->scrollRegion() );
+  _screenWindow->resetScrollCount();
 
   if (!_image) {
      // Create _image.
@@ -959,20 +941,18 @@ void TerminalDisplay::updateImage()
   Q_ASSERT( this->_usedLines <= this->_lines );
   Q_ASSERT( this->_usedColumns <= this->_columns );
 
-  int y,x,len;
+  int y,x;
 
   QPoint tL  = contentsRect().topLeft();
   int    tLx = tL.x();
   int    tLy = tL.y();
-  _hasTextBlinker = false;
-
-  CharacterColor cf;       // undefined
+  QRegion blinkingTextRegion;
 
   const int linesToUpdate = qMin(this->_lines, qMax(0,lines  ));
   const int columnsToUpdate = qMin(this->_columns,qMax(0,columns));
 
-  char* dirtyMask = new char[columnsToUpdate+2];
-  QRegion dirtyRegion;
+  DamageAccumulator damage;
+  QVector<ColumnRange> changedColumns;
 
   // debugging variable, this records the number of lines that are found to
   // be 'dirty' ( ie. have changed from the old _image to the new _image ) and
@@ -986,67 +966,25 @@ void TerminalDisplay::updateImage()
 
     bool updateLine = false;
 
-    // The dirty mask indicates which characters need repainting. We also
-    // mark surrounding neighbours dirty, in case the character exceeds
-    // its cell boundaries
-    memset(dirtyMask, 0, columnsToUpdate+2);
+    changedColumns.clear();
+    findChangedColumns(currentLine, newLine, columnsToUpdate, changedColumns);
+    const bool lineChanged = !changedColumns.isEmpty();
 
+    bool lineHasBlinker = false;
     for( x = 0 ; x < columnsToUpdate ; ++x)
-    {
-        if ( newLine[x] != currentLine[x] ) 
-        {
-            dirtyMask[x] = true;
-        }
-    }
-
-    if (!_resizing) // not while _resizing, we're expecting a paintEvent
-    for (x = 0; x < columnsToUpdate; ++x)
-    {
-      _hasTextBlinker |= (newLine[x].rendition & RE_BLINK);
-
-      // Start drawing if this character or the next one differs.
-      // We also take the next one into account to handle the situation
-      // where characters exceed their cell width.
-      if (dirtyMask[x])
-      {
-        if (!newLine[x+0].character)
-            continue;
-        const bool lineDraw = newLine[x+0].isLineChar();
-        const bool doubleWidth = (x+1 == columnsToUpdate) ? false : (newLine[x+1].character == 0);
-        const quint8 cr = newLine[x].rendition;
-        const CharacterColor clipboard = newLine[x].backgroundColor;
-        if (newLine[x].foregroundColor != cf) cf = newLine[x].foregroundColor;
-        int lln = columnsToUpdate - x;
-        for (len = 1; len < lln; ++len)
-        {
-            const Character& ch = newLine[x+len];
-
-            if (!ch.character)
-                continue; // Skip trailing part of multi-col chars.
-
-            bool nextIsDoubleWidth = (x+len+1 == columnsToUpdate) ? false : (newLine[x+len+1].character == 0);
-
-            if (  ch.foregroundColor != cf || 
-                  ch.backgroundColor != clipboard || 
-                  (ch.rendition & ~RE_EXTENDED_CHAR) != (cr & ~RE_EXTENDED_CHAR) ||
-                  !dirtyMask[x+len] || 
-                  ch.isLineChar() != lineDraw || 
-                  nextIsDoubleWidth != doubleWidth )
-            break;
-        }
-
-        bool saveFixedFont = _fixedFont;
-        if (lineDraw)
-           _fixedFont = false;
-        if (doubleWidth)
-           _fixedFont = false;
+        lineHasBlinker |= (newLine[x].rendition & RE_BLINK);
 
-        updateLine = true;
-
-        _fixedFont = saveFixedFont;
-        x += len - 1;
-      }
+    if ( lineChanged )
+        _renderSpans[y].clear();
+    _changedLines[y] = lineChanged;
 
+    // blinking text is repainted separately by blinkTextEvent()
+    if ( lineHasBlinker )
+    {
+        blinkingTextRegion |= QRect( _leftMargin+tLx ,
+                                     _topMargin+tLy+_fontHeight*y ,
+                                     _fontWidth * columnsToUpdate ,
+                                     _fontHeight );
     }
 
     //both the top and bottom halves of double height _lines must always be redrawn
@@ -1054,7 +992,12 @@ void TerminalDisplay::updateImage()
     //the top one is actually 
     //drawn.
     if (_lineProperties.count() > y)
-        updateLine |= (_lineProperties[y] & LINE_DOUBLEHEIGHT);
+        updateLine = (_lineProperties[y] & LINE_DOUBLEHEIGHT);
+
+    // double width lines are scaled when drawn, so the columns of the image
+    // do not match the columns on screen and the whole line is repainted
+    if (lineChanged && !_resizing && _lineProperties.count() > y)
+        updateLine |= (_lineProperties[y] & LINE_DOUBLEWIDTH);
 
     // if the characters on the line are different in the old and the new _image
     // then this line must be repainted.    
@@ -1062,14 +1005,19 @@ void TerminalDisplay::updateImage()
     {
         dirtyLineCount++;
 
-        // add the area occupied by this line to the region which needs to be
+        // add the area occupied by this line to the area which needs to be
         // repainted
-        QRect dirtyRect = QRect( _leftMargin+tLx , 
-                                 _topMargin+tLy+_fontHeight*y , 
-                                 _fontWidth * columnsToUpdate , 
-                                 _fontHeight );     
+        damage.addLine( y , 0 , columnsToUpdate );
+    }
+    else if (lineChanged && !_resizing) // not while _resizing, we're expecting a paintEvent
+    {
+        dirtyLineCount++;
 
-        dirtyRegion |= dirtyRect;
+        // only the columns between the first and last changed ones are
+        // repainted.  We also include the neighbouring characters, in case
+        // a character exceeds its cell boundaries
+        damage.addLine( y , qMax(0, changedColumns.first().first - 1) ,
+                        qMin(columnsToUpdate, changedColumns.last().second + 1) );
     }
 
     // replace the line of characters in the old _image with the 
@@ -1077,6 +1025,11 @@ void TerminalDisplay::updateImage()
     memcpy((void*)currentLine,(const void*)newLine,columnsToUpdate*sizeof(Character));
   }
 
+  // adjacent changed lines are merged into bands, which keeps the region
+  // simple when a lot of output arrives at once
+  QRegion dirtyRegion = damage.region( QPoint(_leftMargin+tLx, _topMargin+tLy) ,
+                                       _fontWidth , _fontHeight );
+
   // if the new _image is smaller than the previous _image, then ensure that the area
   // outside the new _image is cleared 
   if ( linesToUpdate < _usedLines )
@@ -1088,6 +1041,10 @@ void TerminalDisplay::updateImage()
   }
   _usedLines = linesToUpdate;
 
+  // the runs of each line extend to the last used column
+  if ( columnsToUpdate != _usedColumns )
+      clearRenderSpans(0, _lines-1);
+
   if ( columnsToUpdate < _usedColumns )
   {
     dirtyRegion |= QRect(   _leftMargin+tLx+columnsToUpdate*_fontWidth , 
@@ -1099,15 +1056,49 @@ void TerminalDisplay::updateImage()
 
   dirtyRegion |= _inputMethodData.previousPreeditRect;
 
+  // the cursor is not part of the image, so the cells which it moved from
+  // and to are repainted separately
+  const QPoint cursorCell = _screenWindow->cursorWindowPosition();
+  if ( cursorCell != _cursorCell )
+  {
+      dirtyRegion |= cursorCellRect(_cursorCell);
+      _cursorCell = cursorCell;
+      dirtyRegion |= cursorCellRect(_cursorCell);
+  }
+
+  _blinkingTextRegion = blinkingTextRegion;
+  _hasTextBlinker = !_blinkingTextRegion.isEmpty();
+
+  // the text layer must be drawn again where the text has changed
+  _validTextLayer -= dirtyRegion;
+
   // update the parts of the display which have changed
   update(dirtyRegion);
 
   if ( _hasTextBlinker && !_blinkTextTimer->isActive()) _blinkTextTimer->start( TEXT_BLINK_DELAY ); 
   if (!_hasTextBlinker && _blinkTextTimer->isActive()) { _blinkTextTimer->stop(); _textBlinking = false; }
-  delete[] dirtyMask;
 
 }
 
+void TerminalDisplay::updateCursor()
+{
+  if ( !_screenWindow )
+      return;
+
+  const QPoint cursorCell = _screenWindow->cursorWindowPosition();
+  if ( cursorCell == _cursorCell )
+      return;
+
+  // the text has not changed, so the text layer stays valid and only the
+  // cells under the old and new cursor positions are repainted
+  QRegion dirtyRegion = _inputMethodData.previousPreeditRect;
+  dirtyRegion |= cursorCellRect(_cursorCell);
+  _cursorCell = cursorCell;
+  dirtyRegion |= cursorCellRect(_cursorCell);
+
+  update(dirtyRegion);
+}
+
 void TerminalDisplay::showResizeNotification()
 {
     static bool resizeForTheFirstTime = true;
@@ -1203,14 +1194,145 @@ void TerminalDisplay::paintEvent( QPaintEvent* pe )
 {
   QPainter paint(this);
 
-  foreach (const QRect& rect, (pe->region() & contentsRect()).rects())
+  if ( useTextLayer() )
+  {
+    paintTextLayer(paint, pe->region() & contentsRect());
+  }
+  else
   {
-    drawBackground(paint,rect,palette().background().color(),
-                    true /* use opacity setting */);
-    drawContents(paint, rect);
+    foreach (const QRect& rect, (pe->region() & contentsRect()).rects())
+    {
+      drawBackground(paint,rect,palette().background().color(),
+                      true /* use opacity setting */);
+      drawContents(paint, rect);
+    }
   }
+  drawCursorOverlay(paint);
   drawInputMethodPreeditString(paint,preeditRect());
-  paintFilters(paint);
+  paintFilters(paint, pe->rect());
+}
+
+QRect TerminalDisplay::cursorCellRect(const QPoint& cell) const
+{
+    if ( !_image || cell.x() < 0 || cell.y() < 0 ||
+         cell.x() >= _usedColumns || cell.y() >= _usedLines )
+        return QRect();
+
+    // the cursor covers both cells of a double width character
+    const int width = ( cell.x()+1 < _usedColumns && _image[loc(cell.x()+1,cell.y())].character == 0 ) ? 2 : 1;
+    const bool doubleWidthLine = cell.y() < _lineProperties.size() &&
+                                 (_lineProperties[cell.y()] & LINE_DOUBLEWIDTH);
+    const int scale = doubleWidthLine ? 2 : 1;
+
+    return QRect( contentsRect().left() + _leftMargin + _fontWidth*cell.x()*scale ,
+                  contentsRect().top() + _topMargin + _fontHeight*cell.y() ,
+                  _fontWidth*width*scale ,
+                  _fontHeight );
+}
+
+void TerminalDisplay::drawCursorOverlay(QPainter& painter)
+{
+    const QRect cursorRect = cursorCellRect(_cursorCell);
+    if ( cursorRect.isNull() || _cursorBlinking )
+        return;
+
+    const int x = _cursorCell.x();
+    const int y = _cursorCell.y();
+    const Character* style = &_image[loc(x,y)];
+
+    painter.save();
+
+    // the cursor is drawn using the same scaling as the text of double
+    // width and double height lines
+    QMatrix textScale;
+    if ( y < _lineProperties.size() )
+    {
+        if ( _lineProperties[y] & LINE_DOUBLEWIDTH )
+            textScale.scale(2,1);
+        if ( _lineProperties[y] & LINE_DOUBLEHEIGHT )
+            textScale.scale(1,2);
+    }
+    painter.setWorldMatrix(textScale, true);
+
+    QRect rect( textScale.inverted().map(cursorRect.topLeft()) ,
+                QSize(cursorRect.width() / (textScale.m11() > 1 ? 2 : 1) , _fontHeight) );
+
+    const QColor foregroundColor = _paletteCache.color(style->foregroundColor);
+    const QColor backgroundColor = _paletteCache.color(style->backgroundColor);
+    bool invertCharacterColor = false;
+    drawCursor(painter,rect,foregroundColor,backgroundColor,invertCharacterColor);
+
+    // the character under a filled cursor is drawn again on top of it
+    if ( invertCharacterColor )
+    {
+        QString text;
+        if ( style->rendition & RE_EXTENDED_CHAR )
+        {
+            ushort extendedCharLength = 0;
+            const ushort* chars = ExtendedCharTable::instance.lookupExtendedChar(style->character, extendedCharLength);
+            if ( chars )
+                text = QString::fromUtf16(chars, extendedCharLength);
+        }
+        else if ( style->character )
+        {
+            text = QChar(style->character);
+        }
+
+        if ( !text.isEmpty() )
+        {
+            const bool saveFixedFont = _fixedFont;
+            if ( rect.width() > _fontWidth || style->isLineChar() )
+                _fixedFont = false;
+            drawCharacters(painter,rect,text,style,invertCharacterColor);
+            _fixedFont = saveFixedFont;
+        }
+    }
+
+    painter.restore();
+}
+
+bool TerminalDisplay::useTextLayer() const
+{
+    return !_wallpaper->isNull();
+}
+
+void TerminalDisplay::paintTextLayer(QPainter& painter, const QRegion& region)
+{
+    if ( _textLayer.size() != size() )
+    {
+        _textLayer = QPixmap(size());
+        _textLayer.fill(Qt::transparent);
+        _validTextLayer = QRegion();
+    }
+
+    // draw the text which is not already in the layer.  Unless the layer
+    // was scrolled, all of 'region' is drawn since the display may be
+    // repainted for reasons other than changes to the image.
+    const QRegion textRegion = _textLayerScrolled ? region - _validTextLayer : region;
+    if ( !textRegion.isEmpty() )
+    {
+        QPainter layerPainter(&_textLayer);
+        layerPainter.setFont(font());
+        layerPainter.setLayoutDirection(layoutDirection());
+        layerPainter.setClipRegion(textRegion);
+
+        layerPainter.setCompositionMode(QPainter::CompositionMode_Source);
+        layerPainter.fillRect(textRegion.boundingRect(), Qt::transparent);
+        layerPainter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+
+        foreach (const QRect& rect, textRegion.rects())
+            drawContents(layerPainter, rect);
+    }
+    // only the parts of the layer which were drawn are up to date
+    _validTextLayer |= textRegion;
+    _textLayerScrolled = false;
+
+    foreach (const QRect& rect, region.rects())
+    {
+        drawBackground(painter,rect,palette().background().color(),
+                        true /* use opacity setting */);
+        painter.drawPixmap(rect, _textLayer, rect);
+    }
 }
 
 QPoint TerminalDisplay::cursorPosition() const
@@ -1226,24 +1348,51 @@ FilterChain* TerminalDisplay::filterChain() const
     return _filterChain;
 }
 
-void TerminalDisplay::paintFilters(QPainter& painter)
+void TerminalDisplay::setUserFilters(const QStringList& definitions)
 {
-    // get color of character under mouse and use it to draw
-    // lines for filters
-    QPoint cursorPos = mapFromGlobal(QCursor::pos());
-    int cursorLine;
-    int cursorColumn;
-    int scrollBarWidth = (_scrollbarLocation == ScrollBarLeft) ? _scrollBar->width() : 0;
+    // profiles are applied to the display again whenever one of their
+    // properties changes
+    if ( definitions == _userFilterDefinitions )
+        return;
+
+    foreach( Filter* filter , _userFilters )
+    {
+        _filterChain->removeFilter(filter);
+        delete filter;
+    }
+    _userFilters.clear();
 
-    getCharacterPosition( cursorPos , cursorLine , cursorColumn );
-    Character cursorCharacter = _image[loc(cursorColumn,cursorLine)];
+    foreach( const UserFilter::Definition& definition , UserFilter::parseDefinitions(definitions) )
+    {
+        Filter* filter = new UserFilter(definition);
+        _filterChain->addFilter(filter);
+        _userFilters << filter;
+    }
+
+    _userFilterDefinitions = definitions;
+
+    processFilters();
+}
 
-    painter.setPen( QPen(cursorCharacter.foregroundColor.color(colorTable())) );
+void TerminalDisplay::paintFilters(QPainter& painter, const QRect& rect)
+{
+    // iterate over the hotspots identified by the display's currently active
+    // filters on the lines being painted, with a line to spare either side
+    // for the margins, and draw appropriate visuals to indicate the presence
+    // of the hotspot
+    QList<Filter::HotSpot*> spots = _filterChain->hotSpotsInLines(rect.top() / _fontHeight - 1,
+                                                                  rect.bottom() / _fontHeight + 1);
+    if ( spots.isEmpty() )
+        return;
 
-    // iterate over hotspots identified by the display's currently active filters 
-    // and draw appropriate visuals to indicate the presence of the hotspot
+    const QPoint cursorPos = mapFromGlobal(QCursor::pos());
+    int scrollBarWidth = (_scrollbarLocation == ScrollBarLeft) ? _scrollBar->width() : 0;
+    const QFontMetrics metrics(font());
+
+    // the color of the character under the mouse, which is used to draw
+    // lines for filters, is looked up when the first line is drawn
+    bool penSet = false;
 
-    QList<Filter::HotSpot*> spots = _filterChain->hotSpots();
     QListIterator<Filter::HotSpot*> iter(spots);
     while (iter.hasNext())
     {
@@ -1316,14 +1465,21 @@ void TerminalDisplay::paintFilters(QPainter& painter)
             // Underline link hotspots 
             if ( _underlineLinks && spot->type() == Filter::HotSpot::Link )
             {
-                QFontMetrics metrics(font());
-
                 // find the baseline (which is the invisible line that the characters in the font sit on,
                 // with some having tails dangling below)
                 int baseline = r.bottom() - metrics.descent();
                 // find the position of the underline below that
                 int underlinePos = baseline + metrics.underlinePos();
-                if ( region.contains( mapFromGlobal(QCursor::pos()) ) ){
+                if ( region.contains( cursorPos ) ){
+                    if ( !penSet )
+                    {
+                        int cursorLine;
+                        int cursorColumn;
+                        getCharacterPosition( cursorPos , cursorLine , cursorColumn );
+                        const Character& cursorCharacter = _image[loc(cursorColumn,cursorLine)];
+                        painter.setPen( _paletteCache.pen(cursorCharacter.foregroundColor) );
+                        penSet = true;
+                    }
                     painter.drawLine( r.left() , underlinePos , 
                                       r.right() , underlinePos );
                 }
@@ -1349,109 +1505,47 @@ void TerminalDisplay::drawContents(QPainter& paint, const QRect& rect)
   const int rlx = qMin(_usedColumns-1, qMax(0,(rect.right()  - tLx - _leftMargin ) / _fontWidth));
   const int rly = qMin(_usedLines-1,  qMax(0,(rect.bottom() - tLy - _topMargin  ) / _fontHeight));
 
-  const int numberOfColumns = _usedColumns;
-  QString unistr;
-  unistr.reserve(numberOfColumns);
+  // the lines which are not copied from the line image cache are drawn
+  // in two passes, first the backgrounds and then the text
+  QVector<int> lines;
   for (int y = luy; y <= rly; y++)
   {
-    int x = lux;
-    if(!_image[loc(lux,y)].character && x)
-      x--; // Search for start of multi-column character
-    for (; x <= rlx; x++)
-    {
-      int len = 1;
-      int p = 0;
-
-      // reset our buffer to the number of columns
-      int bufferSize = numberOfColumns;
-      unistr.resize(bufferSize);
-      QChar *disstrU = unistr.data();
-
-      // is this a single character or a sequence of characters ?
-      if ( _image[loc(x,y)].rendition & RE_EXTENDED_CHAR )
-      {
-        // sequence of characters
-        ushort extendedCharLength = 0;
-        const ushort* chars = ExtendedCharTable::instance.lookupExtendedChar(_image[loc(x,y)].character, extendedCharLength);
-        if (chars)
-        {
-          Q_ASSERT(extendedCharLength > 1);
-          bufferSize += extendedCharLength - 1;
-          unistr.resize(bufferSize);
-          disstrU = unistr.data();
-          for ( int index = 0 ; index < extendedCharLength ; index++ ) 
-          {
-            Q_ASSERT( p < bufferSize );
-            disstrU[p++] = chars[index];
-          }
-        }
-      }
-      else
-      {
-        // single character
-        const quint16 c = _image[loc(x,y)].character;
-        if (c)
-        {
-             Q_ASSERT( p < bufferSize );
-             disstrU[p++] = c; //fontMap(c);
-        }
-      }
-
-      const bool lineDraw = _image[loc(x,y)].isLineChar();
-      const bool doubleWidth = (_image[ qMin(loc(x,y)+1,_imageSize) ].character == 0);
-      const CharacterColor currentForeground = _image[loc(x,y)].foregroundColor;
-      const CharacterColor currentBackground = _image[loc(x,y)].backgroundColor;
-      const quint8 currentRendition = _image[loc(x,y)].rendition;
+    if ( drawCachedLine(paint, rect, y) )
+        continue;
+
+    lines.append(y);
+
+    //double-height _lines are represented by two adjacent _lines 
+    //containing the same characters
+    //both _lines will have the LINE_DOUBLEHEIGHT attribute.  
+    //If the current line has the LINE_DOUBLEHEIGHT attribute, 
+    //we can therefore skip the next line
+    if (y < _lineProperties.size()-1 && (_lineProperties[y] & LINE_DOUBLEHEIGHT))
+        y++;
+  }
 
-      while (x+len <= rlx &&
-             _image[loc(x+len,y)].foregroundColor == currentForeground &&
-             _image[loc(x+len,y)].backgroundColor == currentBackground &&
-             (_image[loc(x+len,y)].rendition & ~RE_EXTENDED_CHAR) == (currentRendition & ~RE_EXTENDED_CHAR) &&
-             (_image[ qMin(loc(x+len,y)+1,_imageSize) ].character == 0) == doubleWidth &&
-             _image[loc(x+len,y)].isLineChar() == lineDraw)
-      {
-        const quint16 c = _image[loc(x+len,y)].character;
-        if ( _image[loc(x+len,y)].rendition & RE_EXTENDED_CHAR )
-        {
-            // sequence of characters
-            ushort extendedCharLength = 0;
-            const ushort* chars = ExtendedCharTable::instance.lookupExtendedChar(c, extendedCharLength);
-            if (chars)
-            {
-              Q_ASSERT(extendedCharLength > 1);
-              bufferSize += extendedCharLength - 1;
-              unistr.resize(bufferSize);
-              disstrU = unistr.data();
-              for ( int index = 0 ; index < extendedCharLength ; index++ ) 
-              {
-                Q_ASSERT( p < bufferSize );
-                disstrU[p++] = chars[index];
-              }
-            }
-        }
-        else
-        {
-            // single character
-            if (c)
-            {
-                Q_ASSERT( p < bufferSize );
-                disstrU[p++] = c; //fontMap(c);
-            }
-        }
+  drawBackgrounds(paint, lines, lux, rlx);
 
-        if (doubleWidth) // assert((_image[loc(x+len,y)+1].character == 0)), see above if condition
-          len++; // Skip trailing part of multi-column character
-        len++;
-      }
-      if ((x+len < _usedColumns) && (!_image[loc(x+len,y)].character))
-        len++; // Adjust for trailing part of multi-column character
+  foreach (int y, lines)
+  {
+    // the backgrounds of scaled lines are drawn with their text
+    const bool scaledLine = y < _lineProperties.size() &&
+                            (_lineProperties[y] & (LINE_DOUBLEWIDTH | LINE_DOUBLEHEIGHT));
 
-            bool save__fixedFont = _fixedFont;
-         if (lineDraw)
+    const QVector<RenderSpan>& spans = renderSpans(y);
+    for (int i = 0; i < spans.size(); i++)
+    {
+         const RenderSpan& span = spans[i];
+         if ( span.start > rlx )
+             break;
+         if ( span.start + span.length <= lux )
+             continue;
+
+         bool save__fixedFont = _fixedFont;
+         if (span.lineDraw)
             _fixedFont = false;
-         if (doubleWidth)
+         if (span.doubleWidth)
             _fixedFont = false;
-         unistr.resize(p);
 
          // Create a text scaling matrix for double width and double height lines.
          QMatrix textScale;
@@ -1469,7 +1563,7 @@ void TerminalDisplay::drawContents(QPainter& paint, const QRect& rect)
          paint.setWorldMatrix(textScale, true);
 
          //calculate the area in which the text will be drawn
-         QRect textArea = QRect( _leftMargin+tLx+_fontWidth*x , _topMargin+tLy+_fontHeight*y , _fontWidth*len , _fontHeight);
+         QRect textArea = QRect( _leftMargin+tLx+_fontWidth*span.start , _topMargin+tLy+_fontHeight*y , _fontWidth*span.length , _fontHeight);
 
          //move the calculated area to take account of scaling applied to the painter.
          //the position of the area from the origin (0,0) is scaled 
@@ -1482,30 +1576,267 @@ void TerminalDisplay::drawContents(QPainter& paint, const QRect& rect)
          //paint text fragment
          drawTextFragment(    paint,
                             textArea,
-                            unistr, 
-                            &_image[loc(x,y)] ); //, 
-                            //0, 
-                            //!_isPrinting );
+                            span.text, 
+                            &_image[loc(span.start,y)],
+                            scaledLine );
 
          _fixedFont = save__fixedFont;
 
          //reset back to single-width, single-height _lines 
          paint.setWorldMatrix(textScale.inverted(), true);
+    }
+  }
+}
 
-         if (y < _lineProperties.size()-1)
-         {
-            //double-height _lines are represented by two adjacent _lines 
-            //containing the same characters
-            //both _lines will have the LINE_DOUBLEHEIGHT attribute.  
-            //If the current line has the LINE_DOUBLEHEIGHT attribute, 
-            //we can therefore skip the next line
-            if (_lineProperties[y] & LINE_DOUBLEHEIGHT)
-                y++;
-         }
+// an area of cells with the same background color, which is extended
+// downwards while the next line has the same run of background color
+struct BackgroundArea
+{
+    QRect cells;
+    QColor color;
+};
+
+void TerminalDisplay::drawBackgrounds(QPainter& painter, const QVector<int>& lines,
+                                      int startColumn, int endColumn)
+{
+  if ( startColumn < 0 || startColumn > endColumn )
+      return;
+
+  const QPoint tL = contentsRect().topLeft();
+  const QColor defaultBackground = palette().background().color();
+
+  QVector<BackgroundArea> openAreas;
+  QVector<BackgroundArea> lineAreas;
+
+  for (int i = 0; i <= lines.size(); i++)
+  {
+    lineAreas.clear();
+
+    const int y = (i < lines.size()) ? lines[i] : -1;
+    const bool scaledLine = y >= 0 && y < _lineProperties.size() &&
+                            (_lineProperties[y] & (LINE_DOUBLEWIDTH | LINE_DOUBLEHEIGHT));
+
+    // split the line into runs of the same background color, leaving out
+    // those which have the display's background color since that has
+    // been drawn already
+    if ( y >= 0 && !scaledLine )
+    {
+      int x = startColumn;
+      while (x <= endColumn)
+      {
+        const CharacterColor& background = _image[loc(x,y)].backgroundColor;
+        int len = 1;
+        while (x+len <= endColumn && _image[loc(x+len,y)].backgroundColor == background)
+            len++;
+
+        const QColor color = _paletteCache.color(background);
+        if ( color != defaultBackground )
+        {
+            BackgroundArea area;
+            area.cells = QRect(x, y, len, 1);
+            area.color = color;
+            lineAreas.append(area);
+        }
+        x += len;
+      }
+    }
+
+    // extend the areas of the previous line which have a matching run
+    // on this line and draw the others, which cannot grow any further
+    const bool adjacent = i > 0 && y == lines[i-1] + 1;
+    int next = 0;
+    foreach (const BackgroundArea& area, openAreas)
+    {
+        while (next < lineAreas.size() && lineAreas[next].cells.left() < area.cells.left())
+            next++;
+
+        if ( adjacent && next < lineAreas.size() &&
+             lineAreas[next].cells.left() == area.cells.left() &&
+             lineAreas[next].cells.width() == area.cells.width() &&
+             lineAreas[next].color == area.color )
+        {
+            lineAreas[next].cells.setTop(area.cells.top());
+        }
+        else
+        {
+            drawBackground(painter, imageToWidget(area.cells).translated(tL),
+                           area.color, false /* do not use transparency */);
+        }
+    }
+    openAreas = lineAreas;
+  }
+}
 
-        x += len - 1;
+// appends the characters of 'cell' to 'text'
+static inline void appendCellText(QString& text, const Character& cell)
+{
+    if ( cell.rendition & RE_EXTENDED_CHAR )
+    {
+        // sequence of characters
+        ushort extendedCharLength = 0;
+        const ushort* chars = ExtendedCharTable::instance.lookupExtendedChar(cell.character, extendedCharLength);
+        if (chars)
+        {
+            Q_ASSERT(extendedCharLength > 1);
+            text.append( QString::fromUtf16(chars, extendedCharLength) );
+        }
     }
+    else if (cell.character)
+    {
+        // single character
+        text.append( QChar(cell.character) ); //fontMap(c);
+    }
+}
+
+const QVector<TerminalDisplay::RenderSpan>& TerminalDisplay::renderSpans(int y)
+{
+  QVector<RenderSpan>& spans = _renderSpans[y];
+  if ( !spans.isEmpty() || _usedColumns <= 0 )
+      return spans;
+
+  // split the line into runs of characters with the same colors, rendition
+  // and width, each of which is drawn as one text fragment
+  for (int x = 0; x < _usedColumns; x++)
+  {
+      RenderSpan span;
+      span.start = x;
+      appendCellText(span.text, _image[loc(x,y)]);
+
+      int len = 1;
+      const bool lineDraw = _image[loc(x,y)].isLineChar();
+      const bool doubleWidth = (_image[ qMin(loc(x,y)+1,_imageSize) ].character == 0);
+      const CharacterColor currentForeground = _image[loc(x,y)].foregroundColor;
+      const CharacterColor currentBackground = _image[loc(x,y)].backgroundColor;
+      const quint8 currentRendition = _image[loc(x,y)].rendition;
+
+      while (x+len < _usedColumns &&
+             _image[loc(x+len,y)].foregroundColor == currentForeground &&
+             _image[loc(x+len,y)].backgroundColor == currentBackground &&
+             (_image[loc(x+len,y)].rendition & ~RE_EXTENDED_CHAR) == (currentRendition & ~RE_EXTENDED_CHAR) &&
+             (_image[ qMin(loc(x+len,y)+1,_imageSize) ].character == 0) == doubleWidth &&
+             _image[loc(x+len,y)].isLineChar() == lineDraw)
+      {
+        appendCellText(span.text, _image[loc(x+len,y)]);
+
+        if (doubleWidth) // assert((_image[loc(x+len,y)+1].character == 0)), see above if condition
+          len++; // Skip trailing part of multi-column character
+        len++;
+      }
+      if ((x+len < _usedColumns) && (!_image[loc(x+len,y)].character))
+        len++; // Adjust for trailing part of multi-column character
+
+      span.length = len;
+      span.lineDraw = lineDraw;
+      span.doubleWidth = doubleWidth;
+      spans.append(span);
+
+      x += len - 1;
   }
+
+  return spans;
+}
+
+void TerminalDisplay::clearRenderSpans(int startLine, int endLine)
+{
+  for (int y = qMax(0,startLine); y <= endLine && y < _renderSpans.size(); y++)
+      _renderSpans[y].clear();
+}
+
+void TerminalDisplay::setLineImageCacheSize(int kilobytes)
+{
+    _lineImageCacheSize = kilobytes;
+    updateLineImageCacheSize();
+}
+
+void TerminalDisplay::updateLineImageCacheSize()
+{
+    int kilobytes = _lineImageCacheSize;
+
+    // a cache which holds fewer lines than are on the screen throws away
+    // every image before it is used again
+    if ( kilobytes < 0 )
+    {
+        const qint64 lineBytes = qint64(_columns) * _fontWidth * _fontHeight * 4;
+        kilobytes = int(LINE_IMAGE_CACHE_SCREENS * _lines * lineBytes / 1024);
+    }
+
+    _lineImageCache.setMaxCost(kilobytes);
+}
+
+void TerminalDisplay::clearLineImageCache()
+{
+    _lineImageCache.clear();
+    _validTextLayer = QRegion();
+}
+
+bool TerminalDisplay::drawCachedLine(QPainter& painter, const QRect& rect, int line)
+{
+    if ( _drawingLineImage || _lineImageCache.maxCost() == 0 )
+        return false;
+
+    const QRect lineArea = imageToWidget( QRect(0,line,_usedColumns,1) )
+                                .translated( contentsRect().topLeft() );
+
+    // when only some columns of the line are repainted, drawing them
+    // directly is cheaper than drawing the whole line
+    if ( rect.left() > lineArea.left() || rect.right() < lineArea.right() )
+        return false;
+
+    // double width and height lines are drawn using a scaled painter
+    if ( line < _lineProperties.size() &&
+         (_lineProperties[line] & (LINE_DOUBLEWIDTH | LINE_DOUBLEHEIGHT)) )
+        return false;
+
+    // lines with blinking text change without their characters changing
+    const Character* cells = &_image[loc(0,line)];
+    for (int x = 0; x < _usedColumns; x++)
+    {
+        if ( cells[x].rendition & RE_BLINK )
+            return false;
+    }
+
+    const QByteArray data = QByteArray::fromRawData( (const char*)cells, _usedColumns*sizeof(Character) );
+    const uint key = qHash(data);
+
+    LineImage* image = _lineImageCache.object(key);
+    if ( !image || image->cells.size() != _usedColumns ||
+         memcmp(image->cells.constData(), cells, _usedColumns*sizeof(Character)) != 0 )
+    {
+        // lines which are being written to would be rendered into a new
+        // image after every change, so only lines which stayed the same
+        // in the last update, such as those moved by scrolling, are cached
+        if ( line >= _changedLines.size() || _changedLines[line] )
+            return false;
+
+        // draw the line into a transparent image, the background of the
+        // display is drawn separately
+        image = new LineImage;
+        image->cells = QVector<Character>(_usedColumns);
+        memcpy(image->cells.data(), cells, _usedColumns*sizeof(Character));
+        image->pixmap = QPixmap(lineArea.size());
+        image->pixmap.fill(Qt::transparent);
+
+        QPainter imagePainter(&image->pixmap);
+        imagePainter.setFont(painter.font());
+        imagePainter.setLayoutDirection(painter.layoutDirection());
+        imagePainter.translate(-lineArea.topLeft());
+
+        _drawingLineImage = true;
+        drawContents(imagePainter, lineArea);
+        _drawingLineImage = false;
+
+        imagePainter.end();
+
+        const int cost = qMax(1, lineArea.width() * lineArea.height() * image->pixmap.depth() / 8 / 1024);
+        if ( !_lineImageCache.insert(key, image, cost) )
+        {
+            // the image is larger than the cache, it has been deleted
+            return false;
+        }
+    }
+
+    painter.drawPixmap(lineArea.topLeft(), image->pixmap);
+    return true;
 }
 
 void TerminalDisplay::blinkTextEvent()
@@ -1514,10 +1845,9 @@ void TerminalDisplay::blinkTextEvent()
         return;
 
     _textBlinking = !_textBlinking;
+    _validTextLayer -= _blinkingTextRegion;
 
-    // TODO: Optimize to only repaint the areas of the widget where there is
-    // blinking text rather than repainting the whole widget.
-    update();
+    update(_blinkingTextRegion);
 }
 
 QRect TerminalDisplay::imageToWidget(const QRect& imageArea) const
@@ -1533,8 +1863,7 @@ QRect TerminalDisplay::imageToWidget(const QRect& imageArea) const
 
 void TerminalDisplay::updateCursor()
 {
-    QRect cursorRect = imageToWidget( QRect(cursorPosition(),QSize(1,1)) ); 
-    update(cursorRect);
+    update( cursorCellRect(_cursorCell) );
 }
 
 void TerminalDisplay::blinkCursorEvent()
@@ -1570,11 +1899,14 @@ void TerminalDisplay::propagateSize()
 
 void TerminalDisplay::updateImageSize()
 {
+    clearLineImageCache();
+
     Character* oldImage = _image;
     int oldLines = _lines;
     int oldColumns = _columns;
 
     makeImage();
+    updateLineImageCacheSize();
 
     if ( oldImage )
     {
@@ -1620,6 +1952,8 @@ void TerminalDisplay::makeImage()
     // We over-commit one character so that we can be more relaxed in dealing with
     // certain boundary conditions: _image[_imageSize] is a valid but unused position
     _image = new Character[_imageSize+1];
+    _renderSpans.resize(_lines);
+    _changedLines = QVector<bool>(_lines, true);
 
     clearImage();
 }
@@ -1628,6 +1962,8 @@ void TerminalDisplay::clearImage()
 {
     for (int i = 0; i <= _imageSize; ++i)
         _image[i] = Screen::defaultChar;
+
+    clearRenderSpans(0, _lines-1);
 }
 
 void TerminalDisplay::calcGeometry()
@@ -2861,6 +3197,8 @@ void TerminalDisplay::swapColorTable()
     _colorTable[DEFAULT_BACK_COLOR]=_colorTable[DEFAULT_FORE_COLOR];
     _colorTable[DEFAULT_FORE_COLOR]= color;
     _colorsInverted = !_colorsInverted;
+    _paletteCache.setColorTable(_colorTable);
+    clearLineImageCache();
 
     update();
 }
@@ -22,6 +22,8 @@
 #define TERMINALDISPLAY_H
 
 // Qt
+#include <QtCore/QCache>
+#include <QtCore/QStringList>
 #include <QtGui/QColor>
 #include <QtCore/QPointer>
 #include <QtGui/QWidget>
@@ -31,6 +33,8 @@
 #include "konsole_export.h"
 #include "ScreenWindow.h"
 #include "ColorScheme.h"
+#include "GlyphCache.h"
+#include "PaletteCache.h"
 
 class QDrag;
 class QDragEnterEvent;
@@ -51,6 +55,7 @@ class KMenu;
 namespace Konsole
 {
 
+class Filter;
 class FilterChain;
 class TerminalImageFilterChain;
 class SessionController;
@@ -193,6 +198,14 @@ public:
      */
     bool getUnderlineLinks() const { return _underlineLinks; }
 
+    /**
+     * Sets the definitions of the filters, in the form described by
+     * UserFilter, which find hotspots in the display in addition to the
+     * links found by the session.  The display's previous user filters
+     * are removed.
+     */
+    void setUserFilters(const QStringList& definitions);
+
     void setLineSpacing(uint);
     uint lineSpacing() const;
 
@@ -375,7 +388,7 @@ public:
      * Specifies whether characters with intense colors should be rendered
      * as bold. Defaults to true.
      */
-    void setBoldIntense(bool value) { _boldIntense = value; }
+    void setBoldIntense(bool value) { _boldIntense = value; clearLineImageCache(); }
     /**
      * Returns true if characters with intense colors are rendered in bold.
      */
@@ -400,6 +413,7 @@ public:
      */
     void setBidiEnabled(bool set) {
         _bidiEnabled=set;
+        clearLineImageCache();
         // See bug 280896 for more info
 #if QT_VERSION >= 0x040800
         if (_bidiEnabled) {
@@ -414,6 +428,15 @@ public:
      */
     bool isBidiEnabled() const { return _bidiEnabled; }
 
+    /**
+     * Sets the amount of memory, in kilobytes, used to keep images of
+     * recently drawn lines, which are reused when the same lines are drawn
+     * again, for example when scrolling through the history.
+     * A size of 0 disables the cache.  A size of -1, the default, makes the
+     * cache large enough for the lines of two screens of the display.
+     */
+    void setLineImageCacheSize(int kilobytes);
+
     /**
      * Sets the terminal screen section which is displayed in this widget.
      * When updateImage() is called, the display fetches the latest character image from the
@@ -448,6 +471,11 @@ public slots:
      * associated terminal screen ( see setScreenWindow() ).
      */
     void updateLineProperties();
+    /**
+     * Repaints the cells which the cursor has moved from and to, when the
+     * character image of the associated terminal screen has not changed.
+     */
+    void updateCursor();
 
     /** Copies the selected text to the clipboard. */
     void copyToClipboard();
@@ -638,10 +666,17 @@ private:
     // fragments according to their colors and styles and calls
     // drawTextFragment() to draw the fragments
     void drawContents(QPainter& painter, const QRect& rect);
+    // draws the backgrounds of the columns from 'startColumn' to 'endColumn'
+    // of 'lines', merging adjacent cells with the same background color
+    // into as few rectangles as possible
+    void drawBackgrounds(QPainter& painter, const QVector<int>& lines,
+                         int startColumn, int endColumn);
     // draws a section of text, all the text in this section
-    // has a common color and style
+    // has a common color and style.  The background is drawn
+    // too if 'withBackground' is true
     void drawTextFragment(QPainter& painter, const QRect& rect, 
-                          const QString& text, const Character* style); 
+                          const QString& text, const Character* style,
+                          bool withBackground); 
     // draws the background for a text fragment
     // if useOpacitySetting is true then the color's alpha value will be set to
     // the display's transparency (set with setOpacity()), otherwise the background
@@ -654,6 +689,31 @@ private:
     // draws the characters or line graphics in a text fragment
     void drawCharacters(QPainter& painter, const QRect& rect,  const QString& text, 
                                            const Character* style, bool invertCharacterColor);
+    // returns the runs of characters in 'line', computing them if necessary
+    const QVector<RenderSpan>& renderSpans(int line);
+    // marks the runs of the lines from 'startLine' to 'endLine' as out of date
+    void clearRenderSpans(int startLine, int endLine);
+    // draws the cursor over the contents of the display
+    void drawCursorOverlay(QPainter& painter);
+    // returns the area of the display occupied by the cursor at 'cell'
+    QRect cursorCellRect(const QPoint& cell) const;
+    // returns true if the text is drawn into _textLayer
+    bool useTextLayer() const;
+    // draws the text layer for the parts of 'region' which are not up to date
+    // and composites it over the background
+    void paintTextLayer(QPainter& painter, const QRegion& region);
+    // draws 'line' from the line image cache when 'rect' covers the whole
+    // line, rendering it into the cache first if the line did not change in
+    // the last update.  Returns false if the line was not drawn.
+    bool drawCachedLine(QPainter& painter, const QRect& rect, int line);
+    void clearLineImageCache();
+    // sets the size of the line image cache from _lineImageCacheSize or,
+    // if that is -1, from the size of the display
+    void updateLineImageCacheSize();
+    // returns true if glyphs from _glyphCache can be drawn with 'painter'
+    bool canUseGlyphCache(QPainter& painter) const;
+    // returns true if 'text' can be drawn into 'rect' using glyphs from _glyphCache
+    bool canUseGlyphCache(QPainter& painter, const QRect& rect, const QString& text) const;
     // draws a string of line graphics
     void drawLineCharString(QPainter& painter, int x, int y, 
                             const QString& str, const Character* attributes);
@@ -690,7 +750,8 @@ private:
     void updateImageSize();
     void makeImage();
 
-    void paintFilters(QPainter& painter);
+    // draws the hotspots of the filters which are within 'rect'
+    void paintFilters(QPainter& painter, const QRect& rect);
 
     // returns a region covering all of the areas of the widget which contain
     // a hotspot
@@ -715,6 +776,8 @@ private:
     QGridLayout* _gridLayout;
 
     bool _fixedFont; // has fixed pitch
+    GlyphCache _glyphCache; // rendered glyphs of the current font
+    bool _subpixelText; // the font is drawn with subpixel antialiasing
     int  _fontHeight;     // height
     int  _fontWidth;     // width
     int  _fontAscent;     // ascend
@@ -742,7 +805,27 @@ private:
     int _imageSize;
     QVector<LineProperty> _lineProperties;
 
+    // a run of characters in a line of _image which have the same colors,
+    // rendition and width, and are drawn as one text fragment
+    struct RenderSpan
+    {
+        int start;
+        int length;   // in columns, including the trailing parts of wide characters
+        QString text;
+        bool lineDraw;
+        bool doubleWidth;
+    };
+    // the runs of each line of _image.  They are computed when a line is
+    // first drawn after it changed, an empty list means that they need
+    // to be computed.
+    QVector< QVector<RenderSpan> > _renderSpans;
+    // whether each line of _image changed in the last call to updateImage().
+    // Only unchanged lines are added to the line image cache, changed lines
+    // are repainted from the columns which changed.
+    QVector<bool> _changedLines;
+
     ColorEntry _colorTable[TABLE_COLORS];
+    PaletteCache _paletteCache; // colors, pens and brushes resolved from _colorTable
     uint _randomSeed;
 
     bool _resizing;
@@ -769,6 +852,8 @@ private:
     bool _textBlinking;   // hide text in paintEvent
     bool _cursorBlinking;     // hide cursor in paintEvent
     bool _hasTextBlinker; // has characters to blink
+    QRegion _blinkingTextRegion; // area of the lines with characters to blink
+    QPoint _cursorCell; // position of the cursor in the image, or (-1,-1)
     QTimer* _blinkTextTimer;
     QTimer* _blinkCursorTimer;
 
@@ -800,11 +885,24 @@ private:
 
     ColorSchemeWallpaper::Ptr _wallpaper;
 
+    // when a wallpaper is used, the text is drawn into a separate layer
+    // which is composited over the wallpaper, so that the text can be
+    // scrolled without moving the wallpaper.  _validTextLayer is the part of
+    // the layer which is known to be up to date, it is only relied on when
+    // the layer has been scrolled since the last paint event.
+    QPixmap _textLayer;
+    QRegion _validTextLayer;
+    bool _textLayerScrolled;
+
     // list of filters currently applied to the display.  used for links and
     // search highlight
     TerminalImageFilterChain* _filterChain;
     QRegion _mouseOverHotspotArea;
 
+    // filters in _filterChain created by setUserFilters()
+    QStringList _userFilterDefinitions;
+    QList<Filter*> _userFilters;
+
     KeyboardCursorShape _cursorShape;
 
     // custom cursor color.  if this is invalid then the foreground
@@ -828,6 +926,19 @@ private:
 
     SessionController* _sessionController;
 
+    // an image of a line and the characters which were drawn into it
+    struct LineImage
+    {
+        QVector<Character> cells;
+        QPixmap pixmap;
+    };
+    // images of recently drawn lines keyed by a hash of their characters,
+    // the cost of each image is its size in kilobytes
+    QCache<uint, LineImage> _lineImageCache;
+    // the size set with setLineImageCacheSize()
+    int _lineImageCacheSize;
+    bool _drawingLineImage;
+
 public:
     static void setTransparencyEnabled(bool enable)
     {
@@ -35,6 +35,7 @@
 #include <KActionCollection>
 #include <KXMLGUIFactory>
 #include <KConfigGroup>
+#include <KSharedConfig>
 
 // Konsole
 #include <konsoleadaptor.h>
@@ -801,6 +802,12 @@ TerminalDisplay* ViewManager::createTerminalDisplay(Session* session)
     TerminalDisplay* display = new TerminalDisplay(0);
     display->setRandomSeed(session->sessionId() * 31);
 
+    // memory used to keep images of recently drawn lines, in megabytes
+    const KConfigGroup group = KSharedConfig::openConfig("konsolerc")->group("Desktop Entry");
+    const int lineImageCacheSize = group.readEntry("LineImageCacheSize", -1);
+    if ( lineImageCacheSize >= 0 )
+        display->setLineImageCacheSize(lineImageCacheSize * 1024);
+
     return display;
 }
 
@@ -863,6 +870,7 @@ void ViewManager::applyProfileToView(TerminalDisplay* view , const Profile::Ptr
     view->setTripleClickMode( TerminalDisplay::TripleClickMode(tripleClickMode) );
 
     view->setUnderlineLinks(profile->property<bool>(Profile::UnderlineLinksEnabled));
+    view->setUserFilters(profile->property<QStringList>(Profile::HotSpotFilters));
 
     bool bidiEnabled = profile->property<bool>(Profile::BidiRenderingEnabled);
     view->setBidiEnabled(bidiEnabled);
@@ -0,0 +1,425 @@
+/*
+    Copyright 2012 by Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "FilterTest.h"
+
+// KDE
+#include <qtest_kde.h>
+
+// Konsole
+#include "../Filter.h"
+
+using namespace Konsole;
+
+// builds a terminal image from 'lines', each of which is padded with spaces
+// to 'columns' characters.  Characters of double width are followed by a
+// placeholder cell, as they are on the screen.
+static QVector<Character> makeImage(const QStringList& lines, int columns)
+{
+    QVector<Character> image(lines.count() * columns);
+    for (int line = 0; line < lines.count(); line++) {
+        int column = 0;
+        foreach(const QChar& c, lines[line]) {
+            image[line * columns + column++] = Character(c.unicode());
+            if (c.unicode() >= 0x1100)
+                image[line * columns + column++] = Character(0);
+        }
+    }
+    return image;
+}
+
+void FilterTest::testHotSpotPositions()
+{
+    const int columns = 20;
+    const QStringList lines = QStringList() << QString::fromUtf8("\xe4\xb8\xad foo bar")
+                                            << "no match"
+                                            << "bar    foo fo"
+                                            << "o on the next line";
+    const QVector<Character> image = makeImage(lines, columns);
+    QVector<LineProperty> properties(lines.count(), LINE_DEFAULT);
+    properties[2] = LINE_WRAPPED;
+
+    TerminalImageFilterChain chain;
+    RegExpFilter* filter = new RegExpFilter;
+    filter->setRegExp(QRegExp("fo\\s*o"));
+    chain.addFilter(filter);
+    chain.setImage(image.constData(), lines.count(), columns, properties);
+
+    const QList<Filter::HotSpot*> spots = chain.hotSpots();
+    QCOMPARE(spots.count(), 3);
+
+    // the double width character occupies two columns
+    QCOMPARE(spots[0]->startLine(), 0);
+    QCOMPARE(spots[0]->startColumn(), 3);
+    QCOMPARE(spots[0]->endColumn(), 6);
+
+    QCOMPARE(spots[1]->startLine(), 2);
+    QCOMPARE(spots[1]->startColumn(), 7);
+
+    // the trailing whitespace of a wrapped line is not part of the text
+    QCOMPARE(spots[2]->startLine(), 2);
+    QCOMPARE(spots[2]->startColumn(), 11);
+    QCOMPARE(spots[2]->endLine(), 3);
+    QCOMPARE(spots[2]->endColumn(), 1);
+
+    QVERIFY(chain.hotSpotAt(0, 4) == spots[0]);
+    QVERIFY(chain.hotSpotAt(1, 4) == 0);
+}
+
+void FilterTest::testUnchangedBlocksReused()
+{
+    const int columns = 10;
+    QStringList lines = QStringList() << "foo" << "bar" << "foo foo" << "baz";
+    QVector<LineProperty> properties(lines.count(), LINE_DEFAULT);
+
+    TerminalImageFilterChain chain;
+    RegExpFilter* filter = new RegExpFilter;
+    filter->setRegExp(QRegExp("foo"));
+    chain.addFilter(filter);
+
+    QVector<Character> image = makeImage(lines, columns);
+    chain.setImage(image.constData(), lines.count(), columns, properties);
+    QCOMPARE(chain.hotSpots().count(), 3);
+    Filter::HotSpot* lastSpot = chain.hotSpots().last();
+
+    // scroll the image up by one line, the hotspots found in lines which
+    // are still visible move with them
+    lines.removeFirst();
+    lines << "new foo";
+    image = makeImage(lines, columns);
+    chain.setImage(image.constData(), lines.count(), columns, properties);
+
+    const QList<Filter::HotSpot*> spots = chain.hotSpots();
+    QCOMPARE(spots.count(), 3);
+    QVERIFY(spots.contains(lastSpot));
+    QCOMPARE(lastSpot->startLine(), 1);
+    QCOMPARE(lastSpot->startColumn(), 4);
+    QVERIFY(chain.hotSpotAt(3, 5) != 0);
+    QVERIFY(chain.hotSpotAt(0, 0) == 0);
+
+    // changing the expression discards the previous results
+    filter->setRegExp(QRegExp("ba."));
+    chain.setImage(image.constData(), lines.count(), columns, properties);
+    QCOMPARE(chain.hotSpots().count(), 2);
+}
+
+void FilterTest::testAnchors()
+{
+    const int columns = 30;
+    const QStringList lines = QStringList() << "fixed in #1234"
+                                            << "commit 1a2b3c4d5e"
+                                            << "a foo and a FOO"
+                                            << "nothing here";
+    const QVector<Character> image = makeImage(lines, columns);
+    const QVector<LineProperty> properties(lines.count(), LINE_DEFAULT);
+
+    TerminalImageFilterChain chain;
+
+    RegExpFilter* tickets = new RegExpFilter;
+    tickets->setRegExp(QRegExp("#\\d+"));
+    tickets->setAnchors(QStringList("#"));
+    chain.addFilter(tickets);
+
+    RegExpFilter* hashes = new RegExpFilter;
+    hashes->setRegExp(QRegExp("\\b[0-9a-f]{7,}\\b"));
+    QVERIFY(hashes->anchors().isEmpty());
+    chain.addFilter(hashes);
+
+    // fixed strings are their own anchors
+    RegExpFilter* search = new RegExpFilter;
+    search->setRegExp(QRegExp("foo", Qt::CaseInsensitive, QRegExp::FixedString));
+    QCOMPARE(search->anchors(), QStringList("foo"));
+    QCOMPARE(search->anchorCaseSensitivity(), Qt::CaseInsensitive);
+    chain.addFilter(search);
+
+    chain.setImage(image.constData(), lines.count(), columns, properties);
+
+    QCOMPARE(tickets->hotSpots().count(), 1);
+    QCOMPARE(tickets->hotSpots().first()->startColumn(), 9);
+    QCOMPARE(hashes->hotSpots().count(), 1);
+    QCOMPARE(hashes->hotSpots().first()->startLine(), 1);
+    QCOMPARE(search->hotSpots().count(), 2);
+
+    // each hotspot reports the filter which found it
+    foreach(Filter::HotSpot* spot, chain.hotSpots()) {
+        if (spot->startLine() == 0)
+            QVERIFY(spot->filter() == tickets);
+        else if (spot->startLine() == 1)
+            QVERIFY(spot->filter() == hashes);
+        else
+            QVERIFY(spot->filter() == search);
+    }
+}
+
+void FilterTest::testUserFilters()
+{
+    const QStringList entries = QStringList()
+            << "Bug;OpenUrl;BUG-(\\d+);https://bugs.kde.org/%1"
+            << "Semi\\;colon;Copy;a\\;b;100%% %0"
+            << "Commit;RunCommand;\\b([0-9a-f]{7,})\\b;git show %1"
+            << "Missing fields;Copy"
+            << "Bad action;Open;x;y"
+            << "Bad expression;Copy;(unclosed;%0";
+
+    const QList<UserFilter::Definition> definitions = UserFilter::parseDefinitions(entries);
+    QCOMPARE(definitions.count(), 3);
+
+    QCOMPARE(definitions[0].name, QString("Bug"));
+    QCOMPARE(definitions[0].action, UserFilter::OpenUrl);
+    QCOMPARE(definitions[0].regExp.pattern(), QString("BUG-(\\d+)"));
+    QCOMPARE(definitions[0].anchors, QStringList("BUG-"));
+
+    QCOMPARE(definitions[1].name, QString("Semi;colon"));
+    QCOMPARE(definitions[1].action, UserFilter::CopyText);
+    QCOMPARE(definitions[1].anchors, QStringList("a"));
+
+    QCOMPARE(definitions[2].action, UserFilter::RunCommand);
+    QVERIFY(definitions[2].anchors.isEmpty());
+
+    const int columns = 40;
+    const QStringList lines = QStringList() << "fixed BUG-1234 in 1a2b3c4d5e"
+                                            << "a;b";
+    const QVector<Character> image = makeImage(lines, columns);
+    const QVector<LineProperty> properties(lines.count(), LINE_DEFAULT);
+
+    TerminalImageFilterChain chain;
+    foreach(const UserFilter::Definition& definition, definitions)
+        chain.addFilter(new UserFilter(definition));
+    chain.setImage(image.constData(), lines.count(), columns, properties);
+
+    const QList<Filter::HotSpot*> spots = chain.hotSpots();
+    QCOMPARE(spots.count(), 3);
+    foreach(Filter::HotSpot* spot, spots) {
+        QCOMPARE(spot->type(), Filter::HotSpot::Link);
+
+        const UserFilter* filter = static_cast<UserFilter*>(spot->filter());
+        const QString text = static_cast<UserFilter::HotSpot*>(spot)->actionText();
+        if (filter->definition().action == UserFilter::OpenUrl)
+            QCOMPARE(text, QString("https://bugs.kde.org/1234"));
+        else if (filter->definition().action == UserFilter::CopyText)
+            QCOMPARE(text, QString("100% a;b"));
+        else
+            QCOMPARE(text, QString("git show 1a2b3c4d5e"));
+    }
+}
+
+// a filter which takes 2ms of its own clock to process each block
+class SlowFilter : public Filter
+{
+public:
+    SlowFilter() : processed(0), clock(0) {}
+
+    virtual void process()
+    {
+        processed++;
+        clock += 2;
+    }
+
+    int processed;
+    qint64 clock;
+
+protected:
+    virtual qint64 currentTime() const
+    {
+        return clock;
+    }
+};
+
+void FilterTest::testTimeBudget()
+{
+    const int columns = 10;
+    QStringList lines;
+    for (int i = 0; i < 50; i++)
+        lines << QString::number(i);
+    const QVector<Character> image = makeImage(lines, columns);
+    const QVector<LineProperty> properties(lines.count(), LINE_DEFAULT);
+
+    TerminalImageFilterChain chain;
+    SlowFilter* filter = new SlowFilter;
+    filter->setTimeBudget(10);
+    QCOMPARE(filter->timeBudget(), 10);
+    chain.addFilter(filter);
+
+    // each image processes the blocks which the previous ones ran out of
+    // time for, and reuses the others.  Blocks are started until more than
+    // the budget has been used, which is after 6 blocks of 2ms each.
+    int images = 0;
+    while (filter->processed < lines.count() && images < lines.count()) {
+        const int processed = filter->processed;
+        chain.setImage(image.constData(), lines.count(), columns, properties);
+        QCOMPARE(filter->processed - processed, qMin(6, lines.count() - processed));
+        images++;
+    }
+
+    QCOMPARE(filter->processed, lines.count());
+    QCOMPARE(images, 9);
+}
+
+void FilterTest::testHotSpotIndex()
+{
+    const int columns = 10;
+    const QStringList lines = QStringList() << "ab ab ab"
+                                            << "xxxxxxxxxx"
+                                            << "xxxxxxxxxx"
+                                            << "xx ab";
+    const QVector<Character> image = makeImage(lines, columns);
+    QVector<LineProperty> properties(lines.count(), LINE_DEFAULT);
+    properties[1] = LINE_WRAPPED;
+    properties[2] = LINE_WRAPPED;
+
+    TerminalImageFilterChain chain;
+    RegExpFilter* pairs = new RegExpFilter;
+    pairs->setRegExp(QRegExp("ab"));
+    chain.addFilter(pairs);
+    RegExpFilter* words = new RegExpFilter;
+    words->setRegExp(QRegExp("[abx]+"));
+    chain.addFilter(words);
+    chain.setImage(image.constData(), lines.count(), columns, properties);
+
+    // where hotspots overlap, the one found by the first filter is returned
+    QVERIFY(chain.hotSpotAt(0, 3)->filter() == pairs);
+    QVERIFY(chain.hotSpotAt(0, 2)->filter() == pairs);
+    QVERIFY(chain.hotSpotAt(3, 4)->filter() == pairs);
+    QVERIFY(chain.hotSpotAt(3, 0)->filter() == words);
+    QVERIFY(chain.hotSpotAt(0, 9) == 0);
+    QVERIFY(chain.hotSpotAt(4, 0) == 0);
+    QVERIFY(chain.hotSpotAt(-1, 0) == 0);
+
+    // a hotspot covering several lines covers the whole of its middle lines
+    Filter::HotSpot* spot = chain.hotSpotAt(2, 5);
+    QVERIFY(spot != 0);
+    QCOMPARE(spot->startLine(), 1);
+    QCOMPARE(spot->endLine(), 3);
+    QVERIFY(chain.hotSpotAt(1, 0) == spot);
+    QVERIFY(chain.hotSpotAt(3, 1) == spot);
+
+    QCOMPARE(chain.hotSpotsInLines(0, 0).count(), 6);
+    QCOMPARE(chain.hotSpotsInLines(2, 2).count(), 1);
+    QCOMPARE(chain.hotSpotsInLines(2, 3).count(), 3);
+    QCOMPARE(chain.hotSpotsInLines(-5, 100).count(), chain.hotSpots().count());
+
+    // the index follows changes to the filters
+    pairs->reset();
+    QVERIFY(chain.hotSpotAt(0, 3)->filter() == words);
+    chain.removeFilter(words);
+    QVERIFY(chain.hotSpotAt(0, 3) == 0);
+    delete words;
+}
+
+void FilterTest::benchmarkManyMatches()
+{
+    // a screen full of short matches in a single block of wrapped lines,
+    // each of which is converted to a line and column
+    const int columns = 200;
+    QStringList lines;
+    for (int i = 0; i < 100; i++)
+        lines << QString(" 10.0.0.%1").arg(i % 10).repeated(columns / 9);
+    const QVector<Character> image = makeImage(lines, columns);
+    const QVector<LineProperty> properties(lines.count(), LINE_WRAPPED);
+
+    TerminalImageFilterChain chain;
+    RegExpFilter* filter = new RegExpFilter;
+    filter->setRegExp(QRegExp("\\d+\\.\\d+\\.\\d+\\.\\d+"));
+    chain.addFilter(filter);
+
+    QBENCHMARK {
+        filter->reset();
+        chain.setImage(image.constData(), lines.count(), columns, properties);
+    }
+
+    QCOMPARE(chain.hotSpots().count(), lines.count() * (columns / 9));
+}
+
+void FilterTest::benchmarkManyFilters_data()
+{
+    QTest::addColumn<int>("filterCount");
+
+    QTest::newRow("1 filter") << 1;
+    QTest::newRow("4 filters") << 4;
+    QTest::newRow("16 filters") << 16;
+}
+
+void FilterTest::benchmarkManyFilters()
+{
+    QFETCH(int, filterCount);
+
+    // a screen of ordinary output, with a match for one of the filters on
+    // a few of the lines
+    const int columns = 120;
+    QStringList lines;
+    for (int i = 0; i < 60; i++) {
+        QString line = QString("drwxr-xr-x 2 user users 4096 2012-06-%1 src%2").arg(i % 30).arg(i);
+        if (i % 10 == 0)
+            line += QString(" see BUG-%1-%2").arg(i % filterCount).arg(i);
+        lines << line;
+    }
+    const QVector<Character> image = makeImage(lines, columns);
+    const QVector<LineProperty> properties(lines.count(), LINE_DEFAULT);
+
+    TerminalImageFilterChain chain;
+    for (int i = 0; i < filterCount; i++) {
+        RegExpFilter* filter = new RegExpFilter;
+        filter->setRegExp(QRegExp(QString("BUG-%1-\\d+").arg(i)));
+        filter->setAnchors(QStringList(QString("BUG-%1-").arg(i)));
+        chain.addFilter(filter);
+    }
+
+    QBENCHMARK {
+        chain.reset();
+        chain.setImage(image.constData(), lines.count(), columns, properties);
+    }
+
+    QCOMPARE(chain.hotSpots().count(), 6);
+}
+
+void FilterTest::benchmarkHotSpotAt()
+{
+    // a screen full of short hotspots, looked up at every cell
+    const int columns = 200;
+    QStringList lines;
+    for (int i = 0; i < 100; i++)
+        lines << QString(" 10.0.0.%1").arg(i % 10).repeated(columns / 9);
+    const QVector<Character> image = makeImage(lines, columns);
+    const QVector<LineProperty> properties(lines.count(), LINE_DEFAULT);
+
+    TerminalImageFilterChain chain;
+    RegExpFilter* filter = new RegExpFilter;
+    filter->setRegExp(QRegExp("\\d+\\.\\d+\\.\\d+\\.\\d+"));
+    chain.addFilter(filter);
+    chain.setImage(image.constData(), lines.count(), columns, properties);
+
+    int found = 0;
+    QBENCHMARK {
+        found = 0;
+        for (int line = 0; line < lines.count(); line++) {
+            for (int column = 0; column < columns; column++) {
+                if (chain.hotSpotAt(line, column))
+                    found++;
+            }
+        }
+    }
+
+    QVERIFY(found > 0);
+}
+
+QTEST_KDEMAIN_CORE(FilterTest)
+
+#include "FilterTest.moc"
+
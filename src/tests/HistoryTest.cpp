@@ -0,0 +1,663 @@
+/*
+    Copyright 2012 by Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "HistoryTest.h"
+
+// KDE
+#include <KTempDir>
+#include <qtest_kde.h>
+
+// Konsole
+#include "../History.h"
+#include "../HistorySearchIndex.h"
+#include "../Screen.h"
+#include "../SearchMatchIndex.h"
+
+using namespace Konsole;
+
+// builds a line of 'length' characters which changes color every 'runLength' characters
+static TextLine makeLine(int length, int runLength, quint16 firstChar)
+{
+    TextLine line(length);
+    for (int i = 0; i < length; i++) {
+        const int run = i / runLength;
+        line[i] = Character(firstChar + (i % 26),
+                            CharacterColor(COLOR_SPACE_SYSTEM, run % 8),
+                            CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_BACK_COLOR),
+                            (run % 2) ? RE_BOLD : DEFAULT_RENDITION);
+    }
+    return line;
+}
+
+static bool sameCells(const Character* a, const Character* b, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (a[i] != b[i] || a[i].isRealCharacter != b[i].isRealCharacter)
+            return false;
+    }
+    return true;
+}
+
+void HistoryTest::testCompactHistory()
+{
+    CompactHistoryScroll history(100);
+
+    const TextLine plain = makeLine(80, 80, 'a');
+    const TextLine colored = makeLine(120, 7, 'A');
+    const TextLine empty;
+
+    history.addCellsVector(plain);
+    history.addLine(false);
+    history.addCellsVector(colored);
+    history.addLine(true);
+    history.addCellsVector(empty);
+    history.addLine(false);
+
+    QCOMPARE(history.getLines(), 3);
+    QCOMPARE(history.getLineLen(0), plain.size());
+    QCOMPARE(history.getLineLen(1), colored.size());
+    QCOMPARE(history.getLineLen(2), 0);
+    QVERIFY(!history.isWrappedLine(0));
+    QVERIFY(history.isWrappedLine(1));
+
+    // read whole lines twice, the second read is served from the decoded line cache
+    for (int pass = 0; pass < 2; pass++) {
+        Character buffer[120];
+        history.getCells(0, 0, plain.size(), buffer);
+        QVERIFY(sameCells(buffer, plain.constData(), plain.size()));
+        history.getCells(1, 0, colored.size(), buffer);
+        QVERIFY(sameCells(buffer, colored.constData(), colored.size()));
+    }
+
+    // partial reads starting in the middle of a format run
+    for (int start = 0; start < colored.size(); start += 5) {
+        const int count = qMin(13, colored.size() - start);
+        Character buffer[13];
+        history.getCells(1, start, count, buffer);
+        QVERIFY(sameCells(buffer, colored.constData() + start, count));
+    }
+}
+
+void HistoryTest::testCompactHistoryLimit()
+{
+    CompactHistoryScroll history(10);
+
+    for (int i = 0; i < 50; i++) {
+        history.addCellsVector(makeLine(10 + i, 3, 'a'));
+        history.addLine(false);
+
+        // read the newest line so that it is held in the decoded line cache
+        // when older lines are dropped
+        Character buffer[60];
+        history.getCells(history.getLines() - 1, 0, 10 + i, buffer);
+    }
+
+    QVERIFY(history.getLines() <= 11);
+
+    const int lineCount = history.getLines();
+    for (int line = 0; line < lineCount; line++) {
+        const int length = 50 - lineCount + line + 10;
+        QCOMPARE(history.getLineLen(line), length);
+
+        const TextLine expected = makeLine(length, 3, 'a');
+        Character buffer[60];
+        history.getCells(line, 0, length, buffer);
+        QVERIFY(sameCells(buffer, expected.constData(), length));
+    }
+}
+
+void HistoryTest::testCompactHistoryReleaseMemory()
+{
+    CompactHistoryScroll history(100000);
+
+    for (int i = 0; i < 20000; i++) {
+        history.addCellsVector(makeLine(40 + i % 50, 3, 'a'));
+        history.addLine(i % 3 == 0);
+    }
+
+    const qint64 usage = history.memoryUsage();
+    QVERIFY(usage > 0);
+
+    const qint64 released = history.releaseMemory(usage);
+    QVERIFY(released > 0);
+    QCOMPARE(history.memoryUsage(), usage - released);
+
+    // lines which were moved out of memory are read back on access
+    for (int line = 0; line < 20000; line += 37) {
+        const int length = 40 + line % 50;
+        QCOMPARE(history.getLineLen(line), length);
+        QCOMPARE(history.isWrappedLine(line), line % 3 == 0);
+
+        const TextLine expected = makeLine(length, 3, 'a');
+        Character buffer[90];
+        history.getCells(line, 0, length, buffer);
+        QVERIFY(sameCells(buffer, expected.constData(), length));
+    }
+
+    // dropping lines whose memory was released
+    history.releaseMemory(usage);
+    history.setMaxNbLines(100);
+    QCOMPARE(history.getLineLen(0), 40 + (20000 - history.getLines()) % 50);
+}
+
+void HistoryTest::testCompactHistoryFormatTable()
+{
+    CompactHistoryFormatTable table;
+    QCOMPARE(table.count(), 1);
+
+    const TextLine line = makeLine(16, 1, 'a');
+    const quint16 bold = table.addFormat(line[1]);
+    const quint16 plain = table.addFormat(line[0]);
+    QVERIFY(bold != plain);
+    QCOMPARE(table.addFormat(line[9]), bold);
+    QCOMPARE(table.count(), 3);
+
+    QVERIFY(table.format(bold).rendition & RE_BOLD);
+    QVERIFY(table.format(bold).fgColor == line[1].foregroundColor);
+
+    // the entry is reused once the last reference to a format is dropped
+    table.releaseFormat(bold);
+    QCOMPARE(table.count(), 3);
+    table.releaseFormat(bold);
+    QCOMPARE(table.count(), 2);
+    QCOMPARE(table.addFormat(line[2]), bold);
+    QVERIFY(table.format(bold).fgColor == line[2].foregroundColor);
+}
+
+// even lines are narrow with an odd number of characters, odd lines are wide
+static TextLine mixedWidthLine(int line)
+{
+    if (line % 2) {
+        TextLine wide = makeLine(33, 4, 'a');
+        wide[3].character = 0x263a;
+        return wide;
+    }
+    return makeLine(17 + line, 4, 'a');
+}
+
+void HistoryTest::testCompactHistoryCharacterWidth()
+{
+    CompactHistoryScroll history(100);
+
+    // Latin-1 lines are stored with one byte per character, other lines
+    // with two bytes
+    TextLine latin1 = makeLine(40, 6, 'a');
+    latin1[10].character = 0xe9;
+    TextLine wide = makeLine(40, 6, 'a');
+    wide[39].character = 0x263a;
+
+    history.addCellsVector(latin1);
+    history.addLine(false);
+    history.addCellsVector(wide);
+    history.addLine(false);
+
+    for (int start = 0; start < 40; start += 7) {
+        const int count = qMin(11, 40 - start);
+        Character buffer[11];
+        history.getCells(0, start, count, buffer);
+        QVERIFY(sameCells(buffer, latin1.constData() + start, count));
+        history.getCells(1, start, count, buffer);
+        QVERIFY(sameCells(buffer, wide.constData() + start, count));
+    }
+
+    // narrow lines with an odd number of characters are followed by the
+    // cells and format runs of the next lines
+    CompactHistoryScroll oddHistory(100);
+    for (int i = 0; i < 20; i++) {
+        oddHistory.addCellsVector(mixedWidthLine(i));
+        oddHistory.addLine(false);
+    }
+    for (int line = 0; line < 20; line++) {
+        const TextLine expected = mixedWidthLine(line);
+        QCOMPARE(oddHistory.getLineLen(line), expected.size());
+        for (int start = 0; start < expected.size(); start += 5) {
+            const int count = qMin(9, expected.size() - start);
+            Character buffer[9];
+            oddHistory.getCells(line, start, count, buffer);
+            QVERIFY(sameCells(buffer, expected.constData() + start, count));
+        }
+    }
+}
+
+void HistoryTest::testBlockArrayHistory()
+{
+    HistoryScrollBlockArray history(1000);
+
+    for (int i = 0; i < 5000; i++) {
+        history.addCellsVector(makeLine(40 + i % 50, 5, 'a'));
+        history.addLine(i % 7 == 0);
+    }
+
+    QCOMPARE(history.getLines(), 1000);
+
+    for (int line = 0; line < 1000; line++) {
+        const int i = 4000 + line;
+        const int length = 40 + i % 50;
+        QCOMPARE(history.getLineLen(line), length);
+        QCOMPARE(history.isWrappedLine(line), i % 7 == 0);
+
+        const TextLine expected = makeLine(length, 5, 'a');
+        Character buffer[90];
+        history.getCells(line, 0, length, buffer);
+        QVERIFY(sameCells(buffer, expected.constData(), length));
+    }
+}
+
+void HistoryTest::testBlockArrayHistoryRing()
+{
+    HistoryScrollBlockArray history(1000);
+    const qint64 usage = history.memoryUsage();
+
+    // lines which are much longer than the buffer was sized for cause the
+    // oldest lines to be evicted before the line limit is reached
+    for (int i = 0; i < 5000; i++) {
+        history.addCellsVector(makeLine(500, 5, 'a'));
+        history.addLine(false);
+    }
+
+    QVERIFY(history.getLines() > 0);
+    QVERIFY(history.getLines() < 1000);
+    QCOMPARE(history.memoryUsage(), usage);
+
+    for (int line = 0; line < history.getLines(); line++)
+        QCOMPARE(history.getLineLen(line), 500);
+}
+
+void HistoryTest::testBlockArrayHistoryLongLine()
+{
+    HistoryScrollBlockArray history(1000);
+
+    // lines which are longer than a block are stored as a single line
+    const TextLine line = makeLine(20000, 7, 'a');
+    for (int i = 0; i < 10; i++) {
+        history.addCellsVector(makeLine(80, 3, 'a'));
+        history.addLine(false);
+    }
+    history.addCellsVector(line);
+    history.addLine(true);
+    history.addCellsVector(makeLine(80, 3, 'a'));
+    history.addLine(false);
+
+    QCOMPARE(history.getLines(), 12);
+    QCOMPARE(history.getLineLen(10), line.size());
+    QVERIFY(history.isWrappedLine(10));
+    QVERIFY(!history.isWrappedLine(11));
+
+    TextLine cells(line.size());
+    history.getCells(10, 0, line.size(), cells.data());
+    QVERIFY(sameCells(cells.constData(), line.constData(), line.size()));
+
+    // as the buffer is reused, the long lines evict several of the oldest
+    // lines at once and lines of any length keep their contents
+    for (int i = 0; i < 500; i++) {
+        history.addCellsVector(makeLine(1 + (i * 7919) % 30000, 1 + i % 9, 'a'));
+        history.addLine(i % 3 == 0);
+    }
+
+    const int lines = history.getLines();
+    QVERIFY(lines > 0);
+    QVERIFY(lines < 500);
+
+    // read the lines backwards, which does not walk them in order
+    for (int line = lines - 1; line >= 0; line--) {
+        const int i = 500 - lines + line;
+        const TextLine expected = makeLine(1 + (i * 7919) % 30000, 1 + i % 9, 'a');
+        QCOMPARE(history.getLineLen(line), expected.size());
+        QCOMPARE(history.isWrappedLine(line), i % 3 == 0);
+
+        TextLine cells(expected.size());
+        history.getCells(line, 0, expected.size(), cells.data());
+        QVERIFY(sameCells(cells.constData(), expected.constData(), expected.size()));
+    }
+}
+
+void HistoryTest::testBlockArrayHistoryType()
+{
+    CompactHistoryScroll* compact = new CompactHistoryScroll(100);
+    for (int i = 0; i < 80; i++) {
+        compact->addCellsVector(makeLine(10 + i, 3, 'a'));
+        compact->addLine(i % 2 == 0);
+    }
+
+    // changing the history type keeps the newest lines
+    const HistoryTypeBlockArray type(50);
+    HistoryScroll* history = type.scroll(compact);
+    QCOMPARE(history->getLines(), 50);
+    QCOMPARE(history->getLineLen(0), 40);
+    QVERIFY(history->isWrappedLine(0));
+
+    // the history is kept if its size does not change
+    QCOMPARE(type.scroll(history), history);
+    delete history;
+}
+
+void HistoryTest::testJournalHistory()
+{
+    KTempDir directory;
+
+    TextLine colored = makeLine(120, 7, 'A');
+    const ushort combined[] = { 'e', 0x0301 };
+    colored[5].character = ExtendedCharTable::instance.createExtendedChar(combined, 2);
+    colored[5].rendition |= RE_EXTENDED_CHAR;
+    colored[6].isRealCharacter = false;
+    const TextLine plain = makeLine(80, 80, 'a');
+
+    {
+        HistoryScrollJournal journal(directory.name(), "test", true);
+        journal.addCellsVector(colored);
+        journal.addLine(true);
+        journal.addCellsVector(plain);
+        journal.addLine(false);
+        QCOMPARE(journal.getLines(), 2);
+    }
+
+    // the lines are read back from the journal when it is opened again,
+    // combined characters are found by their code points
+    HistoryScrollJournal journal(directory.name(), "test", false);
+    QCOMPARE(journal.getLines(), 2);
+    QCOMPARE(journal.getLineLen(0), colored.size());
+    QCOMPARE(journal.getLineLen(1), plain.size());
+    QVERIFY(journal.isWrappedLine(0));
+    QVERIFY(!journal.isWrappedLine(1));
+
+    TextLine cells(colored.size());
+    journal.getCells(0, 0, colored.size(), cells.data());
+    QVERIFY(sameCells(cells.constData(), colored.constData(), colored.size()));
+
+    journal.getCells(1, 10, 20, cells.data());
+    QVERIFY(sameCells(cells.constData(), plain.constData() + 10, 20));
+
+    ushort length = 0;
+    journal.getCells(0, 5, 1, cells.data());
+    const ushort* chars = ExtendedCharTable::instance.lookupExtendedChar(cells[0].character, length);
+    QCOMPARE(length, ushort(2));
+    QCOMPARE(chars[1], ushort(0x0301));
+
+    // only journals which have not been written to recently are removed
+    const QString path = HistoryTypeJournal::journalPath(directory.name(), "test");
+    HistoryTypeJournal::removeStaleJournals(directory.name(), "other", 30);
+    QVERIFY(QFile::exists(path));
+    HistoryTypeJournal::removeStaleJournals(directory.name(), "test", -1);
+    QVERIFY(QFile::exists(path));
+    HistoryTypeJournal::removeStaleJournals(directory.name(), "other", -1);
+    QVERIFY(!QFile::exists(path));
+}
+
+// adds 'text' to 'index' as a line of history
+static void addText(HistorySearchIndex& index, const QString& text, bool wrapped = false)
+{
+    QVector<Character> line(text.length());
+    for (int i = 0; i < text.length(); i++)
+        line[i] = Character(text[i].unicode());
+    index.addLine(line.constData(), line.count(), wrapped);
+}
+
+typedef QList< QPair<int,int> > LineRanges;
+
+void HistoryTest::testSearchIndex()
+{
+    HistorySearchIndex index;
+    index.setMemoryLimit(1024 * 1024);
+
+    for (int i = 0; i < 200; i++)
+        addText(index, (i == 100) ? QString("done request-12345") : QString("line %1").arg(i));
+    QCOMPARE(index.lineCount(), 200);
+
+    // only the block of the match and the lines after the history may contain it
+    LineRanges expected;
+    expected << qMakePair(96, 127) << qMakePair(200, 223);
+    QCOMPARE(index.candidateLines("request-12345", 0, 223), expected);
+    QCOMPARE(index.candidateLines("REQUEST", 0, 223), expected);
+
+    expected.clear();
+    expected << qMakePair(100, 127);
+    QCOMPARE(index.candidateLines("request", 100, 199), expected);
+    QVERIFY(index.candidateLines("request", 0, 95).isEmpty());
+
+    // text which is too short to look up
+    expected.clear();
+    expected << qMakePair(10, 20);
+    QCOMPARE(index.candidateLines("re", 10, 20), expected);
+
+    // line numbers move down as the oldest lines are dropped
+    for (int i = 0; i < 90; i++)
+        index.removeFirstLine();
+    QCOMPARE(index.lineCount(), 110);
+    expected.clear();
+    expected << qMakePair(6, 37);
+    QCOMPARE(index.candidateLines("request", 0, 109), expected);
+
+    index.clear();
+    QCOMPARE(index.lineCount(), 0);
+    QCOMPARE(index.memoryUsage(), qint64(0));
+
+    // lines which were added before the index was reset are not indexed,
+    // and neither is the rest of their block
+    index.reset(40, false);
+    QCOMPARE(index.lineCount(), 40);
+    for (int i = 40; i < 100; i++)
+        addText(index, (i == 98) ? QString("done request-12345") : QString("line %1").arg(i));
+    expected.clear();
+    expected << qMakePair(0, 63) << qMakePair(96, 110);
+    QCOMPARE(index.candidateLines("request", 0, 110), expected);
+}
+
+void HistoryTest::testSearchIndexWrappedLines()
+{
+    HistorySearchIndex index;
+    index.setMemoryLimit(1024 * 1024);
+
+    // the text is split over the last line of one block and the first
+    // line of the next
+    for (int i = 0; i < 31; i++)
+        addText(index, QString("line %1").arg(i));
+    addText(index, "xxxreq", true);
+    addText(index, "uest-9");
+    for (int i = 33; i < 100; i++)
+        addText(index, QString("line %1").arg(i));
+
+    LineRanges expected;
+    expected << qMakePair(0, 63);
+    QCOMPARE(index.candidateLines("request-9", 0, 99), expected);
+
+    // text which runs on from the last line of the history may be
+    // found on the screen
+    addText(index, "more text", true);
+    expected.clear();
+    expected << qMakePair(96, 110);
+    QCOMPARE(index.candidateLines("text on the screen", 64, 110), expected);
+}
+
+void HistoryTest::testSearchIndexLimit()
+{
+    HistorySearchIndex index;
+    index.setMemoryLimit(1024 * 1024);
+    for (int i = 0; i < HistorySearchIndex::BLOCK_LINES; i++)
+        addText(index, QString("line %1").arg(i));
+    const qint64 blockSize = index.memoryUsage();
+    QVERIFY(blockSize > 0);
+
+    // the oldest blocks are discarded and their lines may contain anything
+    index.clear();
+    index.setMemoryLimit(2 * blockSize);
+    for (int i = 0; i < 200; i++)
+        addText(index, (i == 10) ? QString("request-12345") : QString("line %1").arg(i));
+    QCOMPARE(index.memoryUsage(), 2 * blockSize);
+
+    LineRanges expected;
+    expected << qMakePair(0, 159);
+    QCOMPARE(index.candidateLines("request", 0, 199), expected);
+
+    // an index which is too small for a single block skips nothing, every
+    // line is a candidate
+    index.setMemoryLimit(blockSize / 2);
+    QCOMPARE(index.memoryUsage(), qint64(0));
+    expected.clear();
+    expected << qMakePair(0, 199);
+    QCOMPARE(index.candidateLines("request", 0, 199), expected);
+}
+
+static void writeLine(Screen& screen, const QString& text)
+{
+    for (int i = 0; i < text.length(); i++)
+        screen.displayCharacter(text[i].unicode());
+    screen.nextLine();
+}
+
+void HistoryTest::testSearchMatchIndex()
+{
+    Screen screen(4, 20);
+    screen.setScroll(CompactHistoryType(100));
+    for (int i = 0; i < 30; i++)
+        writeLine(screen, (i == 10 || i == 20) ? QString("a match and a match") : QString("line %1").arg(i));
+    QCOMPARE(screen.getHistLines(), 27);
+
+    SearchMatchIndex index;
+    index.setRegExp(QRegExp("match"));
+
+    // the history is searched a few lines at a time
+    QVERIFY(!index.update(&screen, 5));
+    QVERIFY(!index.isComplete());
+    while (!index.update(&screen, 5)) {}
+    QCOMPARE(index.count(), 4);
+
+    const SearchMatchIndex::Match match = index.at(1);
+    QCOMPARE(match.startLine, 10);
+    QCOMPARE(match.startColumn, 14);
+    QCOMPARE(match.endLine, 10);
+    QCOMPARE(match.endColumn, 19);
+
+    QCOMPARE(index.findNext(10, 2), 1);
+    QCOMPARE(index.findPrevious(10, 2), -1);
+    QCOMPARE(index.findPrevious(20, 3), 2);
+    QCOMPARE(index.findNext(20, 14), index.count());
+
+    // once the whole history has been searched, the lines on the screen
+    // are covered too, until more output is added
+    QVERIFY(index.covers(&screen, 0, 20));
+    QVERIFY(index.covers(&screen, 20, 30));
+    QVERIFY(!index.covers(&screen, 0, 31));
+    QCOMPARE(index.matchesInLines(15, 25).count(), 2);
+
+    // the lines on the screen are searched again on every update
+    writeLine(screen, "match on the screen");
+    QVERIFY(!index.covers(&screen, 20, 30));
+    QVERIFY(index.update(&screen, 5));
+    QCOMPARE(index.count(), 5);
+    QCOMPARE(index.at(4).startLine, 30);
+
+    // lines which are not wrapped are separated by a single new-line
+    index.setRegExp(QRegExp("29\\nmatch"));
+    QVERIFY(index.update(&screen, 50));
+    QCOMPARE(index.count(), 1);
+    QCOMPARE(index.at(0).startLine, 29);
+    QCOMPARE(index.at(0).startColumn, 5);
+    QCOMPARE(index.at(0).endLine, 30);
+    QCOMPARE(index.at(0).endColumn, 5);
+
+    // expressions which match the empty string match nothing
+    index.setRegExp(QRegExp("x*"));
+    QVERIFY(index.update(&screen, 5));
+    QCOMPARE(index.count(), 0);
+}
+
+void HistoryTest::testSearchMatchIndexDroppedLines()
+{
+    Screen screen(4, 10);
+    screen.setScroll(CompactHistoryType(20));
+
+    // a match which is wrapped onto the next line
+    writeLine(screen, "xxxxxxxmatch");
+    for (int i = 0; i < 10; i++)
+        writeLine(screen, "line");
+
+    SearchMatchIndex index;
+    index.setRegExp(QRegExp("match"));
+    while (!index.update(&screen, 3)) {}
+    QCOMPARE(index.count(), 1);
+
+    SearchMatchIndex::Match match = index.at(0);
+    QCOMPARE(match.startLine, 0);
+    QCOMPARE(match.startColumn, 7);
+    QCOMPARE(match.endLine, 1);
+    QCOMPARE(match.endColumn, 2);
+
+    // matches are dropped along with their lines
+    for (int i = 0; i < 20; i++)
+        writeLine(screen, "line");
+    QVERIFY(screen.totalDroppedLines() > 0);
+    while (!index.update(&screen, 3)) {}
+    QCOMPARE(index.count(), 0);
+
+    // line numbers of later matches take the dropped lines into account
+    writeLine(screen, "match");
+    for (int i = 0; i < 10; i++)
+        writeLine(screen, "line");
+    while (!index.update(&screen, 3)) {}
+    QCOMPARE(index.count(), 1);
+    QCOMPARE(index.at(0).startLine, screen.getHistLines() + 3 - 11);
+    QVERIFY(index.covers(&screen, 0, index.at(0).startLine));
+}
+
+void HistoryTest::benchmarkHistory_data()
+{
+    QTest::addColumn<int>("type");
+
+    QTest::newRow("compact") << 0;
+    QTest::newRow("file") << 1;
+    QTest::newRow("blockarray") << 2;
+}
+
+void HistoryTest::benchmarkHistory()
+{
+    QFETCH(int, type);
+
+    const TextLine line = makeLine(100, 10, 'a');
+    Character buffer[100];
+
+    QBENCHMARK {
+        HistoryScroll* history = 0;
+        switch (type) {
+        case 0:
+            history = new CompactHistoryScroll(10000);
+            break;
+        case 1:
+            history = new HistoryScrollFile(QString());
+            break;
+        default:
+            history = new HistoryScrollBlockArray(10000);
+            break;
+        }
+
+        for (int i = 0; i < 20000; i++) {
+            history->addCellsVector(line);
+            history->addLine(false);
+        }
+        for (int i = 0; i < history->getLines(); i++)
+            history->getCells(i, 0, history->getLineLen(i), buffer);
+
+        delete history;
+    }
+}
+
+QTEST_KDEMAIN_CORE( HistoryTest )
+
+#include "HistoryTest.moc"
+
@@ -21,6 +21,9 @@
 #include "ProfileTest.h"
 
 // KDE
+#include <KConfig>
+#include <KConfigGroup>
+#include <KTempDir>
 #include <qtest_kde.h>
 
 // Konsole
@@ -172,6 +175,51 @@ void ProfileTest::testProfileGroup()
     QVERIFY(profile[0]->property<QString>(Profile::Command) != "fish");
 }
 
+void ProfileTest::testHotSpotFilters()
+{
+    // expressions with commas and backslashes, which KConfig treats
+    // specially in lists
+    const QStringList definitions = QStringList()
+            << "Commit;RunCommand;\\b([0-9a-f]{7,})\\b;git show %1"
+            << "Semi\\;colon;Copy;a\\;b,\\d{1,3};100%% %0";
+
+    KTempDir directory;
+    const QString path = directory.name() + "test.profile";
+
+    Profile::Ptr profile(new Profile);
+    profile->setProperty(Profile::HotSpotFilters, definitions);
+    KDE4ProfileWriter writer;
+    QVERIFY(writer.writeProfile(path, profile));
+
+    // each definition is stored in a group of its own
+    {
+        KConfig config(path, KConfig::NoGlobals);
+        QCOMPARE(config.group("Interaction Options").readEntry("HotSpotFilters", 0), 2);
+        const KConfigGroup group = config.group("HotSpotFilter 2");
+        QCOMPARE(group.readEntry("Name"), QString("Semi;colon"));
+        QCOMPARE(group.readEntry("Action"), QString("Copy"));
+        QCOMPARE(group.readEntry("RegExp"), QString("a\\;b,\\d{1,3}"));
+        QCOMPARE(group.readEntry("Template"), QString("100%% %0"));
+    }
+
+    KDE4ProfileReader reader;
+    Profile::Ptr readProfile(new Profile);
+    QString parent;
+    QVERIFY(reader.readProfile(path, readProfile, parent));
+    QCOMPARE(readProfile->property<QStringList>(Profile::HotSpotFilters), definitions);
+
+    // groups of filters which have been removed are deleted
+    profile->setProperty(Profile::HotSpotFilters, definitions.mid(0, 1));
+    QVERIFY(writer.writeProfile(path, profile));
+    {
+        KConfig config(path, KConfig::NoGlobals);
+        QVERIFY(config.hasGroup("HotSpotFilter 1"));
+        QVERIFY(!config.hasGroup("HotSpotFilter 2"));
+    }
+    QVERIFY(reader.readProfile(path, readProfile, parent));
+    QCOMPARE(readProfile->property<QStringList>(Profile::HotSpotFilters), definitions.mid(0, 1));
+}
+
 QTEST_KDEMAIN_CORE( ProfileTest )
 
 #include "ProfileTest.moc"
@@ -0,0 +1,217 @@
+/*
+    Copyright 2012 by Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "TerminalDisplayTest.h"
+
+// Qt
+#include <QtCore/QVector>
+#include <QtGui/QPixmap>
+
+// KDE
+#include <qtest_kde.h>
+
+// Konsole
+#include "../DamageAccumulator.h"
+#include "../PaletteCache.h"
+#include "../Screen.h"
+#include "../ScreenWindow.h"
+#include "../TerminalDisplay.h"
+
+using namespace Konsole;
+
+// fills 'screen' with text which changes color every few characters
+static void fillScreen(Screen& screen, int lines, int columns)
+{
+    for (int line = 0; line < lines; line++) {
+        for (int column = 0; column < columns; column++) {
+            screen.setForeColor(COLOR_SPACE_SYSTEM, (column / 7 + line) % 8);
+            screen.displayCharacter('a' + (column + line) % 26);
+        }
+        if (line < lines - 1)
+            screen.nextLine();
+    }
+}
+
+void TerminalDisplayTest::testFindChangedColumns()
+{
+    QVector<Character> oldLine(100);
+    QVector<Character> newLine(100);
+    QVector<ColumnRange> ranges;
+
+    findChangedColumns(oldLine.constData(), newLine.constData(), 100, ranges);
+    QVERIFY(ranges.isEmpty());
+
+    newLine[5].character = 'x';
+    newLine[6].character = 'y';
+    newLine[40].rendition = RE_BOLD;
+    newLine[99].foregroundColor = CharacterColor(COLOR_SPACE_SYSTEM, 1);
+    // only differs in a property which is not compared
+    newLine[50].isRealCharacter = false;
+
+    findChangedColumns(oldLine.constData(), newLine.constData(), 100, ranges);
+    QCOMPARE(ranges.count(), 3);
+    QCOMPARE(ranges[0], ColumnRange(5, 7));
+    QCOMPARE(ranges[1], ColumnRange(40, 41));
+    QCOMPARE(ranges[2], ColumnRange(99, 100));
+}
+
+void TerminalDisplayTest::benchmarkFindChangedColumns_data()
+{
+    QTest::addColumn<int>("changeInterval");
+
+    // a frame in which nothing changed, one in which a single character of
+    // each line changed (eg. typing at a prompt) and the worst case, in which
+    // every other character changed
+    QTest::newRow("unchanged") << 0;
+    QTest::newRow("one change per line") << 1000;
+    QTest::newRow("every other character") << 2;
+}
+
+void TerminalDisplayTest::benchmarkFindChangedColumns()
+{
+    QFETCH(int, changeInterval);
+    const int lines = 50;
+    const int columns = 400;
+
+    QVector<Character> oldImage(lines * columns);
+    QVector<Character> newImage(lines * columns);
+    for (int i = 0; i < newImage.size(); i++) {
+        const int column = i % columns;
+        if (changeInterval > 0 && column % changeInterval == 1)
+            newImage[i].character = 'x';
+    }
+
+    QVector<ColumnRange> ranges;
+    QBENCHMARK {
+        for (int line = 0; line < lines; line++) {
+            ranges.clear();
+            findChangedColumns(oldImage.constData() + line * columns,
+                               newImage.constData() + line * columns,
+                               columns, ranges);
+        }
+    }
+}
+
+void TerminalDisplayTest::testDamageAccumulator()
+{
+    DamageAccumulator damage(3);
+    QVERIFY(damage.isEmpty());
+
+    // adjacent lines with overlapping changes are merged into one band
+    damage.addLine(1, 5, 10);
+    damage.addLine(2, 8, 12);
+    damage.addLine(2, 20, 22);
+    // changes which do not touch the band above start a new one
+    damage.addLine(3, 40, 50);
+    damage.addLine(5, 0, 80);
+
+    QVector<QRect> bands = damage.bands();
+    QCOMPARE(bands.count(), 3);
+    QCOMPARE(bands[0], QRect(5, 1, 17, 2));
+    QCOMPARE(bands[1], QRect(40, 3, 10, 1));
+    QCOMPARE(bands[2], QRect(0, 5, 80, 1));
+
+    QCOMPARE(damage.region(QPoint(1, 2), 10, 20), QRegion(QRect(51, 22, 170, 40)) |
+                                                  QRegion(QRect(401, 62, 100, 20)) |
+                                                  QRegion(QRect(1, 102, 800, 20)));
+
+    // above the limit, the bounding rectangle is used
+    damage.addLine(7, 0, 1);
+    bands = damage.bands();
+    QCOMPARE(bands.count(), 1);
+    QCOMPARE(bands[0], QRect(0, 1, 80, 7));
+
+    damage.clear();
+    QVERIFY(damage.isEmpty());
+}
+
+void TerminalDisplayTest::testPaletteCache()
+{
+    ColorEntry table[TABLE_COLORS];
+    for (int i = 0; i < TABLE_COLORS; i++)
+        table[i] = ColorEntry(QColor(i, 255 - i, 128), false);
+
+    PaletteCache cache;
+    cache.setColorTable(table);
+
+    QList<CharacterColor> colors;
+    colors << CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_FORE_COLOR)
+           << CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_BACK_COLOR)
+           << CharacterColor(COLOR_SPACE_RGB, 0x123456)
+           << CharacterColor(COLOR_SPACE_RGB, 0x123456)
+           << CharacterColor();
+    for (int i = 0; i < 16; i++)
+        colors << CharacterColor(COLOR_SPACE_SYSTEM, i);
+    for (int i = 0; i < 256; i++)
+        colors << CharacterColor(COLOR_SPACE_256, i);
+
+    CharacterColor intense(COLOR_SPACE_SYSTEM, 3);
+    intense.setIntensive();
+    colors << intense;
+
+    foreach (const CharacterColor& color, colors) {
+        QCOMPARE(cache.color(color), color.color(table));
+        QCOMPARE(cache.pen(color).color(), color.color(table));
+        QCOMPARE(cache.brush(color).color(), color.color(table));
+    }
+
+    // the palette is resolved again when the table changes
+    table[DEFAULT_FORE_COLOR].color = Qt::red;
+    cache.setColorTable(table);
+    QCOMPARE(cache.color(CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_FORE_COLOR)),
+             QColor(Qt::red));
+}
+
+void TerminalDisplayTest::benchmarkRedraw_data()
+{
+    QTest::addColumn<int>("columns");
+
+    QTest::newRow("80 columns") << 80;
+    QTest::newRow("400 columns") << 400;
+}
+
+void TerminalDisplayTest::benchmarkRedraw()
+{
+    QFETCH(int, columns);
+    const int lines = 50;
+
+    Screen screen(lines, columns);
+    fillScreen(screen, lines, columns);
+
+    ScreenWindow window;
+    window.setScreen(&screen);
+
+    TerminalDisplay display;
+    // measure drawing the text rather than copying cached line images
+    display.setLineImageCacheSize(0);
+    display.setSize(columns, lines);
+    display.resize(display.sizeHint());
+    display.setScreenWindow(&window);
+    display.updateImage();
+
+    QPixmap pixmap(display.size());
+    QBENCHMARK {
+        display.render(&pixmap);
+    }
+}
+
+QTEST_KDEMAIN( TerminalDisplayTest , GUI )
+
+#include "TerminalDisplayTest.moc"